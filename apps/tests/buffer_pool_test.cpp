@@ -0,0 +1,94 @@
+#include <adq/util/BufferPool.hpp>
+
+// These checks are the test, so keep them in release builds too
+#undef NDEBUG
+#include <cassert>
+#include <cstddef>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using adq::util::BufferPool;
+
+void test_size_classes() {
+    assert(BufferPool::size_class_for(0) == 0);
+    assert(BufferPool::size_class_for(1) == 0);
+    assert(BufferPool::size_class_for(BufferPool::MIN_BUFFER_SIZE) == 0);
+    assert(BufferPool::size_class_for(BufferPool::MIN_BUFFER_SIZE + 1) == 1);
+    assert(BufferPool::size_class_for(2 * BufferPool::MIN_BUFFER_SIZE) == 1);
+    assert(BufferPool::size_class_for(3 * BufferPool::MIN_BUFFER_SIZE) == 2);
+    assert(BufferPool::size_class_for(BufferPool::MAX_BUFFER_SIZE) == BufferPool::NUM_SIZE_CLASSES - 1);
+    assert(BufferPool::size_class_for(BufferPool::MAX_BUFFER_SIZE + 1) == BufferPool::NUM_SIZE_CLASSES - 1);
+
+    BufferPool& pool = BufferPool::getInstance();
+    assert(pool.acquire(0)->size() == BufferPool::MIN_BUFFER_SIZE);
+    assert(pool.acquire(BufferPool::MIN_BUFFER_SIZE)->size() == BufferPool::MIN_BUFFER_SIZE);
+    assert(pool.acquire(BufferPool::MIN_BUFFER_SIZE + 1)->size() == 2 * BufferPool::MIN_BUFFER_SIZE);
+    assert(pool.acquire(5000)->size() == 8192);
+    assert(pool.acquire(BufferPool::MAX_BUFFER_SIZE)->size() == BufferPool::MAX_BUFFER_SIZE);
+    // Larger than any class: allocated at exactly the requested size
+    assert(pool.acquire(BufferPool::MAX_BUFFER_SIZE + 1)->size() == BufferPool::MAX_BUFFER_SIZE + 1);
+    std::cout << "Requests rounded up to their size classes" << std::endl;
+}
+
+void test_reuse_and_accounting() {
+    BufferPool& pool = BufferPool::getInstance();
+    const BufferPool::Metrics before = pool.get_metrics();
+    {
+        auto buffer = pool.acquire(1000);
+        assert(pool.get_metrics().bytes_in_use == before.bytes_in_use + buffer->size());
+    }
+    assert(pool.get_metrics().bytes_in_use == before.bytes_in_use);
+    // The buffer just released is in this thread's cache, so the next one of its class is recycled
+    const BufferPool::Metrics after_release = pool.get_metrics();
+    auto buffer = pool.acquire(1000);
+    const BufferPool::Metrics after_reuse = pool.get_metrics();
+    assert(after_reuse.reuses == after_release.reuses + 1);
+    assert(after_reuse.heap_allocations == after_release.heap_allocations);
+    assert(after_reuse.peak_bytes_in_use >= after_reuse.bytes_in_use);
+    std::cout << "Released buffer reused" << std::endl;
+}
+
+/**
+ * Acquires and then releases some buffers of one size on a new thread, and
+ * checks how many of them the thread kept in its cache rather than giving
+ * back to the shared free list, and that it gives them back when it exits.
+ */
+void check_thread_cache(std::size_t buffer_size, std::size_t num_buffers, std::size_t expected_cached) {
+    BufferPool& pool = BufferPool::getInstance();
+    std::size_t free_after_release;
+    std::thread worker([&]() {
+        std::vector<std::shared_ptr<BufferPool::Buffer>> buffers;
+        for(std::size_t i = 0; i < num_buffers; ++i) {
+            buffers.emplace_back(pool.acquire(buffer_size));
+        }
+        const std::size_t free_before_release = pool.get_metrics().bytes_free;
+        buffers.clear();
+        free_after_release = pool.get_metrics().bytes_free;
+        assert(free_after_release - free_before_release == (num_buffers - expected_cached) * buffer_size);
+    });
+    worker.join();
+    assert(pool.get_metrics().bytes_free == free_after_release + expected_cached * buffer_size);
+}
+
+void test_thread_cache_byte_cap() {
+    // A small class is cached up to THREAD_CACHE_SIZE buffers; releasing one more gives all but half back.
+    // Each case uses a class no other thread has freed buffers of, so acquire() can't refill the cache.
+    check_thread_cache(BufferPool::MIN_BUFFER_SIZE, BufferPool::THREAD_CACHE_SIZE, BufferPool::THREAD_CACHE_SIZE);
+    check_thread_cache(2 * BufferPool::MIN_BUFFER_SIZE, BufferPool::THREAD_CACHE_SIZE + 1, BufferPool::THREAD_CACHE_SIZE / 2);
+    // A class whose buffers are half the byte cap is cached only 2 at a time
+    check_thread_cache(BufferPool::MAX_THREAD_CACHE_BYTES_PER_CLASS / 2, 2, 2);
+    // A class whose buffers are a quarter of the byte cap is cached 4 at a time, so overflowing it keeps 2
+    check_thread_cache(BufferPool::MAX_THREAD_CACHE_BYTES_PER_CLASS / 4, 5, 2);
+    // A class larger than the byte cap is never cached
+    check_thread_cache(2 * BufferPool::MAX_THREAD_CACHE_BYTES_PER_CLASS, 3, 0);
+    std::cout << "Thread caches limited by bytes" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    test_size_classes();
+    test_reuse_and_accounting();
+    test_thread_cache_byte_cap();
+    return 0;
+}
@@ -0,0 +1,152 @@
+#include <adq/core/FailureDetector.hpp>
+
+// These checks are the test, so keep them in release builds too
+#undef NDEBUG
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+using adq::FailureDetector;
+using namespace std::chrono_literals;
+
+const std::chrono::milliseconds DEFAULT_ROUND_TRIP_TIME = 100ms;
+const int NUM_PEERS = 10;
+
+/** Measures one round trip to a peer that takes (at least) the given time to answer */
+void probe(FailureDetector& detector, int peer_id, std::chrono::milliseconds round_trip_time, bool is_response = false) {
+    detector.record_probe_sent(peer_id);
+    std::this_thread::sleep_for(round_trip_time);
+    if(is_response) {
+        detector.record_response(peer_id);
+    } else {
+        detector.record_probe_answered(peer_id);
+    }
+}
+
+void test_phi() {
+    FailureDetector detector(DEFAULT_ROUND_TRIP_TIME, 0, NUM_PEERS - 1);
+    const int peer = 1;
+    assert(detector.phi(peer) == 0);
+    assert(detector.time_since_arrival(peer) == FailureDetector::clock_type::duration::max());
+    // A peer heard from every 50ms
+    for(int i = 0; i < 10; ++i) {
+        detector.record_arrival(peer);
+        std::this_thread::sleep_for(50ms);
+    }
+    detector.record_arrival(peer);
+    const double phi_on_time = detector.phi(peer);
+    std::this_thread::sleep_for(60ms);
+    const double phi_late = detector.phi(peer);
+    std::this_thread::sleep_for(440ms);
+    const double phi_silent = detector.phi(peer);
+    std::cout << "Phi on time: " << phi_on_time << ", a little late: " << phi_late
+              << ", long silent: " << phi_silent << std::endl;
+    assert(phi_on_time < phi_late && phi_late < phi_silent);
+    assert(phi_late < FailureDetector::PHI_THRESHOLD);
+    assert(phi_silent > FailureDetector::PHI_THRESHOLD);
+    assert(detector.is_suspected(peer));
+    assert(detector.time_since_arrival(peer) >= 500ms);
+    // Hearing from the peer again clears the suspicion
+    detector.record_arrival(peer);
+    assert(!detector.is_suspected(peer));
+    std::cout << "Phi grows with silence" << std::endl;
+}
+
+void test_round_trip_fallback() {
+    FailureDetector detector(DEFAULT_ROUND_TRIP_TIME, 0, NUM_PEERS - 1);
+    const int slow_peer = 1;
+    const int fast_peer = 2;
+    const int new_peer = 3;
+    // No samples at all: the default
+    assert(detector.round_trip_percentile(0.99) == DEFAULT_ROUND_TRIP_TIME);
+    assert(detector.round_trip_percentile(slow_peer, 0.99) == DEFAULT_ROUND_TRIP_TIME);
+    for(std::size_t i = 0; i < FailureDetector::MIN_SAMPLES - 1; ++i) {
+        probe(detector, slow_peer, 30ms);
+    }
+    // Too few samples for either the peer or the shared pool
+    assert(detector.round_trip_percentile(slow_peer, 0.99) == DEFAULT_ROUND_TRIP_TIME);
+    probe(detector, slow_peer, 30ms);
+    // Enough for the peer's own history, which also fills the shared pool for a peer without one
+    const auto slow_round_trip = detector.round_trip_percentile(slow_peer, 0.99);
+    assert(slow_round_trip >= 30ms && slow_round_trip < DEFAULT_ROUND_TRIP_TIME);
+    assert(detector.round_trip_percentile(new_peer, 0.99) == detector.round_trip_percentile(0.99));
+    assert(detector.round_trip_percentile(new_peer, 0.99) >= 30ms);
+    for(std::size_t i = 0; i < FailureDetector::MIN_SAMPLES; ++i) {
+        probe(detector, fast_peer, 0ms);
+    }
+    // The fast peer's own history now takes precedence over the shared pool
+    assert(detector.round_trip_percentile(fast_peer, 0.99) < 10ms);
+    assert(detector.round_trip_percentile(slow_peer, 0.99) >= 30ms);
+    assert(detector.round_trip_percentile(0.99) >= 30ms);
+    assert(detector.round_trip_percentile(0.1) < 10ms);
+    std::cout << "Round-trip times fall back from peer to pool to default" << std::endl;
+}
+
+void test_response_times() {
+    FailureDetector detector(DEFAULT_ROUND_TRIP_TIME, 0, NUM_PEERS - 1);
+    // Like the utility's query timeout, which starts at the default and adapts as meters respond
+    assert(detector.response_time_percentile(0.99) == DEFAULT_ROUND_TRIP_TIME);
+    for(int peer = 0; peer < static_cast<int>(FailureDetector::MIN_SAMPLES); ++peer) {
+        assert(detector.response_time_percentile(0.99) == DEFAULT_ROUND_TRIP_TIME);
+        probe(detector, peer, 20ms, true);
+    }
+    const auto response_time = detector.response_time_percentile(0.99);
+    assert(response_time >= 20ms && response_time < DEFAULT_ROUND_TRIP_TIME);
+    // Responses don't count as network round trips
+    assert(detector.round_trip_percentile(0.99) == DEFAULT_ROUND_TRIP_TIME);
+    // Once there are network round trips, they are the fallback for too few responses
+    FailureDetector network_only(DEFAULT_ROUND_TRIP_TIME, 0, NUM_PEERS - 1);
+    for(int peer = 0; peer < static_cast<int>(FailureDetector::MIN_SAMPLES); ++peer) {
+        probe(network_only, peer, 0ms);
+    }
+    assert(network_only.response_time_percentile(0.99) == network_only.round_trip_percentile(0.99));
+    assert(network_only.response_time_percentile(0.99) < 10ms);
+    std::cout << "Response times adapt separately from round trips" << std::endl;
+}
+
+void test_probe_expiry() {
+    FailureDetector detector(DEFAULT_ROUND_TRIP_TIME, 0, NUM_PEERS - 1);
+    const int answered_late = 1;
+    const int probed_again = 2;
+    for(std::size_t i = 0; i < FailureDetector::MIN_SAMPLES - 1; ++i) {
+        probe(detector, answered_late, 0ms);
+        probe(detector, probed_again, 0ms);
+    }
+    detector.record_probe_sent(answered_late);
+    detector.record_probe_sent(probed_again);
+    std::cout << "Waiting for probes to expire..." << std::endl;
+    std::this_thread::sleep_for(FailureDetector::PROBE_EXPIRY + 100ms);
+    // An answer to an expired probe yields no sample, neither for the peer nor for the shared pool
+    detector.record_probe_answered(answered_late);
+    assert(detector.round_trip_percentile(answered_late, 0.99) < 10ms);
+    assert(detector.round_trip_percentile(0.99) < 10ms);
+    // A probe sent after the last one expired restarts the measurement
+    detector.record_probe_sent(probed_again);
+    detector.record_probe_answered(probed_again);
+    assert(detector.round_trip_percentile(probed_again, 0.99) < 10ms);
+    std::cout << "Expired probes ignored" << std::endl;
+}
+
+void test_unknown_peers() {
+    FailureDetector detector(DEFAULT_ROUND_TRIP_TIME, 0, NUM_PEERS - 1);
+    for(int peer : {-1, NUM_PEERS}) {
+        detector.record_arrival(peer);
+        for(std::size_t i = 0; i < FailureDetector::MIN_SAMPLES; ++i) {
+            probe(detector, peer, 0ms);
+        }
+        assert(detector.phi(peer) == 0);
+        assert(detector.time_since_arrival(peer) == FailureDetector::clock_type::duration::max());
+    }
+    assert(detector.round_trip_percentile(0.99) == DEFAULT_ROUND_TRIP_TIME);
+    std::cout << "Peers outside the ID range ignored" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    test_phi();
+    test_round_trip_fallback();
+    test_response_times();
+    test_unknown_peers();
+    test_probe_expiry();
+    return 0;
+}
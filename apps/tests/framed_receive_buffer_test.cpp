@@ -0,0 +1,144 @@
+#include <adq/util/FramedReceiveBuffer.hpp>
+
+// These checks are the test, so keep them in release builds too
+#undef NDEBUG
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+using adq::util::FramedReceiveBuffer;
+
+/** @return The bytes of a frame with the given body, including its header */
+std::vector<uint8_t> make_frame(const std::vector<uint8_t>& body) {
+    std::vector<uint8_t> frame(sizeof(FramedReceiveBuffer::frame_size_t) + body.size());
+    const FramedReceiveBuffer::frame_size_t body_size = body.size();
+    std::memcpy(frame.data(), &body_size, sizeof(body_size));
+    std::copy(body.begin(), body.end(), frame.begin() + sizeof(body_size));
+    return frame;
+}
+
+/** Receives some bytes into the buffer the way a socket read would, in as many reads as it takes */
+void receive(FramedReceiveBuffer& buffer, const uint8_t* bytes, std::size_t size) {
+    while(size > 0) {
+        uint8_t* free_space = buffer.prepare();
+        const std::size_t read_size = std::min(size, buffer.free_space());
+        std::memcpy(free_space, bytes, read_size);
+        buffer.commit(read_size);
+        bytes += read_size;
+        size -= read_size;
+    }
+}
+
+void test_split_frame() {
+    FramedReceiveBuffer buffer;
+    const std::vector<uint8_t> body = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+    const std::vector<uint8_t> frame = make_frame(body);
+    const uint8_t* frame_body;
+    std::size_t frame_size;
+    // Half of the header, then the rest of the header and half of the body, then the rest
+    const std::size_t split_points[] = {sizeof(FramedReceiveBuffer::frame_size_t) / 2,
+                                        sizeof(FramedReceiveBuffer::frame_size_t) + body.size() / 2,
+                                        frame.size()};
+    std::size_t received = 0;
+    for(std::size_t split_point : split_points) {
+        assert(!buffer.next_frame(frame_body, frame_size));
+        receive(buffer, frame.data() + received, split_point - received);
+        received = split_point;
+    }
+    assert(buffer.next_frame(frame_body, frame_size));
+    assert(frame_size == body.size());
+    assert(std::equal(body.begin(), body.end(), frame_body));
+    assert(buffer.bytes_buffered() == 0);
+    assert(!buffer.next_frame(frame_body, frame_size));
+    std::cout << "Split frame reassembled" << std::endl;
+}
+
+void test_frames_in_one_read() {
+    FramedReceiveBuffer buffer;
+    std::vector<uint8_t> bytes = make_frame({1, 2, 3});
+    const std::vector<uint8_t> second_frame = make_frame({4, 5});
+    bytes.insert(bytes.end(), second_frame.begin(), second_frame.end());
+    // Part of a third frame's header
+    bytes.push_back(0);
+    receive(buffer, bytes.data(), bytes.size());
+    const uint8_t* frame_body;
+    std::size_t frame_size;
+    assert(buffer.next_frame(frame_body, frame_size));
+    assert(frame_size == 3 && frame_body[0] == 1 && frame_body[2] == 3);
+    assert(buffer.next_frame(frame_body, frame_size));
+    assert(frame_size == 2 && frame_body[0] == 4 && frame_body[1] == 5);
+    assert(!buffer.next_frame(frame_body, frame_size));
+    assert(buffer.bytes_buffered() == 1);
+    std::cout << "Two frames parsed from one read" << std::endl;
+}
+
+void test_zero_length_frame() {
+    FramedReceiveBuffer buffer;
+    std::vector<uint8_t> bytes = make_frame({});
+    const std::vector<uint8_t> next_frame = make_frame({42});
+    bytes.insert(bytes.end(), next_frame.begin(), next_frame.end());
+    receive(buffer, bytes.data(), bytes.size());
+    const uint8_t* frame_body;
+    std::size_t frame_size;
+    assert(buffer.next_frame(frame_body, frame_size));
+    assert(frame_size == 0);
+    assert(buffer.next_frame(frame_body, frame_size));
+    assert(frame_size == 1 && frame_body[0] == 42);
+    std::cout << "Zero-length frame parsed" << std::endl;
+}
+
+void test_oversized_frame() {
+    FramedReceiveBuffer buffer;
+    const FramedReceiveBuffer::frame_size_t body_size = FramedReceiveBuffer::MAX_FRAME_SIZE + 1;
+    std::vector<uint8_t> header(sizeof(body_size));
+    std::memcpy(header.data(), &body_size, sizeof(body_size));
+    receive(buffer, header.data(), header.size());
+    const uint8_t* frame_body;
+    std::size_t frame_size;
+    assert(buffer.has_oversized_frame());
+    assert(!buffer.next_frame(frame_body, frame_size));
+    // prepare() must not try to make room for the whole frame
+    buffer.prepare();
+    assert(buffer.free_space() < FramedReceiveBuffer::MAX_FRAME_SIZE);
+    buffer.clear();
+    assert(!buffer.has_oversized_frame());
+
+    // The largest allowed frame is still accepted
+    const std::vector<uint8_t> largest_frame = make_frame(std::vector<uint8_t>(FramedReceiveBuffer::MAX_FRAME_SIZE, 7));
+    receive(buffer, largest_frame.data(), largest_frame.size());
+    assert(!buffer.has_oversized_frame());
+    assert(buffer.next_frame(frame_body, frame_size));
+    assert(frame_size == FramedReceiveBuffer::MAX_FRAME_SIZE);
+    assert(frame_body[frame_size - 1] == 7);
+    std::cout << "Oversized frame rejected" << std::endl;
+}
+
+void test_shared_frame_survives_prepare() {
+    FramedReceiveBuffer buffer(FramedReceiveBuffer::MIN_READ_SIZE);
+    const std::vector<uint8_t> frame = make_frame({9, 8, 7});
+    receive(buffer, frame.data(), frame.size());
+    const uint8_t* frame_body;
+    std::size_t frame_size;
+    assert(buffer.next_frame(frame_body, frame_size));
+    std::shared_ptr<const uint8_t> shared_body = buffer.share_frame(frame_body);
+    // Enough new bytes to overwrite the start of the old storage, if it were reused
+    const std::vector<uint8_t> next_frame = make_frame(std::vector<uint8_t>(FramedReceiveBuffer::MIN_READ_SIZE, 0));
+    receive(buffer, next_frame.data(), next_frame.size());
+    assert(shared_body.get()[0] == 9 && shared_body.get()[2] == 7);
+    assert(buffer.next_frame(frame_body, frame_size));
+    assert(frame_size == FramedReceiveBuffer::MIN_READ_SIZE);
+    std::cout << "Shared frame kept its bytes" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    test_split_frame();
+    test_frames_in_one_read();
+    test_zero_length_frame();
+    test_oversized_frame();
+    test_shared_frame_survives_prepare();
+    return 0;
+}
@@ -0,0 +1,69 @@
+#include <adq/util/OverlaySchedule.hpp>
+
+// These checks are the test, so keep them in release builds too
+#undef NDEBUG
+#include <cassert>
+#include <climits>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+using adq::util::OverlaySchedule;
+
+/**
+ * The modular exponentiation that gossip_target used before OverlaySchedule,
+ * with its intermediate products widened to 64 bits (the original overflowed
+ * for moduli above 65536). The round was passed to it as a uint32_t.
+ */
+uint32_t mod_pow(uint64_t num, uint32_t pow, uint64_t mod) {
+    uint64_t result = 1;
+    while(pow > 0) {
+        if(pow & 1)
+            result = (result * num) % mod;
+        num = (num * num) % mod;
+        pow >>= 1;
+    }
+    return result;
+}
+
+int reference_gossip_target(int source_id, int round, int num_nodes) {
+    return (source_id + mod_pow(2, round, num_nodes)) % num_nodes;
+}
+
+int reference_gossip_predecessor(int target_id, int round, int num_nodes) {
+    const int offset = mod_pow(2, round, num_nodes);
+    return ((target_id - offset) % num_nodes) + ((target_id >= offset) ? 0 : num_nodes);
+}
+
+void check_schedule(int num_nodes) {
+    const OverlaySchedule& schedule = OverlaySchedule::for_num_nodes(num_nodes);
+    assert(&schedule == &OverlaySchedule::for_num_nodes(num_nodes));
+    assert(schedule.get_num_nodes() == num_nodes);
+    std::vector<int> rounds = {INT_MIN, INT_MIN + 1, -65536, -65537, INT_MAX, INT_MAX - 1, 1 << 20};
+    for(int round = -2 * num_nodes - 70; round < 2 * num_nodes + 70; round += (num_nodes > 1000 ? 97 : 1)) {
+        rounds.push_back(round);
+    }
+    const std::vector<int> node_ids = {0, 1, num_nodes / 2, num_nodes - 2, num_nodes - 1};
+    for(int round : rounds) {
+        for(int node_id : node_ids) {
+            const int target = schedule.gossip_target(node_id, round);
+            assert(target == reference_gossip_target(node_id, round, num_nodes));
+            assert(schedule.gossip_predecessor(node_id, round) == reference_gossip_predecessor(node_id, round, num_nodes));
+            assert(schedule.gossip_predecessor(target, round) == node_id);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    const int powers_of_two[] = {2, 4, 8, 64, 1024, 65536, 1 << 20};
+    const int other_sizes[] = {3, 5, 6, 7, 12, 100, 1000, 65537, 100003, 1000000};
+    for(int num_nodes : powers_of_two) {
+        check_schedule(num_nodes);
+    }
+    std::cout << "Schedules for power-of-two sizes match" << std::endl;
+    for(int num_nodes : other_sizes) {
+        check_schedule(num_nodes);
+    }
+    std::cout << "Schedules for other sizes match" << std::endl;
+    return 0;
+}
@@ -0,0 +1,123 @@
+#include <adq/util/SharedMemoryRing.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// These checks are the test, so keep them in release builds too
+#undef NDEBUG
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <iostream>
+#include <numeric>
+#include <string>
+#include <system_error>
+#include <vector>
+
+using adq::util::SharedMemoryRing;
+
+/** The layout of SharedMemoryRing's header, so the tests can corrupt it the way a faulty peer might */
+struct RingHeader {
+    std::atomic<std::uint64_t> write_position;
+    std::atomic<std::uint64_t> read_position;
+    std::atomic<bool> reader_waiting;
+    std::atomic<bool> writer_waiting;
+    std::uint64_t capacity;
+};
+
+const std::string RING_NAME = "/adq_ring_test_" + std::to_string(getpid());
+
+/** Maps the start of the test ring's segment directly, bypassing SharedMemoryRing */
+RingHeader* map_header() {
+    int fd = shm_open(RING_NAME.c_str(), O_RDWR, 0);
+    assert(fd >= 0);
+    void* mapping = mmap(nullptr, sizeof(RingHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    assert(mapping != MAP_FAILED);
+    return static_cast<RingHeader*>(mapping);
+}
+
+/** @return The errno of the std::system_error thrown by opening the test ring, or 0 if it opened */
+int open_error() {
+    try {
+        SharedMemoryRing::open(RING_NAME);
+    } catch(const std::system_error& e) {
+        return e.code().value();
+    }
+    return 0;
+}
+
+void test_wraparound() {
+    // A capacity that doesn't divide evenly into the writes, so they wrap at different offsets
+    const std::size_t capacity = 100;
+    auto writer = SharedMemoryRing::create(RING_NAME, capacity);
+    auto reader = SharedMemoryRing::open(RING_NAME);
+    std::vector<uint8_t> bytes(capacity + 50);
+    std::iota(bytes.begin(), bytes.end(), 0);
+    std::vector<uint8_t> received(bytes.size());
+    uint8_t next_expected = 0;
+    for(std::size_t chunk_size : {70, 60, 99, 1, 100, 37}) {
+        std::vector<uint8_t> chunk(chunk_size);
+        std::iota(chunk.begin(), chunk.end(), next_expected);
+        assert(writer->write(chunk.data(), chunk_size) == chunk_size);
+        assert(reader->bytes_available() == chunk_size);
+        assert(writer->free_space() == capacity - chunk_size);
+        assert(reader->read(received.data(), received.size()) == chunk_size);
+        for(std::size_t i = 0; i < chunk_size; ++i) {
+            assert(received[i] == static_cast<uint8_t>(next_expected + i));
+        }
+        next_expected += chunk_size;
+        assert(reader->bytes_available() == 0);
+    }
+    // A write larger than the free space is cut short, and a read smaller than what is available leaves the rest
+    assert(writer->write(bytes.data(), bytes.size()) == capacity);
+    assert(writer->free_space() == 0);
+    assert(writer->write(bytes.data(), 1) == 0);
+    assert(reader->read(received.data(), 30) == 30);
+    assert(writer->free_space() == 30);
+    assert(reader->read(received.data() + 30, received.size()) == capacity - 30);
+    for(std::size_t i = 0; i < capacity; ++i) {
+        assert(received[i] == bytes[i]);
+    }
+    writer->unlink();
+    std::cout << "Ring wraps around" << std::endl;
+}
+
+void test_bad_header() {
+    const std::size_t capacity = 4096;
+    auto writer = SharedMemoryRing::create(RING_NAME, capacity);
+    RingHeader* header = map_header();
+    header->capacity = 0;
+    assert(open_error() == EINVAL);
+    header->capacity = capacity + 1;
+    assert(open_error() == EINVAL);
+    header->capacity = UINT64_MAX;
+    assert(open_error() == EINVAL);
+    header->capacity = capacity;
+    auto reader = SharedMemoryRing::open(RING_NAME);
+    // Positions the other side can't have reached are clamped to the capacity
+    header->write_position = UINT64_MAX / 2;
+    assert(reader->bytes_available() == capacity);
+    assert(writer->free_space() == 0);
+    munmap(header, sizeof(RingHeader));
+    writer->unlink();
+
+    // A segment too small to hold a header
+    int fd = shm_open(RING_NAME.c_str(), O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+    assert(fd >= 0);
+    assert(ftruncate(fd, sizeof(RingHeader) / 2) == 0);
+    close(fd);
+    assert(open_error() != 0);
+    shm_unlink(RING_NAME.c_str());
+    assert(open_error() == ENOENT);
+    std::cout << "Bad ring headers rejected" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    test_wraparound();
+    test_bad_header();
+    return 0;
+}
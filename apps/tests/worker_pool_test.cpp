@@ -0,0 +1,94 @@
+#include <adq/util/WorkerPool.hpp>
+
+// These checks are the test, so keep them in release builds too
+#undef NDEBUG
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using adq::util::WorkerPool;
+
+void test_every_index_once() {
+    for(std::size_t num_threads : {0, 1, 3, 8}) {
+        WorkerPool pool(num_threads);
+        assert(pool.get_num_threads() == num_threads);
+        for(std::size_t count : {0, 1, 2, 1000}) {
+            std::vector<std::atomic<int>> calls(count);
+            pool.parallel_for(count, [&](std::size_t index) { ++calls[index]; });
+            for(const auto& num_calls : calls) {
+                assert(num_calls == 1);
+            }
+        }
+    }
+    std::cout << "Every index called exactly once" << std::endl;
+}
+
+void test_caller_participates() {
+    // With no pool threads, everything runs on the caller
+    WorkerPool empty_pool(0);
+    const std::thread::id caller = std::this_thread::get_id();
+    empty_pool.parallel_for(10, [&](std::size_t) { assert(std::this_thread::get_id() == caller); });
+
+    // Every pool thread blocks in its first call until the caller has run one,
+    // so this only finishes (in time) if the caller claims work of its own
+    const std::size_t num_threads = 4;
+    WorkerPool pool(num_threads);
+    std::mutex caller_ran_mutex;
+    std::condition_variable caller_ran_changed;
+    bool caller_ran = false;
+    std::atomic<bool> timed_out{false};
+    pool.parallel_for(num_threads + 1, [&](std::size_t) {
+        std::unique_lock<std::mutex> lock(caller_ran_mutex);
+        if(std::this_thread::get_id() == caller) {
+            caller_ran = true;
+            caller_ran_changed.notify_all();
+        } else if(!caller_ran_changed.wait_for(lock, std::chrono::seconds(10), [&]() { return caller_ran; })) {
+            timed_out = true;
+        }
+    });
+    assert(caller_ran);
+    assert(!timed_out);
+    std::cout << "Caller works on its own call" << std::endl;
+}
+
+void test_exception_propagation() {
+    WorkerPool pool(3);
+    const std::size_t count = 100;
+    std::atomic<std::size_t> num_finished{0};
+    bool caught = false;
+    try {
+        pool.parallel_for(count, [&](std::size_t index) {
+            if(index == 10 || index == 50) {
+                throw std::runtime_error("index " + std::to_string(index));
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            ++num_finished;
+        });
+    } catch(const std::runtime_error& e) {
+        caught = true;
+        const std::string message = e.what();
+        assert(message == "index 10" || message == "index 50");
+        // The exception is only rethrown after every other call has finished
+        assert(num_finished == count - 2);
+    }
+    assert(caught);
+    // The pool is still usable afterwards
+    std::atomic<std::size_t> num_calls{0};
+    pool.parallel_for(count, [&](std::size_t) { ++num_calls; });
+    assert(num_calls == count);
+    std::cout << "Exceptions rethrown after all calls finish" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    test_every_index_once();
+    test_caller_participates();
+    test_exception_propagation();
+    return 0;
+}
@@ -110,6 +110,93 @@ public:
      * when searching for a client's key.
      */
     static const std::string CLIENT_KEY_FILE_PREFIX;
+    /**
+     * The number of threads that will run the network I/O loop, receiving and
+     * deserializing messages. Optional; if it is not present, one thread is used.
+     */
+    static const std::string NUM_NETWORK_THREADS;
+    /**
+     * The number of extra threads that help with public-key encryption when
+     * a client builds its onions at the start of a query. Optional; if it is
+     * not present, one fewer than the number of hardware threads is used.
+     */
+    static const std::string NUM_CRYPTO_THREADS;
+    /**
+     * The maximum number of sockets a client or server will keep open at once.
+     * Optional; the least recently used outgoing connection is closed when the
+     * limit is reached.
+     */
+    static const std::string MAX_OPEN_CONNECTIONS;
+    /** The time (ms) after which an unused outgoing connection is closed. Optional. */
+    static const std::string CONNECTION_IDLE_TIMEOUT;
+    /**
+     * Whether pings and empty round markers should be sent as UDP datagrams
+     * rather than over TCP connections. Optional; defaults to false. Datagrams
+     * are always accepted, so clients with different settings can interoperate.
+     */
+    static const std::string UDP_CONTROL_MESSAGES;
+    /** The time (ms) between retransmissions of a ping sent over UDP that has not been answered. Optional. */
+    static const std::string UDP_RETRY_INTERVAL;
+    /**
+     * The directory in which Unix-domain sockets are created for clients that
+     * use the Unix or shared-memory transports. Optional; defaults to /tmp.
+     */
+    static const std::string LOCAL_TRANSPORT_DIR;
+    /** The size (bytes) of each shared-memory ring buffer. Optional. */
+    static const std::string SHARED_MEMORY_RING_SIZE;
+    /**
+     * Whether TCP connections should be handled with io_uring instead of the
+     * ASIO reactor, on Linux kernels that support it. Optional; defaults to false.
+     */
+    static const std::string USE_IO_URING;
+    /** The most bytes (of outgoing messages) that may be queued for any one peer. Optional; defaults to no limit. */
+    static const std::string PEER_SEND_BUDGET;
+    /** The most bytes (of outgoing messages) that may be queued for all peers combined. Optional; defaults to no limit. */
+    static const std::string TOTAL_SEND_BUDGET;
+    /**
+     * What to do with a message that would exceed a send budget: "block" the
+     * sender until there is room, "drop" it if it is a dummy message, or
+     * "fail" the recipient. Optional; defaults to "fail". Messages that can't
+     * be blocked or dropped are handled as "fail". "block" requires
+     * NUM_NETWORK_THREADS to be at least 2.
+     */
+    static const std::string SEND_BUDGET_POLICY;
+    /** The longest (ms) a sender will wait for room under the "block" policy. Optional. */
+    static const std::string SEND_BLOCK_TIMEOUT;
+    /**
+     * The path to a file of simulated delays, bandwidth limits, drops, and
+     * resets to apply to messages sent to other clients, for benchmarking.
+     * Optional; if it is not set, messages are sent normally.
+     */
+    static const std::string FAULT_INJECTION_FILE;
+    /** The seed for the random choices made when injecting faults. Optional; defaults to 0. */
+    static const std::string FAULT_INJECTION_SEED;
+    /**
+     * The number of queries the server will run at once when it is given a
+     * batch of queries; clients keep state for a few times this many queries.
+     * Optional; defaults to ProtocolState::DEFAULT_MAX_CONCURRENT_QUERIES.
+     */
+    static const std::string MAX_CONCURRENT_QUERIES;
+    /**
+     * How many overlay rounds ahead of its own round a client will buffer
+     * messages from faster peers; messages further ahead are discarded.
+     * Optional; defaults to ProtocolState::DEFAULT_FUTURE_ROUND_HORIZON.
+     */
+    static const std::string FUTURE_ROUND_HORIZON;
+};
+
+/**
+ * The ways a client can be reached by other clients on the same host, in
+ * addition to TCP.
+ */
+enum class TransportType { TCP,
+                           UNIX,
+                           SHARED_MEMORY };
+
+/** One entry in the client list: where a client listens, and which transport to use to reach it. */
+struct PeerAddress {
+    asio::ip::tcp::endpoint endpoint;
+    TransportType transport;
 };
 
 // Some stand-alone utility methods that help construct configuration data from the properties
@@ -121,6 +208,17 @@ public:
  */
 std::map<int, asio::ip::tcp::endpoint> read_ip_map_from_file(const std::string& client_list_file);
 
+/**
+ * Parses a client-list file in the same format as read_ip_map_from_file,
+ * where each line may also have a fourth column naming the transport that
+ * should be used to reach that device: "tcp" (the default), "unix", or "shm".
+ * The local transports can only be used by clients on the same host.
+ *
+ * @return A map from device ID to that device's address and transport
+ * @throws std::invalid_argument if a line names an unknown transport
+ */
+std::map<int, PeerAddress> read_peer_list_from_file(const std::string& client_list_file);
+
 /**
  * Constructs a path to the (expected) public key file of each client, given
  * a base path (to the folder the keys should be in) and the total number of
@@ -45,12 +45,27 @@ public:
 
     /**
      * Encrypts the body of an OverlayMessage under the public key of the given client.
+     * This only reads the public keys, so it can be called from several threads at once.
      * @param message The message to encrypt; after calling this method, its body will be encrypted
      * @param target_id The ID of the client whose public key should be used to encrypt
      */
     template <typename RecordType>
     void rsa_encrypt(messaging::OverlayMessage<RecordType>& message, const int target_id);
 
+    /**
+     * Encrypts the body of an OverlayMessage under the public key of the given
+     * client, using a serialized copy of the body that the caller has already
+     * made. When the same body is sent to several clients, this allows it to
+     * be serialized once instead of once per client.
+     * @param message The message to encrypt; after calling this method, its body will be encrypted
+     * @param body_bytes The serialized form of the message's body
+     * @param body_size The number of bytes in body_bytes
+     * @param target_id The ID of the client whose public key should be used to encrypt
+     */
+    template <typename RecordType>
+    void rsa_encrypt(messaging::OverlayMessage<RecordType>& message, const uint8_t* body_bytes,
+                     std::size_t body_size, const int target_id);
+
     /**
      * Encrypts a ValueTuple under under the public key of the given client.
      * @param value The ValueTuple to encrypt
@@ -72,6 +87,18 @@ public:
     template <typename RecordType>
     void rsa_decrypt(messaging::OverlayMessage<RecordType>& message);
 
+    /**
+     * Decrypts an encrypted message body that is still in serialized form,
+     * such as the payload of a received message that has not been
+     * deserialized, using the private key of the current client.
+     * @param encrypted_body A pointer to the bytes of the ciphertext
+     * @param encrypted_size The number of bytes of ciphertext
+     * @return The decrypted and deserialized message body
+     */
+    template <typename RecordType>
+    std::unique_ptr<messaging::MessageBody<RecordType>> rsa_decrypt(const uint8_t* encrypted_body,
+                                                                    std::size_t encrypted_size);
+
     /**
      * Creates a blinded message representing a ValueTuple, by multiplying
      * its numeric representation by a random value that is invertible under
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <map>
+#include <mutex>
+
+namespace adq {
+
+/**
+ * Keeps track of how quickly, and how regularly, each peer responds, so that
+ * timeouts can be based on measured latency instead of constants.
+ *
+ * Round-trip times are measured from probes: a request whose send time is
+ * recorded with record_probe_sent(), and whose response is recorded with
+ * record_probe_answered(), or with record_response() if answering involved
+ * work on the peer, such as signing, that would make the sample a poor
+ * estimate of network latency to other peers. Separately, every message received from a peer
+ * is recorded as an arrival, and the intervals between arrivals feed a
+ * phi-accrual failure detector (Hayashibara et al., 2004): phi is the
+ * negative log10 of the probability that a live peer would have been silent
+ * for as long as this one has, given the distribution of its past intervals,
+ * so it grows smoothly the longer a peer is silent instead of flipping from
+ * "alive" to "dead" at a fixed timeout.
+ *
+ * Peer IDs come from the network, so only IDs in the range given at
+ * construction are recorded; samples for any other ID are ignored, and
+ * queries about one are answered as for a peer that has not been heard from.
+ *
+ * All methods are thread-safe, since samples come from the network threads
+ * and timeouts are computed on the timer thread.
+ */
+class FailureDetector {
+public:
+    using clock_type = std::chrono::steady_clock;
+
+    /** The number of recent round-trip times and arrival intervals kept for each peer */
+    static constexpr std::size_t HISTORY_SIZE = 64;
+    /** The fewest samples a peer must have before its own history is used rather than every peer's */
+    static constexpr std::size_t MIN_SAMPLES = 4;
+    /** The phi above which a peer is suspected to have failed; 8 means a 1 in 10^8 chance of being wrong */
+    static constexpr double PHI_THRESHOLD = 8.0;
+    /**
+     * The smallest standard deviation assumed for a peer's arrival intervals,
+     * so that a peer whose messages have been very regular is not suspected
+     * as soon as one is slightly late.
+     */
+    static constexpr std::chrono::milliseconds MIN_INTERVAL_STDDEV{10};
+    /** A probe that has been unanswered for this long is assumed lost, and yields no round-trip time */
+    static constexpr std::chrono::seconds PROBE_EXPIRY{10};
+
+private:
+    struct PeerHistory {
+        std::deque<clock_type::duration> round_trip_times;
+        std::deque<clock_type::duration> arrival_intervals;
+        /** The send time of the oldest unanswered probe, if has_probe_outstanding */
+        clock_type::time_point probe_sent_time;
+        bool has_probe_outstanding = false;
+        clock_type::time_point last_arrival;
+        bool has_arrived = false;
+    };
+    mutable std::mutex histories_mutex;
+    std::map<int, PeerHistory> peer_histories;
+    /** The most recent round-trip times measured to any peer, for peers that have too few of their own */
+    std::deque<clock_type::duration> all_round_trip_times;
+    /** The most recent response times recorded with record_response(), from any peer */
+    std::deque<clock_type::duration> all_response_times;
+    /** The round-trip time assumed before any have been measured */
+    const clock_type::duration default_round_trip_time;
+    /** The lowest peer ID whose samples are recorded */
+    const int lowest_peer_id;
+    /** The highest peer ID whose samples are recorded */
+    const int highest_peer_id;
+
+    /** Implements record_probe_answered() and record_response() */
+    void answer_probe(int peer_id, bool shared_sample);
+    /** @return True if samples from this peer ID should be recorded */
+    bool is_known_peer(int peer_id) const;
+    /** Appends a sample to a history, discarding the oldest one if the history is full */
+    static void add_sample(std::deque<clock_type::duration>& history, clock_type::duration sample);
+    /** @return The requested percentile of a non-empty set of samples */
+    static clock_type::duration percentile_of(std::deque<clock_type::duration> samples, double fraction);
+
+public:
+    /**
+     * @param default_round_trip_time The round-trip time to assume for a
+     * peer until at least MIN_SAMPLES have been measured (to any peer)
+     * @param lowest_peer_id The lowest peer ID to record samples for
+     * @param highest_peer_id The highest peer ID to record samples for
+     */
+    FailureDetector(std::chrono::milliseconds default_round_trip_time, int lowest_peer_id, int highest_peer_id);
+
+    /**
+     * Records that a request expecting a response was just sent to a peer. If
+     * an earlier probe is still unanswered (and has not expired), its send time
+     * is kept instead, so a retransmitted probe never makes the round trip look
+     * shorter than it was.
+     * @param peer_id The ID of the peer
+     */
+    void record_probe_sent(int peer_id);
+    /**
+     * Records that the response to a probe arrived from a peer, adding a
+     * round-trip time sample if a probe was outstanding. Also counts as an arrival.
+     * @param peer_id The ID of the peer
+     */
+    void record_probe_answered(int peer_id);
+    /**
+     * Records that the response to a probe arrived from a peer, like
+     * record_probe_answered(), but keeps the round-trip time out of the
+     * samples shared by all peers, because it includes the time the peer
+     * spent working on the response. The sample is pooled with other
+     * response times instead, for response_time_percentile().
+     * @param peer_id The ID of the peer
+     */
+    void record_response(int peer_id);
+    /**
+     * Records that some message arrived from a peer, which shows that it is alive.
+     * @param peer_id The ID of the peer
+     */
+    void record_arrival(int peer_id);
+
+    /**
+     * @param peer_id The ID of a peer
+     * @return The current suspicion level of the peer: 0 if it was just
+     * heard from, growing as it stays silent. A peer that has never been
+     * heard from has a phi of 0, since there is no evidence against it yet.
+     */
+    double phi(int peer_id) const;
+    /** @return True if the peer's phi is above PHI_THRESHOLD */
+    bool is_suspected(int peer_id) const { return phi(peer_id) > PHI_THRESHOLD; }
+    /**
+     * @param peer_id The ID of a peer
+     * @return The time since the last message arrived from the peer, or
+     * clock_type::duration::max() if it has never been heard from
+     */
+    clock_type::duration time_since_arrival(int peer_id) const;
+    /**
+     * @param peer_id The ID of a peer
+     * @param fraction The percentile to compute, between 0 and 1
+     * @return The given percentile of the round-trip times measured to that
+     * peer, or to all peers if it has too few samples of its own, or the
+     * default round-trip time if there are no samples at all
+     */
+    std::chrono::milliseconds round_trip_percentile(int peer_id, double fraction) const;
+    /**
+     * @param fraction The percentile to compute, between 0 and 1
+     * @return The given percentile of the round-trip times recently measured to
+     * any peer, or the default round-trip time if there are too few samples
+     */
+    std::chrono::milliseconds round_trip_percentile(double fraction) const;
+    /**
+     * @param fraction The percentile to compute, between 0 and 1
+     * @return The given percentile of the response times recently recorded
+     * with record_response() for any peer, or round_trip_percentile(fraction)
+     * if there are too few of them
+     */
+    std::chrono::milliseconds response_time_percentile(double fraction) const;
+};
+
+}  // namespace adq
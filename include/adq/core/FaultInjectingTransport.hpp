@@ -0,0 +1,138 @@
+#pragma once
+
+#include "Transport.hpp"
+#include "adq/util/BufferPool.hpp"
+
+#include <asio.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace adq {
+
+/**
+ * The network conditions to simulate for the messages this client sends to
+ * one peer, for benchmarking on a local network.
+ */
+struct FaultProfile {
+    /** The shapes the one-way delay can be drawn from */
+    enum class DelayDistribution { UNIFORM,
+                                   NORMAL,
+                                   PARETO };
+    /** The mean one-way delay added to each write */
+    std::chrono::microseconds delay{0};
+    /**
+     * How much the delay varies: the half-width of a uniform distribution,
+     * the standard deviation of a normal distribution, or the scale of a
+     * Pareto distribution's tail.
+     */
+    std::chrono::microseconds jitter{0};
+    DelayDistribution distribution = DelayDistribution::NORMAL;
+    /** The simulated link's bandwidth, or 0 for no limit */
+    std::uint64_t bandwidth_bytes_per_second = 0;
+    /** The probability that a write (a batch of whole frames) or datagram is silently discarded */
+    double drop_probability = 0;
+    /** The probability that a write resets the connection instead of being sent */
+    double reset_probability = 0;
+
+    /** @return A delay drawn from this profile's distribution, never less than zero */
+    std::chrono::microseconds sample_delay(std::mt19937_64& random_engine) const;
+};
+
+/**
+ * Parses a fault-injection file, which has one rule per line in the form
+ *
+ *     <from-id> <to-id> key=value ...
+ *
+ * where either ID may be "*" to match every client, and the keys are
+ * delay_ms, jitter_ms, distribution (uniform, normal, or pareto),
+ * bandwidth_kbps, drop, and reset. Blank lines and lines starting with '#'
+ * are ignored. Every rule that matches a pair of clients applies, in order,
+ * so a later rule's keys override an earlier one's.
+ *
+ * @param fault_file The path to the file
+ * @param local_id The ID of this client, which selects the rules whose from-ID matches it
+ * @param peer_ids The IDs of every peer, which a "*" to-ID expands to
+ * @return The profile for each peer that has at least one matching rule
+ * @throws std::invalid_argument if a line can't be parsed
+ */
+std::map<int, FaultProfile> read_fault_profiles_from_file(const std::string& fault_file, int local_id,
+                                                          const std::vector<int>& peer_ids);
+
+/**
+ * A Transport that wraps another one and makes its outgoing stream behave
+ * like a slower, lossier link, according to a FaultProfile. Each write is
+ * copied, then delivered to the wrapped transport after a random delay; the
+ * caller's write completes as soon as the simulated link would have finished
+ * transmitting it, so several writes can be in flight at once, and the
+ * stream is still delivered in order. A write can also be dropped entirely,
+ * which is safe because NetworkManager only writes whole frames, or can
+ * reset the connection.
+ *
+ * Reads and connects are passed through unchanged; the peer's own
+ * FaultInjectingTransport simulates the other direction. All randomness comes
+ * from a seed, so a benchmark can be repeated exactly.
+ */
+class FaultInjectingTransport : public Transport {
+private:
+    /** A copy of a write that is waiting for its simulated delay to pass */
+    struct PendingDelivery {
+        std::shared_ptr<util::BufferPool::Buffer> bytes;
+        std::size_t size;
+        std::chrono::steady_clock::time_point deliver_at;
+    };
+    /**
+     * Everything the delayed deliveries use, which is shared with their
+     * handlers so it outlives this object until the last delivery finishes.
+     * Only accessed on the wrapped transport's strand.
+     */
+    struct State {
+        std::unique_ptr<Transport> inner;
+        FaultProfile profile;
+        std::mt19937_64 random_engine;
+        asio::steady_timer transmit_timer;
+        asio::steady_timer delivery_timer;
+        std::deque<PendingDelivery> pending_deliveries;
+        /** When the simulated link will have finished transmitting everything written so far */
+        std::chrono::steady_clock::time_point link_free_at;
+        /** Deliveries never go out earlier than the one before them, so the stream stays in order */
+        std::chrono::steady_clock::time_point last_deliver_at;
+        bool delivery_in_progress;
+        /** Set when close() is called while deliveries are pending; the wrapped transport is closed once they finish */
+        bool close_requested;
+        bool closed;
+        /** An error from a delivery, which is reported by the next write */
+        asio::error_code delivery_error;
+        State(std::unique_ptr<Transport> inner, const FaultProfile& profile, std::uint64_t seed);
+    };
+    std::shared_ptr<State> state;
+
+    /** Writes the next pending delivery to the wrapped transport once it is due */
+    static void deliver_next(const std::shared_ptr<State>& state);
+    /** Closes the wrapped transport and discards anything not yet delivered */
+    static void close_now(const std::shared_ptr<State>& state);
+
+public:
+    /**
+     * @param inner The transport to wrap, which this one takes ownership of
+     * @param profile The conditions to simulate
+     * @param seed The seed for this transport's random choices
+     */
+    FaultInjectingTransport(std::unique_ptr<Transport> inner, const FaultProfile& profile, std::uint64_t seed);
+    ~FaultInjectingTransport();
+
+    asio::any_io_executor get_executor() override { return state->inner->get_executor(); }
+    void async_connect(ConnectHandler handler) override;
+    void async_read_some(asio::mutable_buffer buffer, IoHandler handler) override;
+    void async_write(const std::vector<asio::const_buffer>& buffers, IoHandler handler) override;
+    /** Closes the transport once every delayed write has been delivered, so a graceful close loses nothing */
+    void close() override;
+};
+
+}  // namespace adq
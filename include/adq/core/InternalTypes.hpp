@@ -30,10 +30,14 @@ class AggregationMessage;
 template <typename RecordType>
 class AggregationMessageValue;
 template <typename RecordType>
+class MessageBody;
+template <typename RecordType>
 class OverlayMessage;
 template <typename RecordType>
 class OverlayTransportMessage;
 template <typename RecordType>
+class OverlayTransportMessageView;
+template <typename RecordType>
 class PingMessage;
 template <typename RecordType>
 class QueryRequest;
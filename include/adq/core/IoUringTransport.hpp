@@ -0,0 +1,185 @@
+#pragma once
+
+#include "adq/util/IoUring.hpp"
+
+#ifdef ADQ_HAS_IO_URING
+
+#include "Transport.hpp"
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <asio.hpp>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace adq {
+
+/**
+ * Runs socket operations for many connections through a single io_uring
+ * instance, as part of an ASIO io_context. Operations requested while the
+ * service is busy are collected and submitted together with one system call,
+ * and the kernel signals an eventfd that the io_context watches when any of
+ * them complete.
+ *
+ * All of the ring's state is only accessed on the service's own strand, but
+ * operations can be started and cancelled from any thread.
+ */
+class IoUringService {
+public:
+    /** Fills in a submission queue entry for an operation; its user_data is set by the service */
+    using Preparer = std::function<void(io_uring_sqe&)>;
+    /**
+     * Called on the service's strand with the result of an operation (a
+     * negative errno value on failure) and whether more completions will
+     * follow for the same operation.
+     */
+    using CompletionHandler = std::function<void(int, bool)>;
+
+private:
+    util::IoUring ring;
+    asio::strand<asio::io_context::executor_type> strand;
+    /** The eventfd the kernel signals when completions are posted */
+    asio::posix::stream_descriptor completion_event;
+    std::atomic<std::uint64_t> next_operation_id;
+    /** The handlers of the operations that are in progress, indexed by the ID in their user_data */
+    std::unordered_map<std::uint64_t, CompletionHandler> operations;
+    /** True if a submit() of the queued entries has already been posted to the strand */
+    bool submit_scheduled;
+
+    /** Adds an operation to the submission queue. Must be called on the strand. */
+    void queue_operation(std::uint64_t operation_id, const Preparer& prepare, CompletionHandler handler);
+    /** Submits every queued operation, unless a submit is already scheduled. Must be called on the strand. */
+    void schedule_submit();
+    void submit();
+    void wait_for_completions();
+    /** Dispatches every available completion to its operation's handler. Must be called on the strand. */
+    void reap_completions();
+
+public:
+    /**
+     * @param io_context The io_context that will watch for completions
+     * @param entries The size of the submission queue
+     * @throws std::system_error if io_uring is not available
+     */
+    IoUringService(asio::io_context& io_context, unsigned entries);
+
+    /**
+     * Starts an operation. The submission is batched with any others that are
+     * started before the service's strand next runs.
+     *
+     * @param prepare A function that fills in the operation's submission queue entry
+     * @param handler The function to call on the service's strand when the operation completes
+     * @return An ID that can be used to cancel the operation
+     */
+    std::uint64_t start_operation(Preparer prepare, CompletionHandler handler);
+
+    /** Asks the kernel to cancel an operation, if it is still in progress; its handler is called with -ECANCELED. */
+    void cancel_operation(std::uint64_t operation_id);
+
+    /** The default size of the submission queue */
+    static constexpr unsigned DEFAULT_ENTRIES = 1024;
+};
+
+/**
+ * A TCP Transport whose connect, read, and write operations are performed by
+ * an IoUringService instead of ASIO's reactor. Writes use a single sendmsg
+ * with the whole buffer sequence, and are resubmitted if they are short.
+ */
+class IoUringTransport : public Transport {
+private:
+    IoUringService& service;
+    asio::any_io_executor strand;
+    int socket_fd;
+    /** The peer's address, for an outgoing transport; the kernel reads it during the connect */
+    sockaddr_storage peer_address;
+    socklen_t peer_address_length;
+    /** The ID of this client, which an outgoing transport sends to the peer after connecting */
+    int hello_id;
+    /** The remaining buffers of the write in progress, which the kernel reads during each sendmsg */
+    std::vector<iovec> write_iovecs;
+    std::size_t write_iovec_index;
+    msghdr write_message;
+    std::size_t bytes_written;
+    std::uint64_t read_operation;
+    std::uint64_t write_operation;
+    bool closed;
+
+    /** Submits a sendmsg for the rest of the write in progress */
+    void continue_write(IoHandler handler);
+    /** Posts a handler to this transport's strand */
+    template <typename Handler, typename... Args>
+    void complete(Handler handler, Args... args);
+
+public:
+    /**
+     * Constructs an outgoing transport that has not connected yet.
+     *
+     * @param service The service that will perform this transport's operations
+     * @param strand A new strand for this transport's handlers
+     * @param peer_endpoint The endpoint to connect to
+     * @param hello_id The ID to introduce this client with after connecting
+     */
+    IoUringTransport(IoUringService& service, asio::any_io_executor strand,
+                     const asio::ip::tcp::endpoint& peer_endpoint, int hello_id);
+    /**
+     * Constructs a transport from an accepted socket.
+     *
+     * @param service The service that will perform this transport's operations
+     * @param strand A new strand for this transport's handlers
+     * @param socket_fd The connected socket, which this transport takes ownership of
+     */
+    IoUringTransport(IoUringService& service, asio::any_io_executor strand, int socket_fd);
+    ~IoUringTransport();
+
+    asio::any_io_executor get_executor() override { return strand; }
+    void async_connect(ConnectHandler handler) override;
+    void async_read_some(asio::mutable_buffer buffer, IoHandler handler) override;
+    void async_write(const std::vector<asio::const_buffer>& buffers, IoHandler handler) override;
+    void close() override;
+};
+
+/**
+ * A TransportListener that accepts TCP connections through an IoUringService,
+ * using a single multishot accept if the kernel supports it, so that one
+ * submission accepts every incoming connection. Like SocketListener, it
+ * reads the ID each client sends before handing over the connection.
+ */
+class IoUringListener : public TransportListener {
+private:
+    IoUringService& service;
+    asio::io_context& io_context;
+    int listen_fd;
+    AcceptHandler accept_handler;
+    /** False once the kernel has rejected a multishot accept, so only single accepts are used */
+    bool use_multishot;
+    std::atomic<std::uint64_t> accept_operation;
+    std::atomic<bool> closed;
+
+    void start_accept();
+    /** Handles one accept completion on the service's strand */
+    void handle_accept_completion(int result, bool more);
+    /** Reads the ID of the client that opened an accepted socket, then passes it to accept_handler */
+    void read_hello(int socket_fd);
+
+public:
+    /**
+     * @param service The service that will perform the accepts
+     * @param io_context The io_context that accepted transports will use; each one gets its own strand
+     * @param listen_endpoint The endpoint to listen on
+     * @throws std::system_error if the listening socket could not be created
+     */
+    IoUringListener(IoUringService& service, asio::io_context& io_context, const asio::ip::tcp::endpoint& listen_endpoint);
+    ~IoUringListener();
+
+    void start_accepting(AcceptHandler handler) override;
+    void close() override;
+};
+
+}  // namespace adq
+
+#endif  // ADQ_HAS_IO_URING
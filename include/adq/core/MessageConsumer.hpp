@@ -21,9 +21,12 @@ template <typename RecordType>
 class MessageConsumer {
 public:
     /**
-     * Handles an Overlay message received from a query client or server.
+     * Handles an Overlay message received from a query client or server. Overlay
+     * messages are delivered as views of the receive buffer, rather than
+     * deserialized, so that they can be inspected before deciding whether to
+     * materialize them.
      */
-    virtual void handle_message(std::shared_ptr<messaging::OverlayTransportMessage<RecordType>> message) = 0;
+    virtual void handle_message(std::shared_ptr<messaging::OverlayTransportMessageView<RecordType>> message) = 0;
     /**
      * Handles an aggregation message received from a query client.
      */
@@ -1,21 +1,217 @@
 #pragma once
 
+#include "FaultInjectingTransport.hpp"
 #include "InternalTypes.hpp"
+#include "IoUringTransport.hpp"
 #include "MessageConsumer.hpp"
+#include "Transport.hpp"
+#include "adq/config/Configuration.hpp"
+#include "adq/util/BufferPool.hpp"
+#include "adq/util/FramedReceiveBuffer.hpp"
+#include "adq/util/FramedSendBuffer.hpp"
 
 #include <spdlog/spdlog.h>
 #include <asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <list>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
 
 namespace adq {
 
 template <typename RecordType>
 class NetworkManager {
+public:
+    /**
+     * A snapshot of how much memory is pinned by outgoing frames that have
+     * not finished sending, and how often the send budgets have been exceeded.
+     */
+    struct SendQueueMetrics {
+        /** The bytes of all frames that are queued or being written, to every peer */
+        std::size_t total_bytes_queued;
+        /** The largest value total_bytes_queued has reached */
+        std::size_t peak_total_bytes_queued;
+        /** The number of dummy frames dropped because a budget was exceeded */
+        std::uint64_t frames_dropped;
+        /** The number of frames that were not sent because a budget was exceeded */
+        std::uint64_t frames_rejected;
+        /** The number of times a sending thread had to wait for a budget to free up */
+        std::uint64_t producer_blocks;
+    };
+
 private:
+    /** What to do with an outgoing frame that would exceed a send budget */
+    enum class SendBudgetPolicy { BLOCK,
+                                  DROP,
+                                  FAIL };
+    /** The result of checking an outgoing frame against the send budgets */
+    enum class BudgetDecision { ACCEPT,
+                                DROP,
+                                REJECT };
+    /**
+     * The outbound lanes of a connection. Control frames are written ahead of
+     * any bulk frames that are still queued, so a ping response or aggregation
+     * message never waits behind a backlog of overlay batches.
+     */
+    enum class SendLane { CONTROL,
+                          BULK };
+    /** The lifecycle states of a connection */
+    enum class ConnectionState { CONNECTING,
+                                 CONNECTED,
+                                 FAILED };
+    /**
+     * A frame in a connection's send queue, along with an optional callback
+     * that is notified when the frame has been written or has failed to send.
+     */
+    struct OutgoingFrame {
+        std::shared_ptr<util::FramedSendBuffer> buffer;
+        std::function<void(bool)> send_callback;
+    };
+    /**
+     * The state of one open connection to another client, which carries
+     * messages in both directions no matter which side opened it. The
+     * transport is bound to its own strand, so all the handlers for a single
+     * connection run serially even when several threads are running the io_context.
+     */
+    struct Connection {
+        std::unique_ptr<Transport> transport;
+        /** True if this client opened the connection, false if it was accepted */
+        const bool outgoing;
+        /**
+         * The receive buffer for this connection, which is reused for every
+         * message received on it. Reads from the transport go directly into this
+         * buffer, and may contain several messages at once.
+         */
+        util::FramedReceiveBuffer receive_buffer;
+        /**
+         * Whether an outgoing connection has finished connecting. This is
+         * written on the connection's strand but read by sending threads.
+         * Accepted connections start out CONNECTED.
+         */
+        std::atomic<ConnectionState> state;
+        /**
+         * Control frames that are waiting to be written, in the order they were
+         * sent. Frames queued while a write is in progress (or while the
+         * connection is being established) are all written together in the
+         * next write. Only accessed on the connection's strand.
+         */
+        std::deque<OutgoingFrame> control_queue;
+        /**
+         * Bulk frames that are waiting to be written, in the order they were
+         * sent. Each write takes at most MAX_BULK_WRITE_SIZE bytes from this
+         * queue, after every queued control frame. Only accessed on the connection's strand.
+         */
+        std::deque<OutgoingFrame> bulk_queue;
+        /**
+         * The frames being written by the current asynchronous write, which must
+         * stay alive until it completes. Only one write is in progress at a time,
+         * and it is in progress whenever this is not empty.
+         */
+        std::vector<OutgoingFrame> frames_in_flight;
+        /** The combined buffer sequence for the current write; reused for each write. */
+        std::vector<asio::const_buffer> write_buffers;
+        /**
+         * True if the connection has been evicted from the cache, and should
+         * be closed as soon as its queued frames have been written. Only
+         * accessed on the connection's strand.
+         */
+        bool closing;
+        /** The last time a message was sent on this connection. Guarded by connections_mutex. */
+        std::chrono::steady_clock::time_point last_used;
+        /**
+         * Set whenever a message is received on this connection, and cleared by
+         * the idle reaper, so that a connection the peer is still sending on
+         * is not closed just because this client has not sent anything on it.
+         */
+        std::atomic<bool> received_since_reap;
+        /** This connection's position in connection_lru, if it is in the peer table. Guarded by connections_mutex. */
+        std::list<int>::iterator lru_position;
+        Connection(std::unique_ptr<Transport> transport, ConnectionState initial_state, bool outgoing)
+            : transport(std::move(transport)),
+              outgoing(outgoing),
+              state(initial_state),
+              closing(false),
+              last_used(std::chrono::steady_clock::now()),
+              received_since_reap(false) {}
+        bool has_queued_frames() const { return !control_queue.empty() || !bulk_queue.empty(); }
+    };
+
+    /**
+     * Everything this NetworkManager tracks about one other client (or the
+     * query server), stored together in one entry of the peer table.
+     */
+    struct Peer {
+        /** The address and port the peer listens on, if it was in the client list */
+        asio::ip::tcp::endpoint endpoint;
+        /** The same address and port, for control datagrams */
+        asio::ip::udp::endpoint control_endpoint;
+        bool has_address;
+        /** How to connect to the peer; the local transports use the port number to find its socket */
+        TransportType transport;
+        /**
+         * The connection to this peer, if any, whichever side opened it. Messages
+         * are sent and received on it in both directions. Guarded by connections_mutex.
+         */
+        std::shared_ptr<Connection> connection;
+        /** The number of frames written to this peer */
+        std::atomic<std::uint64_t> frames_sent;
+        /** The number of frames received from this peer */
+        std::atomic<std::uint64_t> frames_received;
+        /** The bytes of frames to this peer that are queued or being written. Guarded by send_budget_mutex. */
+        std::size_t bytes_queued;
+        Peer() : has_address(false), transport(TransportType::TCP), frames_sent(0), frames_received(0), bytes_queued(0) {}
+    };
+
+    /** A serialized control message waiting to be sent as a single UDP datagram */
+    struct OutgoingDatagram {
+        asio::ip::udp::endpoint destination;
+        std::shared_ptr<const std::vector<uint8_t>> bytes;
+    };
+    /**
+     * A ping sent over UDP that has not been answered yet. Since datagrams
+     * can be lost, it is retransmitted every udp_retry_interval until either
+     * a response arrives from the recipient or the deadline passes.
+     */
+    struct PendingPing {
+        int recipient_id;
+        std::shared_ptr<const std::vector<uint8_t>> bytes;
+        std::chrono::steady_clock::time_point deadline;
+        /** Fires when the next retransmission is due; runs on control_socket's strand */
+        asio::steady_timer retry_timer;
+        std::function<void(bool)> completion_handler;
+        /** Set once the result has been reported, so it is only reported once */
+        bool completed;
+        PendingPing(int recipient_id, std::shared_ptr<const std::vector<uint8_t>> bytes,
+                    std::chrono::steady_clock::time_point deadline,
+                    asio::steady_timer retry_timer, std::function<void(bool)> completion_handler)
+            : recipient_id(recipient_id),
+              bytes(std::move(bytes)),
+              deadline(deadline),
+              retry_timer(std::move(retry_timer)),
+              completion_handler(std::move(completion_handler)),
+              completed(false) {}
+    };
+
     std::shared_ptr<spdlog::logger> logger;
     /** The io_context that all the sockets will use */
     asio::io_context network_io_context;
+    /** The number of threads that will run network_io_context when run() is called */
+    const unsigned int num_io_threads;
+    /**
+     * A strand that serializes the delivery of received messages to message_handler,
+     * so the application never handles two messages at once even though they
+     * may be received and deserialized concurrently on different I/O threads.
+     */
+    asio::strand<asio::io_context::executor_type> delivery_strand;
 
     /**
      * The application-level object that owns this NetworkManager and will
@@ -24,103 +220,465 @@ private:
      */
     MessageConsumer<RecordType>* message_handler;
 
-    /** Maps client IDs to address/port pairs. */
-    std::map<int, asio::ip::tcp::endpoint> id_to_ip_map;
-    /** Maps address/port pairs to client IDs */
-    std::map<asio::ip::tcp::endpoint, int> ip_to_id_map;
     /**
-     * Cache of open sockets to clients, lazily initialized: the socket
-     * is created the first time a message is sent to or received from
-     * that client. This may also contain a socket for the query server,
-     * at entry -1.
+     * The peer table, indexed by client ID + 1. Client IDs are dense, starting
+     * at 0, and the query server has ID -1 (UTILITY_NODE_ID), so it is stored
+     * at index 0. The table is sized once, from the client list, and never
+     * resized, so references to its entries stay valid.
      */
-    std::map<int, asio::ip::tcp::socket> sockets_by_id;
+    std::vector<Peer> peers;
     /**
-     * Contains one receive buffer per client for reading the initial
-     * "size of message" data for an incoming message. These will be
-     * supplied to asynchronous read requests.
+     * The IDs of the peers that have a connection in the peer table, ordered
+     * from most recently used to least recently used. When the cache is full,
+     * the connection at the back of this list is the one that gets closed.
      */
-    std::map<int, std::array<uint8_t, sizeof(std::size_t)>> length_buffers;
+    std::list<int> connection_lru;
+    /** The number of connections currently in the peer table */
+    std::size_t num_open_connections;
     /**
-     * Contains one receive buffer per client that will be used to read a
-     * (complete) message from a socket. These will be allocated dynamically
-     * once the size of an incoming message is known.
+     * Guards the connections in the peer table, connection_lru, and
+     * num_open_connections, which may be modified by handlers running on any
+     * of the I/O threads.
      */
-    std::map<int, std::vector<uint8_t>> incoming_message_buffers;
+    std::mutex connections_mutex;
 
+#ifdef ADQ_HAS_IO_URING
     /**
-     * A "server socket" that listens for incoming connections from
-     * other clients
+     * The io_uring instance that handles TCP connections, if io_uring is
+     * enabled in the configuration and the kernel supports it. If this is
+     * null, TCP connections use ASIO's reactor.
      */
-    asio::ip::tcp::acceptor connection_listener;
+    std::unique_ptr<IoUringService> io_uring_service;
+#endif
     /**
-     * Constructs a new socket for the specified recipient if there is not
-     * already one in the socket map.
+     * The listeners that accept incoming connections from other clients: one
+     * for TCP, and one for the local transport named by this client's own
+     * entry in the client list, if it has one.
      */
-    void initialize_socket(int recipient_id);
+    std::vector<std::unique_ptr<TransportListener>> listeners;
+    /** The Unix-domain socket path the local transport listener was bound to, if there is one */
+    std::string local_listener_path;
+    /** The directory containing the Unix-domain sockets of clients that use a local transport */
+    const std::string local_transport_dir;
+    /** The size of each ring buffer in a shared-memory connection */
+    const std::size_t shared_memory_ring_size;
+    /**
+     * The number of shared-memory transports created so far, which is part of
+     * each one's ring name, so a reconnection never reuses (and unlinks) the
+     * rings of a connection that is still being accepted or torn down
+     */
+    std::atomic<std::uint64_t> num_shared_memory_transports;
+    /**
+     * The maximum number of connections that this NetworkManager will keep in
+     * the peer table at once. Once it is reached, the least recently used
+     * connection is closed to make room for a new one.
+     */
+    const std::size_t max_open_connections;
+    /** Connections that have not been used for this long in either direction are closed by the idle reaper. */
+    const std::chrono::milliseconds connection_idle_timeout;
+    /** A timer that periodically wakes up the idle connection reaper */
+    asio::steady_timer idle_reaper_timer;
 
     /**
-     * Handler function for ASIO accept events.
+     * The most bytes of outgoing frames that may be queued for one peer, or 0
+     * for no limit. A single frame is always allowed, even if it is larger.
+     */
+    const std::size_t peer_send_budget;
+    /** The most bytes of outgoing frames that may be queued for all peers together, or 0 for no limit */
+    const std::size_t total_send_budget;
+    /** What to do with a frame that would exceed one of the send budgets */
+    const SendBudgetPolicy send_budget_policy;
+    /**
+     * The longest a sending thread will wait for a budget to free up under the
+     * BLOCK policy. Messages are handled on the I/O threads, so a handler that
+     * blocks can only be unblocked by writes finishing on another I/O thread.
      */
-    void handle_accept(const asio::error_code& error, asio::ip::tcp::socket incoming_socket);
+    const std::chrono::milliseconds send_block_timeout;
+    /** Guards each peer's bytes_queued, send_queue_metrics, and the decision to admit a frame */
+    std::mutex send_budget_mutex;
+    /** Notified whenever queued bytes are released, to wake up blocked senders */
+    std::condition_variable send_budget_released;
+    SendQueueMetrics send_queue_metrics;
 
+    /** The ID of the client (or server) that owns this NetworkManager, which is needed to answer pings */
+    const int local_id;
+    /** True if pings and empty round markers should be sent as UDP datagrams instead of over TCP */
+    const bool use_udp_control;
+    /** The time between retransmissions of an unanswered ping sent over UDP */
+    const std::chrono::milliseconds udp_retry_interval;
     /**
-     * Handles an asynchronous read event for the "size of message" header
-     * from a single client. When ASIO calls this function, the message size
-     * should be in the length_buffers entry for the specified client.
+     * A UDP socket bound to the same port number as the TCP listener, which
+     * sends and receives control datagrams. It is only opened if
+     * use_udp_control is true. Its executor is a strand, and all the state
+     * below is only accessed on that strand.
      */
-    void handle_size_read(int sender_id, const asio::error_code& error, std::size_t bytes_read);
+    asio::ip::udp::socket control_socket;
+    /** Datagrams waiting to be sent together in the next batch */
+    std::vector<OutgoingDatagram> datagram_queue;
+    /** True if a flush of datagram_queue has already been scheduled */
+    bool datagram_flush_scheduled;
+    /**
+     * The storage that received datagrams are read into, in DATAGRAM_BATCH_SIZE
+     * slots of MAX_DATAGRAM_SIZE bytes, from the BufferPool (or null if
+     * use_udp_control is false). Overlay messages
+     * delivered from a datagram share ownership of it, so it is replaced
+     * rather than reused while any of them are still alive.
+     */
+    std::shared_ptr<std::vector<uint8_t>> datagram_receive_storage;
+    /** Pings sent over UDP that are waiting for a response, indexed by recipient ID */
+    std::map<int, std::list<std::shared_ptr<PendingPing>>> pending_pings;
 
     /**
-     * Handles an asynchronous read event for the body of a message from a client.
-     * When ASIO calls this function, the incoming message buffer for that client
-     * should be populated with data.
+     * The simulated network conditions for messages sent to each peer, from
+     * the fault injection file. Peers that are not in this map are sent to
+     * normally. Only written by the constructor.
+     */
+    std::map<int, FaultProfile> fault_profiles;
+    /** The seed that every fault-injecting transport's random choices are derived from */
+    const std::uint64_t fault_injection_seed;
+    /** The number of fault-injecting transports created so far, which makes each one's seed different */
+    std::atomic<std::uint64_t> num_fault_injected_transports;
+    /** The source of random choices for datagram faults; only used on control_socket's strand */
+    std::mt19937_64 datagram_fault_engine;
+    /**
+     * Looks up a peer in the peer table.
+     *
+     * @param client_id The ID of the peer
+     * @return The peer table entry for that ID
+     * @throws std::out_of_range if the ID is not in the client list
      */
-    void handle_body_read(int sender_id, const asio::error_code& error, std::size_t bytes_read);
+    Peer& get_peer(int client_id);
 
     /**
-     * Starts an asynchronous accept request on the connection listener.
+     * Starts the TCP listener, and the Unix-domain or shared-memory listener
+     * if this client's entry in the client list asks for a local transport.
+     * If io_uring is enabled, this also sets up the io_uring instance, and
+     * falls back to ASIO's reactor if it can't be created.
      */
-    void do_accept();
+    void start_listeners();
 
     /**
-     * Starts an asynchronous read on the socket for the specified client ID
-     * that expects to read exactly sizeof(size_t) bytes. This is the standard
-     * "header" of a message indicating the length of its body.
+     * @param port The port number a client listens on
+     * @param transport The local transport the client uses
+     * @return The path of the Unix-domain socket that the client listens on for that transport
+     */
+    std::string local_socket_path(uint16_t port, TransportType transport) const;
+
+    /**
+     * Constructs an unconnected transport to a peer, of the kind its entry in
+     * the client list asks for, bound to a new strand.
+     */
+    std::unique_ptr<Transport> make_transport(const Peer& peer);
+
+    /**
+     * Wraps a transport to a peer in a FaultInjectingTransport, if the fault
+     * injection file has a profile for that peer.
      *
-     * @param sender_id The ID of the client to read from
+     * @param peer_id The ID of the peer at the other end of the transport
+     * @param transport The transport to wrap
+     * @return Either the wrapping transport or the original one
      */
-    void start_size_read(int sender_id);
+    std::unique_ptr<Transport> inject_faults(int peer_id, std::unique_ptr<Transport> transport);
 
     /**
-     * Starts an asynchronous read on the socket for the specified client ID
-     * that expects to read the specified number of bytes. This will allocate
-     * a buffer of the specified size in incoming_message_buffers.
+     * Gets the connection to the specified recipient, constructing a new one
+     * and starting an asynchronous connect if there is not already one in the
+     * peer table (including one the recipient opened). This never blocks on
+     * the network; messages sent to the new connection will be queued until
+     * it finishes connecting. If the cache is full, the least recently used
+     * connection is closed.
+     */
+    std::shared_ptr<Connection> get_connection(int recipient_id);
+
+    /**
+     * Handles the completion of an asynchronous connect to another client,
+     * either by starting to read from the connection and writing out the
+     * messages that were queued while connecting, or by discarding them and
+     * marking the connection as failed.
+     */
+    void handle_connect(int recipient_id, std::shared_ptr<Connection> connection, const asio::error_code& error);
+
+    /**
+     * Checks whether the most recent connection attempt to a client failed.
+     * If it did, the failed connection is removed from the cache, so the next
+     * send to that client will try to connect again.
+     *
+     * @return True if the connection is in the FAILED state
+     */
+    bool check_connection_failed(int recipient_id, const std::shared_ptr<Connection>& connection);
+
+    /**
+     * Removes a connection from the cache, if the cache still contains that
+     * connection for the specified client, and closes it.
+     */
+    void remove_connection(int peer_id, const std::shared_ptr<Connection>& connection);
+
+    /**
+     * Removes a peer's connection from the cache and closes it once any
+     * writes that are still in progress have finished. This must be called
+     * while holding connections_mutex, and the peer must have a connection.
+     *
+     * @param peer_id The ID of the peer whose connection should be closed
+     */
+    void close_connection(int peer_id);
+
+    /**
+     * Closes a connection that is no longer in the peer table once it has
+     * finished writing the frames already queued on it.
+     */
+    void close_when_flushed(const std::shared_ptr<Connection>& connection);
+
+    /**
+     * Closes least recently used connections until there is room in the cache
+     * for one more. This must be called while holding connections_mutex.
+     */
+    void make_room_for_connection();
+
+    /**
+     * Closes the connections that have not been used for more than
+     * connection_idle_timeout, then schedules itself to run again. A
+     * connection that has received messages since the last check counts as
+     * used, even if nothing was sent on it.
+     */
+    void reap_idle_connections();
+
+    /**
+     * Handles a transport accepted by any of the listeners, by putting it in
+     * the peer table and starting to read from it. If this client already has
+     * a connection to the same peer, because both sides connected at the same
+     * time, the one opened by the client with the lower ID is kept. A TCP
+     * transport is rejected unless it comes from the address configured for
+     * the client it claims to be.
+     *
+     * @param error An ASIO error code, if accepting the transport failed
+     * @param transport The accepted transport
+     * @param client_id The ID of the client that opened the transport, according to its hello
+     * @param remote_address The address the transport came from, or an
+     * unspecified address for a local transport
+     */
+    void handle_accept(const asio::error_code& error, std::unique_ptr<Transport> transport, int client_id,
+                       const asio::ip::address& remote_address);
+
+    /**
+     * Handles an asynchronous read event on a connection to a single client. When ASIO calls this function, the newly received bytes
+     * have been written into the connection's receive buffer; each complete
+     * message in the buffer is dispatched, and then another read is started.
+     */
+    void handle_read(int sender_id, std::shared_ptr<Connection> connection,
+                     const asio::error_code& error, std::size_t bytes_read);
+
+    /**
+     * Starts an asynchronous read on a connection, which will read
+     * as many bytes as are available (up to the free space in the connection's
+     * receive buffer). Messages may span more than one read, and one read may
+     * contain several messages.
      *
      * @param sender_id The ID of the client to read from
-     * @param body_size The number of bytes to read
+     * @param connection The connection to that client
      */
-    void start_body_read(int sender_id, std::size_t body_size);
+    void start_read(int sender_id, std::shared_ptr<Connection> connection);
 
     /**
      * Performs the application-level logic of reading a message and dispatching
      * it to the correct handler, assuming the entire message has already been
-     * received into a buffer.
+     * received into a buffer. Deserialization happens on the calling I/O thread,
+     * but the handlers are invoked on delivery_strand. Overlay messages are not
+     * deserialized; they are delivered as views that keep the frame alive. A
+     * frame too small to hold its batch header is dropped, and so is the rest
+     * of a batch once a message would run past the end of the frame.
      *
-     * @param message_bytes A reference to the byte buffer containing the body of the message
+     * @param frame A pointer to the body of the message, which shares ownership
+     * of the receive buffer containing it
+     * @param message_size The size of the message body, in bytes
+     * @param datagram_source If the message arrived as a UDP datagram, the
+     * endpoint it came from. Only pings and overlay messages are accepted over
+     * UDP, and only if their sender ID matches this endpoint.
+     */
+    void receive_message(std::shared_ptr<const uint8_t> frame, std::size_t message_size,
+                         const asio::ip::udp::endpoint* datagram_source = nullptr);
+
+    /**
+     * Delivers a deserialized message to the application-level handler by
+     * posting a call to message_handler on delivery_strand.
      */
-    void receive_message(const std::vector<uint8_t>& message_bytes);
+    template <typename MessageType>
+    void deliver_message(std::shared_ptr<MessageType> message);
 
     /**
-     * Handles an asynchronous write event for one of the "send" functions. Since
-     * there's nothing left to do once a write completes, this just does error
-     * reporting.
+     * Checks whether a frame fits within the recipient's send budget and the
+     * total send budget, applying send_budget_policy if it doesn't, and
+     * counts its bytes against both budgets if it is accepted. Under the BLOCK
+     * policy, this waits (for up to send_block_timeout) for queued frames to
+     * finish sending.
+     *
+     * @param recipient_id The ID of the client the frame will be sent to
+     * @param frame_size The size of the frame, in bytes
+     * @param droppable True if the frame is a dummy that can be dropped without harm
+     * @return Whether the frame should be sent, dropped, or rejected
+     */
+    BudgetDecision reserve_send_budget(int recipient_id, std::size_t frame_size, bool droppable);
+
+    /**
+     * Parses the send_budget_policy configuration option.
+     * @param policy_name "block", "drop", or "fail"; an empty string selects "fail"
+     * @param num_io_threads The number of threads that will run the network io_context
+     * @throws std::invalid_argument if the name is not one of these, or if it
+     * is "block" and there is only one I/O thread
+     */
+    static SendBudgetPolicy parse_send_budget_policy(const std::string& policy_name, unsigned int num_io_threads);
+
+    /**
+     * Releases bytes that were counted against the send budgets, once the
+     * frames they belong to have been written or discarded.
+     */
+    void release_send_budget(int recipient_id, std::size_t num_bytes);
+
+    /**
+     * Adds a frame to one of a connection's send queues, on the connection's strand,
+     * and starts writing the queue if no write is already in progress. If the
+     * frame would exceed a send budget and is rejected, the connection is
+     * reset, which discards everything queued on it, so the recipient appears
+     * to have failed (unless only the total budget was exceeded).
+     *
+     * @param recipient_id The ID of the client to write to
+     * @param connection The connection to that client
+     * @param send_buffer The frame to send, which has not been finished yet
+     * @param send_callback An optional function to call, on the connection's
+     * strand, with true once the frame has been written or false if it could not be sent
+     * @param droppable True if the frame is a dummy that may be dropped when a budget is exceeded
+     * @param lane The lane to queue the frame in
+     * @return False if the frame was rejected because a send budget was exceeded
+     */
+    bool start_write(int recipient_id, std::shared_ptr<Connection> connection,
+                     std::shared_ptr<util::FramedSendBuffer> send_buffer,
+                     std::function<void(bool)> send_callback = nullptr,
+                     bool droppable = false,
+                     SendLane lane = SendLane::CONTROL);
+
+    /**
+     * Notifies the send callbacks of some frames that they have either been
+     * written or failed to send, releases their bytes from the send budgets,
+     * and then discards the frames.
+     *
+     * @param recipient_id The ID of the client the frames were sent to
+     * @param frames The frames to complete; this container will be emptied
+     * @param success True if the frames were written, false if they failed
+     */
+    template <typename FrameContainer>
+    void complete_frames(int recipient_id, FrameContainer& frames, bool success);
+
+    /** Fails every frame in both of a connection's send queues. Must be called on the connection's strand. */
+    void discard_queued_frames(int recipient_id, const std::shared_ptr<Connection>& connection);
+
+    /**
+     * Starts a single gathered write of every queued control frame, followed
+     * by queued bulk frames up to MAX_BULK_WRITE_SIZE, unless a write is
+     * already in progress or the connection is not connected yet. Capping
+     * the bulk part lets control frames queued during a long backlog of bulk
+     * frames go out after the current write, at a frame boundary. Must be
+     * called on the connection's strand.
+     */
+    void flush_send_queue(int recipient_id, const std::shared_ptr<Connection>& connection);
+
+    /**
+     * Handles the completion of a write started by flush_send_queue. If more
+     * frames were queued during the write, this starts the next write;
+     * otherwise, it finishes closing the connection if it was evicted while
+     * the write was in progress.
      *
      * @param recipient_id The ID of the client that the send was writing to
+     * @param connection The connection that the send was writing to
      * @param error An ASIO error code, if any
      * @param bytes_sent The number of bytes successfully written
      */
-    void handle_write_complete(int recipient_id, const asio::error_code& error, std::size_t bytes_sent);
+    void handle_write_complete(int recipient_id, const std::shared_ptr<Connection>& connection,
+                               const asio::error_code& error, std::size_t bytes_sent);
+
+    /**
+     * Serializes a single message as the body of a control datagram, in the
+     * same format as a TCP frame body (a message count followed by the message).
+     *
+     * @return The serialized datagram, or null if the message is too large to
+     * fit in one datagram
+     */
+    template <typename MessageType>
+    std::shared_ptr<const std::vector<uint8_t>> serialize_datagram(const MessageType& message);
+
+    /**
+     * Queues a datagram to be sent to a peer in the next batch. This can be
+     * called from any thread.
+     */
+    void send_datagram(int recipient_id, std::shared_ptr<const std::vector<uint8_t>> datagram);
+
+    /**
+     * Sends every datagram in datagram_queue, using as few system calls as
+     * possible. If the socket's send buffer is full, the rest are sent once
+     * it becomes writable again. Must be called on control_socket's strand.
+     */
+    void flush_datagrams();
+
+    /**
+     * Starts waiting for control_socket to become readable. The handler reads
+     * every datagram that is available, in batches, then waits again.
+     */
+    void start_datagram_receive();
+
+    /**
+     * Reads and dispatches as many received datagrams as are available without
+     * blocking. Must be called on control_socket's strand.
+     */
+    void receive_datagrams();
+
+    /**
+     * Answers a datagram if it contains a ping request, by sending a response
+     * datagram immediately. Pings that arrive over UDP are answered here, on
+     * the I/O thread, rather than by the application, so a response is not
+     * delayed by whatever message the application is handling.
+     *
+     * @param datagram The received datagram
+     * @param datagram_size The size of the datagram, in bytes
+     * @param source The endpoint the datagram came from; a ping request whose
+     * sender ID doesn't match it is dropped instead of answered
+     * @return True if the datagram was a ping request, false if it should be
+     * delivered normally
+     */
+    bool answer_ping_request(const uint8_t* datagram, std::size_t datagram_size, const asio::ip::udp::endpoint& source);
+
+    /**
+     * Checks whether a datagram really came from the peer it claims to be
+     * from. UDP has no handshake, so the sender ID in a datagram is only
+     * trusted if the datagram came from that peer's configured control endpoint.
+     *
+     * @param sender_id The sender ID in the datagram
+     * @param source The endpoint the datagram came from
+     * @return True if sender_id is in the client list with that control endpoint
+     */
+    bool is_datagram_from(int sender_id, const asio::ip::udp::endpoint& source);
+
+    /**
+     * Sends a ping over UDP, and retransmits it until it is answered or its
+     * deadline passes. Must be called on control_socket's strand.
+     */
+    void start_udp_ping(int recipient_id, std::shared_ptr<const std::vector<uint8_t>> datagram,
+                        std::function<void(bool)> completion_handler, std::chrono::milliseconds deadline);
+
+    /**
+     * Schedules the next retransmission of a UDP ping, or fails it if its
+     * deadline has passed. Must be called on control_socket's strand.
+     */
+    void schedule_ping_retry(std::shared_ptr<PendingPing> ping);
+
+    /**
+     * Removes a UDP ping from pending_pings and reports its result. Must be
+     * called on control_socket's strand.
+     */
+    void complete_udp_ping(const std::shared_ptr<PendingPing>& ping, bool success);
+
+    /**
+     * Completes every UDP ping that is waiting for a response from a peer,
+     * because a ping response has been received from it (over either transport).
+     */
+    void handle_ping_response(int sender_id);
 
 public:
     /**
@@ -134,30 +692,55 @@ public:
     NetworkManager(MessageConsumer<RecordType>* owning_client);
 
     /**
-     * Destructor: Calls shutdown() so that no more network events are handled if the NetworkManager is destroyed
+     * Destructor: Calls shutdown() so that no more network events are handled if the NetworkManager is destroyed,
+     * and removes the local transport listener's socket file
      */
     ~NetworkManager();
 
+    /**
+     * Starts connecting to each of the specified peers that this client does
+     * not already have a connection to, without waiting for the connections
+     * to be established, so that later sends to them don't have to wait for a
+     * connect. A previous connection attempt that failed is retried. At most
+     * max_open_connections peers are connected to; the rest are connected
+     * lazily, when something is first sent to them.
+     *
+     * @param peer_ids The IDs of the peers to connect to
+     */
+    void open_connections(const std::set<int>& peer_ids);
+
     /**
      * Starts waiting for network events by giving control of the calling
-     * thread to the ASIO io_context. Callers should expect this function
+     * thread to the ASIO io_context. If more than one network thread is
+     * configured, the additional threads are started here and share the
+     * io_context with the calling thread. Callers should expect this function
      * to block forever.
      */
     void run();
 
     /**
      * Shuts down the network manager by stopping the ASIO io_context. Calling
-     * this will unblock the thread that called run().
+     * this will unblock the thread that called run(), once the other network
+     * threads have finished.
      */
     void shutdown();
+    /**
+     * Runs a function on the strand that delivers received messages, so that
+     * it never runs concurrently with a message handler. This is how work
+     * triggered by another thread, such as a timer firing, joins the protocol.
+     * @param task The function to run
+     */
+    void post(std::function<void()> task);
 
     /**
      * Sends a stream of overlay messages over the network to another meter,
      * identified by its ID. Messages will be sent in the order they appear
-     * in the list.
+     * in the list. If UDP control messages are enabled, a batch that only
+     * contains an empty round marker is sent as a datagram instead.
      * @param messages The messages to send.
      * @param recipient_id The ID of the recipient.
-     * @return true if the send was successful, false if a connection could not be made.
+     * @return true if the messages were sent or queued, false if the last attempt to connect to the recipient failed
+     * or the recipient's send queue is over its budget.
      */
     bool send(const std::list<std::shared_ptr<messaging::OverlayTransportMessage<RecordType>>>& messages, const int recipient_id);
     /**
@@ -165,16 +748,36 @@ public:
      * utility), identified by its ID.
      * @param message The message to send
      * @param recipient_id The ID of the recipient
-     * @return true if the send was successful, false if a connection could not be made.
+     * @return true if the message was sent or queued, false if the last attempt to connect to the recipient failed
+     * or the recipient's send queue is over its budget.
      */
     bool send(const std::shared_ptr<messaging::AggregationMessage<RecordType>>& message, const int recipient_id);
     /**
-     * Sends a PingMessage over the network to another meter
+     * Sends a PingMessage over the network to another meter, without waiting
+     * for it to be written. The completion handler is called once the ping
+     * has either been written to the recipient's connection or failed; if
+     * neither has happened by the deadline, the ping is considered failed.
+     * The handler is called on the same strand that delivers received
+     * messages, so it never runs concurrently with a message handler.
+     * If UDP control messages are enabled, the ping is sent as a datagram and
+     * retransmitted until the recipient responds, so success means a response
+     * was received before the deadline rather than just that it was written.
+     *
+     * @param message The message to send
+     * @param recipient_id The ID of the recipient
+     * @param completion_handler A function to call with true if the ping was
+     * sent successfully, or false if the recipient could not be reached in time
+     * @param deadline The maximum time to wait for the ping to be sent
+     */
+    void send(const std::shared_ptr<messaging::PingMessage<RecordType>>& message, const int recipient_id,
+              std::function<void(bool)> completion_handler, std::chrono::milliseconds deadline);
+    /**
+     * Sends a PingMessage without being notified of the result. This is used
+     * for ping responses, since failures are only detected by the sender.
      * @param message The message to send
      * @param recipient_id The ID of the recipient
-     * @return true if the send was successful, false if a connection could not be made.
      */
-    bool send(const std::shared_ptr<messaging::PingMessage<RecordType>>& message, const int recipient_id);
+    void send(const std::shared_ptr<messaging::PingMessage<RecordType>>& message, const int recipient_id);
     /** Sends a signature request message to the query server. */
     bool send(const std::shared_ptr<messaging::SignatureRequest<RecordType>>& message);
     /**
@@ -191,6 +794,49 @@ public:
      * @param recipient_id The ID of the recipient
      */
     void send(const std::shared_ptr<messaging::SignatureResponse<RecordType>>& message, const int recipient_id);
+    /**
+     * Sends the same message to several clients. The message is serialized
+     * once into a shared buffer, and each recipient's frame references that
+     * buffer instead of containing its own copy. Recipients that are
+     * unreachable are skipped with a warning.
+     * @param message The message to send
+     * @param recipient_ids The IDs of the recipients
+     */
+    template <typename MessageType>
+    void multicast(const std::shared_ptr<MessageType>& message, const std::vector<int>& recipient_ids);
+
+    /** @return A snapshot of the outgoing queue sizes and budget counters */
+    SendQueueMetrics get_send_queue_metrics();
+    /**
+     * @param peer_id The ID of a client (or UTILITY_NODE_ID)
+     * @return The bytes of frames to that client that are queued or being written
+     */
+    std::size_t get_bytes_queued(int peer_id);
+
+    /** The default limit on open sockets, if the configuration file does not set one */
+    static constexpr std::size_t DEFAULT_MAX_OPEN_CONNECTIONS = 512;
+    /** The default time (ms) an outgoing connection can be idle before it is closed */
+    static constexpr int DEFAULT_CONNECTION_IDLE_TIMEOUT = 30000;
+    /** The default size (bytes) of each shared-memory ring buffer */
+    static constexpr std::size_t DEFAULT_SHARED_MEMORY_RING_SIZE = 1 << 20;
+    /** The default time (ms) a sender waits for a send budget to free up under the "block" policy */
+    static constexpr int DEFAULT_SEND_BLOCK_TIMEOUT = 1000;
+    /** The default time (ms) between retransmissions of an unanswered UDP ping */
+    static constexpr int DEFAULT_UDP_RETRY_INTERVAL = 15;
+    /**
+     * The largest control datagram that will be sent; messages that don't fit
+     * are sent over TCP. This keeps datagrams under a typical Ethernet MTU, so
+     * they are never fragmented.
+     */
+    static constexpr std::size_t MAX_DATAGRAM_SIZE = 1400;
+    /** The maximum number of datagrams sent or received with a single system call */
+    static constexpr std::size_t DATAGRAM_BATCH_SIZE = 32;
+    /**
+     * The most bytes of bulk frames written together in one write (though one
+     * larger frame can always be written alone), which bounds how long a
+     * newly queued control frame waits for the write in progress.
+     */
+    static constexpr std::size_t MAX_BULK_WRITE_SIZE = 256 * 1024;
 };
 }  // namespace adq
 
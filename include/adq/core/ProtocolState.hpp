@@ -2,19 +2,24 @@
 
 #include "CrusaderAgreementState.hpp"
 #include "CryptoLibrary.hpp"
+#include "FailureDetector.hpp"
 #include "TreeAggregationState.hpp"
 #include "adq/core/DataSource.hpp"
 #include "adq/core/InternalTypes.hpp"
 #include "adq/util/Overlay.hpp"
+#include "adq/util/OverlaySchedule.hpp"
 #include "adq/util/PointerUtil.hpp"
 #include "adq/util/TimerManager.hpp"
+#include "adq/util/WorkerPool.hpp"
 
 #include <spdlog/spdlog.h>
 
+#include <chrono>
 #include <cmath>
 #include <list>
 #include <memory>
 #include <set>
+#include <unordered_map>
 #include <vector>
 
 namespace adq {
@@ -26,7 +31,7 @@ enum class ProtocolPhase { IDLE,
                            AGGREGATE };
 
 template <typename RecordType>
-class ProtocolState {
+class ProtocolState : public std::enable_shared_from_this<ProtocolState<RecordType>> {
 private:
     std::shared_ptr<spdlog::logger> logger;
     ProtocolPhase protocol_phase;
@@ -39,6 +44,8 @@ private:
     int log2n;
     /** The number of aggregation groups, which is based on the number of meters */
     const int num_aggregation_groups;
+    /** The gossip schedule for num_meters meters, which is shared by every ProtocolState in the process */
+    const util::OverlaySchedule& schedule;
     /** The current overlay round */
     int overlay_round;
     /** True if the current overlay round is the last one in a query */
@@ -49,21 +56,43 @@ private:
      * meter that has failed. */
     std::set<int> failed_meter_ids;
 
+    /** True if the QueryRequest arrived but this meter chose not to contribute to the query */
+    bool query_declined;
+
     /** Handle for the timer registered to timeout the round. */
     util::timer_id_t round_timeout_timer;
     /**
-     * True if this client has received a ping response from its predecessor in
-     * the overlay graph in the current round. Reset to false at the end of each
-     * round.
+     * Incremented whenever the round timer is started or cancelled. A timeout
+     * is handled on the delivery strand some time after the timer fires, so
+     * it is ignored if the timer was replaced or cancelled in the meantime.
+     */
+    int round_timer_generation;
+    /**
+     * True if this client has heard from its predecessor in the overlay graph
+     * (by a ping response or any other message) in the current round. Reset
+     * to false at the end of each round.
      */
     bool ping_response_from_predecessor;
 
     template <typename T>
     using ptr_list = std::list<std::shared_ptr<T>>;
 
-    ptr_list<messaging::OverlayTransportMessage<RecordType>> future_overlay_messages;
-    ptr_list<messaging::AggregationMessage<RecordType>> future_aggregation_messages;
-    ptr_list<messaging::OverlayMessage<RecordType>> waiting_messages;
+    /** The number of rounds ahead of overlay_round that future_overlay_messages can hold */
+    const int future_round_horizon;
+    /**
+     * Overlay messages received early, in a ring of buckets indexed by sender
+     * round modulo future_round_horizon. Only rounds from overlay_round + 1 to
+     * overlay_round + future_round_horizon are accepted, so each bucket holds
+     * messages for a single round, and it can be drained whole when that round begins.
+     */
+    std::vector<std::vector<std::shared_ptr<messaging::OverlayTransportMessage<RecordType>>>> future_overlay_messages;
+    std::vector<std::shared_ptr<messaging::AggregationMessage<RecordType>>> future_aggregation_messages;
+    /**
+     * Messages waiting to be forwarded, indexed by the destination of their next
+     * hop, so each round only touches the messages for that round's gossip target.
+     * Each bucket is kept in the order its messages arrived.
+     */
+    std::unordered_map<int, std::vector<std::shared_ptr<messaging::OverlayMessage<RecordType>>>> waiting_messages;
     ptr_list<messaging::OverlayMessage<RecordType>> outgoing_messages;
 
     std::shared_ptr<messaging::ValueTuple<RecordType>> my_contribution;
@@ -77,7 +106,8 @@ private:
     util::unordered_ptr_set<messaging::ValueContribution<RecordType>> proxy_values;
     std::unique_ptr<TreeAggregationState<RecordType>> aggregation_phase_state;
 
-    std::unique_ptr<util::TimerManager> timers;
+    /** A reference to the TimerManager stored in the QueryClient, which is shared by every query's ProtocolState. */
+    util::TimerManager& timers;
     /** A reference to the NetworkManager stored in the QueryClient. */
     NetworkManager<RecordType>& network;
     /**
@@ -86,7 +116,12 @@ private:
      * aggregation messages.
      */
     DataSource<RecordType>& data_source;
-    CryptoLibrary crypto;
+    /** A reference to the CryptoLibrary stored in the QueryClient, so the keys are only loaded once. */
+    CryptoLibrary& crypto;
+    /** A reference to the QueryClient's FailureDetector, which measures every peer's latency and liveness. */
+    FailureDetector& failure_detector;
+    /** A reference to the QueryClient's WorkerPool, which builds onions for different paths in parallel. */
+    util::WorkerPool& crypto_workers;
 
     /* --- Specific to BFT agreement --- */
     std::unique_ptr<CrusaderAgreementState<RecordType>> agreement_phase_state;
@@ -104,7 +139,8 @@ private:
     /**
      * Helper method that generates an encrypted multicast of a ValueContribution
      * to the proxies it specifies, assuming the overlay is starting in round 0,
-     * then ends the overlay round.
+     * then ends the overlay round. The onions for different paths are encrypted
+     * in parallel, and all of them are finished before round 0 starts.
      * @param contribution The ValueContribution to multicast.
      */
     void encrypted_multicast_to_proxies(std::shared_ptr<messaging::ValueContribution<RecordType>> contribution);
@@ -136,22 +172,79 @@ private:
      * again and keep waiting. If not, we give up and move to the next round.
      */
     void handle_round_timeout();
+    /**
+     * Starts the timer for the current round, replacing any timer already
+     * running. The timer fires on the timer thread, so the timeout is posted
+     * to the NetworkManager's delivery strand to be handled like a message,
+     * and is dropped if this ProtocolState has been destroyed by then.
+     * @param predecessor The ID of the predecessor being waited on, which determines the timeout
+     */
+    void start_round_timer(int predecessor);
+    /** Cancels the timer for the current round, if there is one. */
+    void cancel_round_timer();
+    /**
+     * Sends a ping to the predecessor node for the current round, without
+     * waiting for it to be sent. If the ping fails, or is not delivered within
+     * the round timeout for that predecessor (which is based on its measured
+     * round-trip time), handle_ping_failure() will be called.
+     *
+     * @param predecessor The ID of the predecessor node
+     */
+    void ping_predecessor(int predecessor);
+    /**
+     * Records that a ping to a predecessor could not be sent, and ends the
+     * overlay round early if the round in which the ping was sent is still
+     * the current one.
+     *
+     * @param predecessor The ID of the node that could not be pinged
+     * @param ping_query_num The query number at the time the ping was sent
+     * @param ping_round The overlay round in which the ping was sent
+     */
+    void handle_ping_failure(int predecessor, int ping_query_num, int ping_round);
+    /**
+     * @param other_meter_id The ID of another meter
+     * @return True if a message from that meter was received more recently
+     * than the round timeout for that meter
+     */
+    bool heard_from_recently(int other_meter_id) const;
+    /**
+     * Computes how long to wait for a message from a predecessor before giving
+     * up on the round, from the measured round-trip times to it. A predecessor
+     * that the failure detector suspects gets a shorter timeout, which is just
+     * long enough for its response to the round's ping to arrive.
+     *
+     * @param predecessor The ID of the predecessor being waited on
+     * @return The round timeout, in milliseconds
+     */
+    int round_timeout(int predecessor) const;
 
 public:
     /**
-     * Constructs the ProtocolState, making it ready to start handling query
-     * messages. The NetworkManager must be constructed first, since
-     * ProtocolState needs a reference to it.
+     * Constructs the ProtocolState for one query, making it ready to start
+     * handling that query's messages. A client has one ProtocolState for each
+     * query that is running, so several queries can be in progress at once;
+     * they share the client's NetworkManager, TimerManager, and CryptoLibrary,
+     * which must be constructed first.
      *
      * @param num_clients The total number of clients in the network
      * @param local_client_id This client's ID
      * @param network_manager A reference to the NetworkManager that will be used to send messages
      * @param data_source A reference to the client's DataSource, which will be used to
      * compute aggregates when handling AggregationMessages.
+     * @param timer_manager A reference to the TimerManager that will run round timeouts
+     * @param crypto_library A reference to the CryptoLibrary holding the client's keys
+     * @param failure_detector A reference to the FailureDetector that round timeouts are based on
+     * @param crypto_worker_pool A reference to the WorkerPool that will help encrypt onions
      */
     ProtocolState(int num_clients, int local_client_id,
                   NetworkManager<RecordType>& network_manager,
-                  DataSource<RecordType>& data_source);
+                  DataSource<RecordType>& data_source,
+                  util::TimerManager& timer_manager,
+                  CryptoLibrary& crypto_library,
+                  FailureDetector& failure_detector,
+                  util::WorkerPool& crypto_worker_pool);
+    /** Cancels this query's round timeout, so it can't fire after the ProtocolState is gone. */
+    ~ProtocolState();
 
     /**
      * Starts the query protocol to respond to a specific query request with the
@@ -174,6 +267,15 @@ public:
      * in the current round
      */
     void handle_overlay_message(messaging::OverlayTransportMessage<RecordType>& message);
+    /**
+     * Processes an overlay message for the current round that is still in its
+     * serialized form. If it is encrypted, the body is decrypted directly from
+     * the receive buffer, so only the decrypted layer is ever deserialized.
+     *
+     * @param message A view of an overlay message that should be handled by
+     * this client in the current round
+     */
+    void handle_overlay_message(const messaging::OverlayTransportMessageView<RecordType>& message);
     /**
      * Processes an aggregation message, assuming the protocol is currently in
      * the aggregation phase.
@@ -182,16 +284,18 @@ public:
      */
     void handle_aggregation_message(messaging::AggregationMessage<RecordType>& message);
     /**
-     * Processes a ping message from another client, for the purpose of
-     * detecting failures. Either responds if it is a request, or locally
-     * records the fact that the predecessor responded to a ping recently.
+     * Records that a message was just received from another meter, which shows
+     * that it is alive. Overlay traffic serves as an implicit ping response, so
+     * the predecessor only needs to be pinged explicitly if it has been silent.
+     * The QueryClient records the message's arrival in the FailureDetector.
      *
-     * @param message The ping message
+     * @param sender_id The ID of the meter that sent the message
      */
-    void handle_ping_message(const messaging::PingMessage<RecordType>& message);
+    void record_liveness(int sender_id);
     /**
      * Stores an overlay message for a future round in an internal cache, so it can be
-     * automatically handled when the round advances.
+     * automatically handled when the round advances. A message more than
+     * future_round_horizon rounds ahead is discarded instead.
      *
      * @param message A shared_ptr to the overlay message, which ProtocolState will now own
      */
@@ -204,15 +308,51 @@ public:
      */
     void buffer_future_message(std::shared_ptr<messaging::AggregationMessage<RecordType>> message);
 
+    /**
+     * Computes every peer that this meter will send messages to during a
+     * query, if it runs for the longest possible number of overlay rounds:
+     * its gossip target in each round, its parent in the aggregation tree,
+     * and the utility. This depends only on the meter's ID and the number of
+     * meters, so it can be computed before the query starts.
+     *
+     * @return The IDs of the peers, which may include UTILITY_NODE_ID
+     */
+    std::set<int> get_scheduled_peers() const;
+
     int get_num_aggregation_groups() const { return num_aggregation_groups; }
     int get_current_query_num() const { return my_contribution ? my_contribution->query_num : -1; }
     int get_current_overlay_round() const { return overlay_round; }
 
     bool is_in_overlay_phase() const { return protocol_phase == ProtocolPhase::SHUFFLE || protocol_phase == ProtocolPhase::AGREEMENT; }
     bool is_in_aggregate_phase() const { return protocol_phase == ProtocolPhase::AGGREGATE; }
+    /** @return True if this query has not started yet, or has finished */
+    bool is_idle() const { return protocol_phase == ProtocolPhase::IDLE; }
+    /**
+     * @return True if this meter is done with the query: it started and
+     * finished it, or declined to contribute. This is false for a query whose
+     * QueryRequest has not arrived yet, even though its state is idle.
+     */
+    bool is_finished() const { return query_declined || (is_idle() && get_current_query_num() >= 0); }
+    /** Records that the QueryRequest arrived, but this meter will not contribute to the query. */
+    void decline_query() { query_declined = true; }
 
-    /** The maximum time (ms) any meter should wait on receiving a message in an overlay round */
+    /**
+     * The time (ms) a meter waits on receiving a message in an overlay round
+     * before any round-trip times have been measured
+     */
     static constexpr int OVERLAY_ROUND_TIMEOUT = 100;
+    /** The shortest and longest round timeouts (ms) that will be derived from measured round-trip times */
+    static constexpr int MIN_ROUND_TIMEOUT = 10;
+    static constexpr int MAX_ROUND_TIMEOUT = 2000;
+    /** The round timeout is this many times the ROUND_TIMEOUT_PERCENTILE round-trip time to the predecessor */
+    static constexpr int ROUND_TIMEOUT_RTT_MULTIPLE = 4;
+    /** The multiple used instead if the predecessor is suspected of having failed */
+    static constexpr int SUSPECTED_ROUND_TIMEOUT_RTT_MULTIPLE = 2;
+    static constexpr double ROUND_TIMEOUT_PERCENTILE = 0.99;
+    /** The number of queries that can run at once, if the configuration does not say otherwise */
+    static constexpr int DEFAULT_MAX_CONCURRENT_QUERIES = 4;
+    /** The number of rounds ahead that early overlay messages are buffered for, if the configuration does not say otherwise */
+    static constexpr int DEFAULT_FUTURE_ROUND_HORIZON = 64;
     /**
      * The number of failures tolerated by the currently running instance of the system.
      * This is set only once, at startup, once the number of meters in the system is known.
@@ -1,15 +1,22 @@
 #pragma once
 
+#include "CryptoLibrary.hpp"
 #include "DataSource.hpp"
+#include "FailureDetector.hpp"
 #include "InternalTypes.hpp"
 #include "MessageConsumer.hpp"
 #include "NetworkManager.hpp"
 #include "ProtocolState.hpp"
+#include "adq/util/OverlaySchedule.hpp"
+#include "adq/util/TimerManager.hpp"
+#include "adq/util/WorkerPool.hpp"
 
 #include <spdlog/spdlog.h>
 
 #include <asio.hpp>
+#include <map>
 #include <memory>
+#include <set>
 
 namespace adq {
 
@@ -31,12 +38,53 @@ public:
 
 private:
     std::shared_ptr<spdlog::logger> logger;
+    /** The gossip schedule for num_clients clients, used to check the target of every incoming overlay message. */
+    const util::OverlaySchedule& overlay_schedule;
     /** The NetworkManager object representing this client device's network interface. */
     NetworkManager<RecordType> network_manager;
-    /** The ProtocolState object managing the query protocol for this client device. */
-    ProtocolState<RecordType> query_protocol_state;
+    /** Runs the round timeouts of every query; there can only be one LinuxTimerManager in a process. */
+    std::unique_ptr<util::TimerManager> timers;
+    /** Holds this client's private key and every client's public key, for all queries. */
+    CryptoLibrary crypto;
+    /** Measures the round-trip times and liveness of every peer, from all queries' traffic. */
+    FailureDetector failure_detector;
+    /** Threads that help with public-key encryption, shared by all queries. */
+    util::WorkerPool crypto_workers;
     /** The DataSource object that this device reads data from in response to a query. */
     std::unique_ptr<DataSource<RecordType>> data_source;
+    /**
+     * The ProtocolState managing each query this client is taking part in,
+     * indexed by query number, so that several queries can run at once with
+     * their own rounds and timeouts. A state is created when the first
+     * message for its query arrives, which may be before the QueryRequest.
+     * States of finished queries are kept until there are more than
+     * max_tracked_queries states, so late messages for them are recognized.
+     * They are shared_ptrs so that pending timer and ping callbacks can hold
+     * weak references, which expire if the state is discarded first.
+     */
+    std::map<int, std::shared_ptr<ProtocolState<RecordType>>> query_states;
+    /** The most ProtocolStates to keep, unless more queries than this are running */
+    const std::size_t max_tracked_queries;
+    /**
+     * Messages for queries numbered below this are obsolete, since their
+     * states have been discarded (or the queries never reached this client
+     * and are long over). It only advances over a contiguous run of
+     * discarded queries, so it never passes a query that hasn't started here.
+     */
+    int oldest_tracked_query;
+    /** Queries numbered above oldest_tracked_query whose states have been discarded */
+    std::set<int> discarded_queries;
+
+    /**
+     * Finds the ProtocolState for a query, creating it if this is the first
+     * message for the query, and discards the oldest finished states if there
+     * are now too many. States of queries that are running, or whose
+     * QueryRequest hasn't arrived yet, are never discarded.
+     *
+     * @param query_num A query number
+     * @return The query's ProtocolState, or null if the query is obsolete
+     */
+    ProtocolState<RecordType>* get_query_state(int query_num);
 
 public:
     /**
@@ -60,7 +108,7 @@ public:
      * The QueryClient shares ownership of the message, so it will stay alive
      * until QueryClient is done handling it.
      */
-    virtual void handle_message(std::shared_ptr<messaging::OverlayTransportMessage<RecordType>> message) override;
+    virtual void handle_message(std::shared_ptr<messaging::OverlayTransportMessageView<RecordType>> message) override;
     /**
      * Handles an aggregation message received from another client. This is a
      * callback for NetworkManager to invoke when a message arrives.
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "CryptoLibrary.hpp"
+#include "FailureDetector.hpp"
 #include "InternalTypes.hpp"
 #include "MessageConsumer.hpp"
 #include "NetworkManager.hpp"
@@ -13,6 +14,7 @@
 #include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <queue>
 #include <set>
 #include <string>
@@ -31,17 +33,37 @@ private:
     NetworkManager<RecordType> network;
     CryptoLibrary crypto_library;
     std::unique_ptr<util::TimerManager> timer_library;
-    /** Number of milliseconds to wait for a query timeout interval */
-    const int query_timeout_time;
-    /** Handle referring to the timer that was set to time-out the current query*/
-    int query_timeout_timer;
-    int query_num;
-    bool query_finished;
+    /**
+     * Measures the round trip from sending a query to each meter to receiving
+     * its signature request, which query timeouts are based on.
+     */
+    FailureDetector failure_detector;
+    /** The most queries from a batch that are run at once */
+    const std::size_t max_concurrent_queries;
+    /** The state of one query that is in progress */
+    struct ActiveQuery {
+        /** Handle referring to the timer that was set to time-out this query */
+        util::timer_id_t timeout_timer;
+        /** Incremented each time the timeout is reset, so a timeout that fired before the reset is ignored */
+        int timeout_generation;
+        util::unordered_ptr_multiset<messaging::AggregationMessage<RecordType>> results;
+        /** The meters whose contributions to this query have been signed */
+        std::set<int> meters_signed;
+    };
+    /**
+     * The queries that are in progress, indexed by query number. Each one has
+     * its own results and timeout, so several can run at once.
+     */
+    std::map<int, ActiveQuery> active_queries;
+    /**
+     * Guards active_queries, pending_batch_queries, and all_query_results,
+     * since queries are started by the caller's thread, while results and
+     * timeouts are handled on the network's delivery strand.
+     */
+    std::mutex queries_mutex;
     std::map<int, QueryCallback> query_callbacks;
-    util::unordered_ptr_multiset<messaging::AggregationMessage<RecordType>> curr_query_results;
     /** All results of queries the utility has issued, indexed by query number. */
     std::vector<std::shared_ptr<messaging::AggregationMessageValue<RecordType>>> all_query_results;
-    std::set<int> curr_query_meters_signed;
     //"A priority queue of pointers to QueryRequests, ordered by QueryNumGreater"
     using query_priority_queue = std::priority_queue<
         std::shared_ptr<messaging::QueryRequest<RecordType>>,
@@ -49,9 +71,31 @@ private:
         util::ptr_comparator<messaging::QueryRequest<RecordType>, messaging::QueryNumGreater<RecordType>>>;
     query_priority_queue pending_batch_queries;
 
-    static int compute_timeout_time(const int num_meters);
+    /**
+     * @return The time (ms) the utility is willing to wait on a network
+     * round-trip, based on how long meters recently took to answer a
+     * QueryRequest with a SignatureRequest, and scaled the same way the
+     * meters scale their round timeouts. Until enough meters have answered,
+     * this is NETWORK_ROUNDTRIP_TIMEOUT.
+     */
+    int network_roundtrip_timeout() const;
+    /** @return The time (ms) to wait for the next result of a query, once one has arrived */
+    int compute_timeout_time() const;
 
-    void end_query();
+    /**
+     * Finishes a query: records its result, notifies the query callbacks,
+     * and starts the next pending batch query if there is one. Does nothing
+     * if the query has already finished.
+     * @param query_num The number of the query to finish
+     */
+    void end_query(int query_num);
+    /**
+     * Arms the timer that ends a query if no result arrives in time.
+     * queries_mutex must be held by the caller.
+     * @param query_num The query to time out
+     * @param delay_ms The time to wait
+     */
+    void set_query_timeout(int query_num, int delay_ms);
 
 public:
     QueryServer(int num_clients);
@@ -66,25 +110,25 @@ public:
 
     // Handlers for other messages that a server should not normally receive. These will print a warning and drop the message.
 
-    virtual void handle_message(std::shared_ptr<messaging::OverlayTransportMessage<RecordType>> message) override;
+    virtual void handle_message(std::shared_ptr<messaging::OverlayTransportMessageView<RecordType>> message) override;
     virtual void handle_message(std::shared_ptr<messaging::PingMessage<RecordType>> message) override;
     virtual void handle_message(std::shared_ptr<messaging::QueryRequest<RecordType>> message) override;
     virtual void handle_message(std::shared_ptr<messaging::SignatureResponse<RecordType>> message) override;
 
     /**
      * Starts a query by broadcasting a message from the utility to all the meters in the network.
-     * Do not call this while an existing query is still in progress, or the existing query's
-     * results will be lost.
+     * Queries that are already in progress keep running alongside it; each query must have a
+     * different query number.
      */
     void start_query(std::shared_ptr<messaging::QueryRequest<RecordType>> query);
 
     /**
-     * Starts a batch of queries that should be executed in sequence as quickly as possible.
-     * This starts the first query in the batch immediately (defined as the one with
-     * the lowest query number), but the next one will not start running until the
-     * first one completes.
+     * Starts a batch of queries that should be executed as quickly as possible.
+     * Up to max_concurrent_queries of them (the ones with the lowest query
+     * numbers) start immediately, and each time one completes, the next one
+     * in the batch starts.
      * @param queries A batch of queries. The order of this vector will be ignored
-     * and the queries will be run in order of query number.
+     * and the queries will be started in order of query number.
      */
     void start_queries(const std::list<std::shared_ptr<messaging::QueryRequest<RecordType>>>& queries);
 
@@ -116,7 +160,7 @@ public:
      * Obviously, this must be called from a separate thread from listen_loop().  */
     void shut_down();
 
-    /** The maximum time (ms) the utility is willing to wait on a network round-trip */
+    /** The time (ms) the utility is willing to wait on a network round-trip before any have been measured */
     static constexpr int NETWORK_ROUNDTRIP_TIMEOUT = 100;
 };
 }  // namespace adq
@@ -0,0 +1,151 @@
+#pragma once
+
+#include "Transport.hpp"
+#include "adq/util/SharedMemoryRing.hpp"
+
+#include <asio.hpp>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace adq {
+
+/**
+ * A Transport between two clients on the same host that copies bytes through
+ * shared memory instead of the kernel's socket buffers. Each transport has
+ * two single-producer, single-consumer rings, one for each direction, which
+ * the connecting side creates and names in its hello.
+ *
+ * Each transport also has a Unix-domain socket, the "doorbell," which is
+ * only used to wake up the other side when it is waiting: a reader waits on
+ * it when its ring is empty, and a writer waits on it when its ring is full.
+ * A side only rings the doorbell if the other side has set a waiting flag,
+ * so a busy stream sends no doorbell bytes at all. Closing the doorbell
+ * tells the other side that the transport is closed.
+ */
+class SharedMemoryTransport : public Transport {
+private:
+    asio::local::stream_protocol::socket doorbell;
+    /** The listener's doorbell endpoint, for an outgoing transport */
+    asio::local::stream_protocol::endpoint doorbell_endpoint;
+    /** The prefix of the shared memory segments' names, for an outgoing transport */
+    std::string ring_name;
+    std::size_t ring_capacity;
+    /** The ID this client introduces itself with, for an outgoing transport */
+    int local_id;
+    /** The ring this side writes to */
+    std::unique_ptr<util::SharedMemoryRing> send_ring;
+    /** The ring this side reads from */
+    std::unique_ptr<util::SharedMemoryRing> receive_ring;
+    /** Doorbell bytes carry no data, so they are all read into (and discarded from) here */
+    std::array<uint8_t, 64> doorbell_scratch;
+    /** The hello message for an outgoing transport, which must stay alive while it is written */
+    std::vector<uint8_t> hello;
+    /** True while an asynchronous wait on the doorbell is in progress */
+    bool doorbell_wait_pending;
+    /** True once the other side has closed its doorbell */
+    bool peer_closed;
+
+    /** The buffers of the write in progress, if any */
+    std::vector<asio::const_buffer> write_buffers;
+    /** The index of the buffer in write_buffers that is currently being copied */
+    std::size_t write_buffer_index;
+    /** The number of bytes of the current buffer that have already been copied */
+    std::size_t write_buffer_offset;
+    std::size_t bytes_written;
+    /** The handler for the write in progress; the write is in progress whenever this is set */
+    IoHandler write_handler;
+
+    /** The buffer of the read in progress, if any */
+    asio::mutable_buffer read_buffer;
+    /** The handler for the read in progress; the read is in progress whenever this is set */
+    IoHandler read_handler;
+
+    /** Sends one byte on the doorbell to wake up the other side, if the socket has room for it */
+    void ring_doorbell();
+    /** Copies as much of the write in progress as fits, then waits for space if needed */
+    void continue_write();
+    /** Copies available bytes into the read in progress, or waits for bytes if there are none */
+    void continue_read();
+    /**
+     * Waits for the other side to ring the doorbell (or close it), then
+     * continues whichever operations are still in progress.
+     */
+    void wait_for_doorbell();
+    /** Finishes an operation by posting its handler to this transport's strand */
+    void complete(IoHandler& handler, const asio::error_code& error, std::size_t bytes_transferred);
+
+public:
+    /**
+     * Constructs an outgoing transport that has not connected yet. Connecting
+     * will create the shared memory segments.
+     *
+     * @param strand A new strand for this transport's handlers
+     * @param doorbell_endpoint The Unix-domain socket the peer's SharedMemoryListener listens on
+     * @param ring_name The prefix of the names to create the shared memory
+     * segments with, which must start with a '/'
+     * @param ring_capacity The size of each ring, in bytes
+     * @param local_id The ID of this client, which is sent to the peer
+     */
+    SharedMemoryTransport(asio::any_io_executor strand,
+                          const asio::local::stream_protocol::endpoint& doorbell_endpoint,
+                          const std::string& ring_name, std::size_t ring_capacity, int local_id);
+    /**
+     * Constructs a transport that was accepted by a SharedMemoryListener.
+     *
+     * @param doorbell The connected doorbell socket, whose executor should be a new strand
+     * @param send_ring The ring to write to, which the peer created
+     * @param receive_ring The ring to read from, which the peer created
+     */
+    SharedMemoryTransport(asio::local::stream_protocol::socket doorbell,
+                          std::unique_ptr<util::SharedMemoryRing> send_ring,
+                          std::unique_ptr<util::SharedMemoryRing> receive_ring);
+
+    asio::any_io_executor get_executor() override { return doorbell.get_executor(); }
+    void async_connect(ConnectHandler handler) override;
+    void async_read_some(asio::mutable_buffer buffer, IoHandler handler) override;
+    void async_write(const std::vector<asio::const_buffer>& buffers, IoHandler handler) override;
+    void close() override;
+
+    /** The suffix of the ring that carries bytes from the connecting side to the accepting side */
+    static constexpr const char* CONNECTOR_TO_ACCEPTOR_SUFFIX = ".0";
+    /** The suffix of the ring that carries bytes from the accepting side to the connecting side */
+    static constexpr const char* ACCEPTOR_TO_CONNECTOR_SUFFIX = ".1";
+};
+
+/**
+ * Accepts SharedMemoryTransports by listening for doorbell connections on a
+ * Unix-domain socket. Each connecting client sends a hello containing its ID
+ * and the name of the rings it created, and the listener maps those rings.
+ * Clients must run as the same user and send their hello within HELLO_TIMEOUT.
+ */
+class SharedMemoryListener : public TransportListener {
+private:
+    asio::io_context& io_context;
+    asio::local::stream_protocol::acceptor acceptor;
+    AcceptHandler accept_handler;
+
+    void do_accept();
+    /** Reads the hello from a newly accepted doorbell socket, then hands over the transport */
+    void read_hello(asio::local::stream_protocol::socket doorbell);
+
+public:
+    /**
+     * @param io_context The io_context that accepted transports will use; each one gets its own strand
+     * @param listen_endpoint The Unix-domain socket to listen on
+     */
+    SharedMemoryListener(asio::io_context& io_context,
+                         const asio::local::stream_protocol::endpoint& listen_endpoint)
+        : io_context(io_context), acceptor(io_context, listen_endpoint) {}
+
+    void start_accepting(AcceptHandler handler) override;
+    void close() override;
+
+    /** The longest ring name a client may send in its hello */
+    static constexpr std::size_t MAX_RING_NAME_LENGTH = 255;
+};
+
+}  // namespace adq
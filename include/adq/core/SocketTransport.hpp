@@ -0,0 +1,89 @@
+#pragma once
+
+#include "Transport.hpp"
+
+#include <asio.hpp>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace adq {
+
+/**
+ * A Transport that is an ASIO stream socket. This is used both for TCP and
+ * for Unix-domain sockets, which have the same interface in ASIO.
+ *
+ * @tparam Protocol The ASIO protocol type, e.g. asio::ip::tcp or asio::local::stream_protocol
+ */
+template <typename Protocol>
+class SocketTransport : public Transport {
+private:
+    typename Protocol::socket socket;
+    /** The endpoint to connect to, for an outgoing transport */
+    typename Protocol::endpoint peer_endpoint;
+    /**
+     * The ID of this client, which is sent to the peer as soon as an outgoing
+     * connection is established so the peer knows who connected.
+     */
+    int hello_id;
+
+public:
+    /**
+     * Constructs an outgoing transport that has not connected yet.
+     *
+     * @param socket An unopened socket, whose executor should be a new strand
+     * @param peer_endpoint The endpoint to connect to
+     * @param hello_id The ID to introduce this client with after connecting
+     */
+    SocketTransport(typename Protocol::socket socket, const typename Protocol::endpoint& peer_endpoint, int hello_id)
+        : socket(std::move(socket)),
+          peer_endpoint(peer_endpoint),
+          hello_id(hello_id) {}
+    /**
+     * Constructs a transport from a socket that was accepted by a listener.
+     * @param socket A connected socket, whose executor should be a new strand
+     */
+    explicit SocketTransport(typename Protocol::socket socket) : socket(std::move(socket)), hello_id(0) {}
+
+    asio::any_io_executor get_executor() override { return socket.get_executor(); }
+    void async_connect(ConnectHandler handler) override;
+    void async_read_some(asio::mutable_buffer buffer, IoHandler handler) override;
+    void async_write(const std::vector<asio::const_buffer>& buffers, IoHandler handler) override;
+    void close() override;
+};
+
+/**
+ * A TransportListener that accepts ASIO stream sockets, for either TCP or
+ * Unix-domain sockets. Each client that connects must introduce itself by
+ * sending its ID within HELLO_TIMEOUT, which is read before the connection
+ * is handed over; a Unix-domain peer must also run as the same user.
+ *
+ * @tparam Protocol The ASIO protocol type, e.g. asio::ip::tcp or asio::local::stream_protocol
+ */
+template <typename Protocol>
+class SocketListener : public TransportListener {
+private:
+    asio::io_context& io_context;
+    typename Protocol::acceptor acceptor;
+    AcceptHandler accept_handler;
+
+    void do_accept();
+    /** Reads the ID of the client that opened an accepted socket, then passes it to accept_handler */
+    void read_hello(typename Protocol::socket socket);
+
+public:
+    /**
+     * @param io_context The io_context that accepted sockets will use; each one gets its own strand
+     * @param listen_endpoint The endpoint to listen on
+     */
+    SocketListener(asio::io_context& io_context, const typename Protocol::endpoint& listen_endpoint)
+        : io_context(io_context),
+          acceptor(io_context, listen_endpoint) {}
+
+    void start_accepting(AcceptHandler handler) override;
+    void close() override;
+};
+
+}  // namespace adq
+
+#include "detail/SocketTransport_impl.hpp"
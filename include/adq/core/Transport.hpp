@@ -0,0 +1,89 @@
+#pragma once
+
+#include <asio.hpp>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace adq {
+
+/**
+ * A reliable, ordered byte stream to one other client, which NetworkManager
+ * uses to send and receive frames without depending on what kind of
+ * connection carries them. Each Transport is bound to its own strand, and
+ * all of its handlers are invoked on that strand; its methods must also
+ * only be called on that strand.
+ */
+class Transport {
+public:
+    using ConnectHandler = std::function<void(const asio::error_code&)>;
+    using IoHandler = std::function<void(const asio::error_code&, std::size_t)>;
+
+    virtual ~Transport() = default;
+    /** @return The strand that this transport's handlers run on */
+    virtual asio::any_io_executor get_executor() = 0;
+    /**
+     * Starts connecting to the peer this transport was constructed for. This
+     * is only used for outgoing transports; accepted transports are already connected.
+     */
+    virtual void async_connect(ConnectHandler handler) = 0;
+    /**
+     * Starts reading whatever bytes are available, up to the size of the buffer.
+     * The handler is called with asio::error::eof once the peer has closed its end.
+     */
+    virtual void async_read_some(asio::mutable_buffer buffer, IoHandler handler) = 0;
+    /**
+     * Starts writing every byte in a sequence of buffers. The buffers must stay
+     * valid until the handler is called, and only one write may be in progress at a time.
+     */
+    virtual void async_write(const std::vector<asio::const_buffer>& buffers, IoHandler handler) = 0;
+    /** Closes the transport, cancelling any operations that are in progress. */
+    virtual void close() = 0;
+};
+
+/**
+ * Accepts incoming Transports of one kind, and identifies which client
+ * opened each one.
+ */
+class TransportListener {
+protected:
+    /**
+     * Checks that the process at the other end of a Unix-domain socket runs as
+     * the same user as this one. Listeners for transports that only work
+     * within one host use this instead of checking the peer's address.
+     * @param socket_fd A connected Unix-domain socket
+     * @return True if the peer's credentials could be read and match this process's user
+     */
+    static bool is_same_user(int socket_fd);
+
+public:
+    /**
+     * Called with each accepted transport (already bound to its own strand),
+     * the ID the client that opened it claimed in its hello, and the address
+     * it connected from, or with an error if accepting a transport failed.
+     * Transports that only work within one host report an unspecified
+     * address, since their listeners have already checked the peer's user.
+     */
+    using AcceptHandler = std::function<void(const asio::error_code&, std::unique_ptr<Transport>, int,
+                                             const asio::ip::address&)>;
+
+    /**
+     * How long an accepted connection may take to send its hello before it is
+     * closed, so that connections that never introduce themselves don't stay open.
+     */
+    static constexpr std::chrono::seconds HELLO_TIMEOUT{5};
+
+    virtual ~TransportListener() = default;
+    /**
+     * Starts accepting incoming transports, and keeps accepting them until
+     * the listener is closed. The handler may be called concurrently for
+     * transports accepted at the same time.
+     */
+    virtual void start_accepting(AcceptHandler handler) = 0;
+    /** Stops listening. */
+    virtual void close() = 0;
+};
+
+}  // namespace adq
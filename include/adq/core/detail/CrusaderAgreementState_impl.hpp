@@ -32,10 +32,14 @@ std::vector<std::shared_ptr<messaging::OverlayMessage<RecordType>>> CrusaderAgre
         std::remove_copy(signed_value_entry.first->value_tuple.proxies.begin(),
                          signed_value_entry.first->value_tuple.proxies.end(), other_proxies.begin(), node_id);
         auto proxy_paths = util::find_paths(node_id, other_proxies, num_nodes, current_round + 1);
+        // The accepted value is the same for every proxy, so it only needs to be serialized once
+        std::vector<uint8_t> accepted_value_bytes(mutils::bytes_size(*signed_accepted_value));
+        mutils::to_bytes(*signed_accepted_value, accepted_value_bytes.data());
         for(const auto& proxy_path : proxy_paths) {
             auto accept_message = std::make_shared<messaging::PathOverlayMessage<RecordType>>(
                 query_num, proxy_path, signed_accepted_value);
-            crypto_library.rsa_encrypt(*accept_message, proxy_path.back());
+            crypto_library.rsa_encrypt(*accept_message, accepted_value_bytes.data(), accepted_value_bytes.size(),
+                                       proxy_path.back());
             accept_messages.emplace_back(std::move(accept_message));
         }
     }
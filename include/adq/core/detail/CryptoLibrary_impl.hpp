@@ -111,11 +111,17 @@ void CryptoLibrary::rsa_encrypt(messaging::OverlayMessage<RecordType>& message,
     std::size_t body_bytes_size = mutils::bytes_size(*message.enclosed_body);
     uint8_t body_bytes[body_bytes_size];
     mutils::to_bytes(*message.enclosed_body, body_bytes);
+    rsa_encrypt(message, body_bytes, body_bytes_size, target_id);
+}
 
+template <typename RecordType>
+void CryptoLibrary::rsa_encrypt(messaging::OverlayMessage<RecordType>& message, const uint8_t* body_bytes,
+                                std::size_t body_size, const int target_id) {
+    message.is_encrypted = true;
     // Create an EnvelopeEncryptor for the destination, using its public key
     openssl::EnvelopeEncryptor encryptor(public_keys_by_id.at(target_id), openssl::CipherAlgorithm::AES256_CBC);
     // Encrypted body format: encrypted session key, IV, encrypted payload
-    std::vector<uint8_t> encrypted_body = encryptor.make_encrypted_message(body_bytes, body_bytes_size);
+    std::vector<uint8_t> encrypted_body = encryptor.make_encrypted_message(body_bytes, body_size);
     message.enclosed_body = std::make_shared<messaging::ByteBody<RecordType>>(std::move(encrypted_body));
 }
 
@@ -127,20 +133,26 @@ void CryptoLibrary::rsa_decrypt(messaging::OverlayMessage<RecordType>& message)
     }
     std::shared_ptr<messaging::ByteBody<RecordType>> encrypted_body =
         std::static_pointer_cast<messaging::ByteBody<RecordType>>(message.enclosed_body);
+    message.enclosed_body = rsa_decrypt<RecordType>(encrypted_body->data(), encrypted_body->size());
+}
+
+template <typename RecordType>
+std::unique_ptr<messaging::MessageBody<RecordType>> CryptoLibrary::rsa_decrypt(const uint8_t* encrypted_body,
+                                                                               std::size_t encrypted_size) {
     // Encrypted body format: encrypted session key, IV, encrypted payload
     std::size_t key_iv_size = my_decryptor.get_IV_size() + my_decryptor.get_encrypted_key_size();
     // The plaintext will be no larger than the ciphertext, and possibly smaller
-    std::vector<uint8_t> decrypted_body(encrypted_body->size() - key_iv_size);
-    my_decryptor.init(encrypted_body->data(), encrypted_body->data() + my_decryptor.get_encrypted_key_size());
-    std::size_t bytes_written = my_decryptor.decrypt_bytes(encrypted_body->data() + key_iv_size,
-                                                           encrypted_body->size() - key_iv_size,
+    std::vector<uint8_t> decrypted_body(encrypted_size - key_iv_size);
+    my_decryptor.init(encrypted_body, encrypted_body + my_decryptor.get_encrypted_key_size());
+    std::size_t bytes_written = my_decryptor.decrypt_bytes(encrypted_body + key_iv_size,
+                                                           encrypted_size - key_iv_size,
                                                            decrypted_body.data());
     bytes_written += my_decryptor.finalize(decrypted_body.data() + bytes_written);
     // Shrink the array to fit
     assert(bytes_written <= decrypted_body.size());
     decrypted_body.resize(bytes_written);
     // Deserialize the decrypted payload
-    message.enclosed_body = mutils::from_bytes<messaging::MessageBody<RecordType>>(nullptr, decrypted_body.data());
+    return mutils::from_bytes<messaging::MessageBody<RecordType>>(nullptr, decrypted_body.data());
 }
 
 template <typename RecordType>
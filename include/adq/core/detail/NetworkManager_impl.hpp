@@ -1,11 +1,15 @@
 #include "../NetworkManager.hpp"
 
 #include "adq/config/Configuration.hpp"
+#include "adq/core/IoUringTransport.hpp"
 #include "adq/core/MessageConsumer.hpp"
+#include "adq/core/SharedMemoryTransport.hpp"
+#include "adq/core/SocketTransport.hpp"
 #include "adq/messaging/AggregationMessage.hpp"
 #include "adq/messaging/Message.hpp"
 #include "adq/messaging/MessageType.hpp"
 #include "adq/messaging/OverlayTransportMessage.hpp"
+#include "adq/messaging/OverlayTransportMessageView.hpp"
 #include "adq/messaging/PingMessage.hpp"
 #include "adq/messaging/QueryRequest.hpp"
 #include "adq/messaging/SignatureRequest.hpp"
@@ -13,313 +17,1331 @@
 
 #include "adq/mutils-serialization/SerializationSupport.hpp"
 
+#include <algorithm>
+#include <array>
 #include <asio.hpp>
 #include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
 
 namespace adq {
 
 template <typename RecordType>
 NetworkManager<RecordType>::NetworkManager(MessageConsumer<RecordType>* owning_client)
     : logger(spdlog::get("global_logger")),
+      num_io_threads(Configuration::getInstance().hasKey(Configuration::SECTION_SETUP, Configuration::NUM_NETWORK_THREADS)
+                         ? std::max(1u, Configuration::getUInt32(Configuration::SECTION_SETUP, Configuration::NUM_NETWORK_THREADS))
+                         : 1u),
+      delivery_strand(asio::make_strand(network_io_context)),
       message_handler(owning_client),
-      id_to_ip_map(read_ip_map_from_file(
-          Configuration::getString(Configuration::SECTION_SETUP, Configuration::CLIENT_LIST_FILE))),
-      connection_listener(network_io_context,
-                          asio::ip::tcp::endpoint(asio::ip::tcp::tcp::v4(),
-                                                  Configuration::getUInt16(Configuration::SECTION_SETUP, Configuration::CLIENT_PORT))) {
+      num_open_connections(0),
+      local_transport_dir(Configuration::getString(Configuration::SECTION_SETUP, Configuration::LOCAL_TRANSPORT_DIR).empty()
+                              ? "/tmp"
+                              : Configuration::getString(Configuration::SECTION_SETUP, Configuration::LOCAL_TRANSPORT_DIR)),
+      shared_memory_ring_size(Configuration::getInstance().hasKey(Configuration::SECTION_SETUP, Configuration::SHARED_MEMORY_RING_SIZE)
+                                  ? Configuration::getUInt32(Configuration::SECTION_SETUP, Configuration::SHARED_MEMORY_RING_SIZE)
+                                  : DEFAULT_SHARED_MEMORY_RING_SIZE),
+      num_shared_memory_transports(0),
+      max_open_connections(Configuration::getInstance().hasKey(Configuration::SECTION_SETUP, Configuration::MAX_OPEN_CONNECTIONS)
+                               ? std::max(1u, Configuration::getUInt32(Configuration::SECTION_SETUP, Configuration::MAX_OPEN_CONNECTIONS))
+                               : DEFAULT_MAX_OPEN_CONNECTIONS),
+      connection_idle_timeout(Configuration::getInstance().hasKey(Configuration::SECTION_SETUP, Configuration::CONNECTION_IDLE_TIMEOUT)
+                                  ? Configuration::getUInt32(Configuration::SECTION_SETUP, Configuration::CONNECTION_IDLE_TIMEOUT)
+                                  : DEFAULT_CONNECTION_IDLE_TIMEOUT),
+      idle_reaper_timer(network_io_context),
+      peer_send_budget(Configuration::getInstance().hasKey(Configuration::SECTION_SETUP, Configuration::PEER_SEND_BUDGET)
+                           ? Configuration::getUInt32(Configuration::SECTION_SETUP, Configuration::PEER_SEND_BUDGET)
+                           : 0),
+      total_send_budget(Configuration::getInstance().hasKey(Configuration::SECTION_SETUP, Configuration::TOTAL_SEND_BUDGET)
+                            ? Configuration::getUInt32(Configuration::SECTION_SETUP, Configuration::TOTAL_SEND_BUDGET)
+                            : 0),
+      send_budget_policy(parse_send_budget_policy(
+          Configuration::getString(Configuration::SECTION_SETUP, Configuration::SEND_BUDGET_POLICY), num_io_threads)),
+      send_block_timeout(Configuration::getInstance().hasKey(Configuration::SECTION_SETUP, Configuration::SEND_BLOCK_TIMEOUT)
+                             ? Configuration::getUInt32(Configuration::SECTION_SETUP, Configuration::SEND_BLOCK_TIMEOUT)
+                             : DEFAULT_SEND_BLOCK_TIMEOUT),
+      send_queue_metrics{0, 0, 0, 0, 0},
+      // The query server doesn't have a client ID
+      local_id(Configuration::getString(Configuration::SECTION_SETUP, Configuration::CLIENT_ID).empty()
+                   ? UTILITY_NODE_ID
+                   : Configuration::getInt32(Configuration::SECTION_SETUP, Configuration::CLIENT_ID)),
+      use_udp_control(Configuration::getInstance().hasKey(Configuration::SECTION_SETUP, Configuration::UDP_CONTROL_MESSAGES)
+                      && Configuration::getBool(Configuration::SECTION_SETUP, Configuration::UDP_CONTROL_MESSAGES)),
+      udp_retry_interval(Configuration::getInstance().hasKey(Configuration::SECTION_SETUP, Configuration::UDP_RETRY_INTERVAL)
+                             ? Configuration::getUInt32(Configuration::SECTION_SETUP, Configuration::UDP_RETRY_INTERVAL)
+                             : DEFAULT_UDP_RETRY_INTERVAL),
+      control_socket(asio::make_strand(network_io_context)),
+      datagram_flush_scheduled(false),
+      datagram_receive_storage(use_udp_control ? util::BufferPool::getInstance().acquire(DATAGRAM_BATCH_SIZE * MAX_DATAGRAM_SIZE)
+                                               : nullptr),
+      fault_injection_seed(Configuration::getInstance().hasKey(Configuration::SECTION_SETUP, Configuration::FAULT_INJECTION_SEED)
+                               ? Configuration::getUInt64(Configuration::SECTION_SETUP, Configuration::FAULT_INJECTION_SEED)
+                               : 0),
+      num_fault_injected_transports(0) {
     assert(message_handler != nullptr);
-    // Initialize the receive buffers with empty arrays, and initialize the reverse IP-to-ID map
-    for(const auto& id_ip_pair : id_to_ip_map) {
-        length_buffers.emplace(id_ip_pair.first, std::array<uint8_t, sizeof(std::size_t)>{});
-        ip_to_id_map.emplace(id_ip_pair.second, id_ip_pair.first);
+    std::map<int, PeerAddress> peer_list = read_peer_list_from_file(
+        Configuration::getString(Configuration::SECTION_SETUP, Configuration::CLIENT_LIST_FILE));
+    // The map is sorted, so the last entry has the largest ID; leave room for UTILITY_NODE_ID at index 0
+    peers = std::vector<Peer>(peer_list.empty() ? 1 : std::max(peer_list.rbegin()->first + 2, 1));
+    for(const auto& id_address_pair : peer_list) {
+        if(id_address_pair.first < UTILITY_NODE_ID) {
+            logger->warn("Ignoring invalid client ID {} in the client list", id_address_pair.first);
+            continue;
+        }
+        const asio::ip::tcp::endpoint& endpoint = id_address_pair.second.endpoint;
+        Peer& peer = get_peer(id_address_pair.first);
+        peer.endpoint = endpoint;
+        peer.control_endpoint = asio::ip::udp::endpoint(endpoint.address(), endpoint.port());
+        peer.transport = id_address_pair.second.transport;
+        peer.has_address = true;
+    }
+    const std::string fault_injection_file = Configuration::getString(Configuration::SECTION_SETUP, Configuration::FAULT_INJECTION_FILE);
+    if(!fault_injection_file.empty()) {
+        std::vector<int> peer_ids{UTILITY_NODE_ID};
+        for(const auto& id_address_pair : peer_list) {
+            peer_ids.push_back(id_address_pair.first);
+        }
+        fault_profiles = read_fault_profiles_from_file(fault_injection_file, local_id, peer_ids);
+        std::seed_seq datagram_seed{fault_injection_seed, static_cast<std::uint64_t>(local_id + 1)};
+        datagram_fault_engine.seed(datagram_seed);
+        logger->warn("Injecting simulated network faults on connections to {} peers, with seed {}",
+                     fault_profiles.size(), fault_injection_seed);
+    }
+    if(use_udp_control) {
+        control_socket.open(asio::ip::udp::v4());
+        control_socket.bind(asio::ip::udp::endpoint(asio::ip::udp::v4(),
+                                                    Configuration::getUInt16(Configuration::SECTION_SETUP, Configuration::CLIENT_PORT)));
+        // The control socket is only used with non-blocking batched system calls
+        control_socket.non_blocking(true);
     }
-    do_accept();
+    start_listeners();
+    if(use_udp_control) {
+        start_datagram_receive();
+    }
+    reap_idle_connections();
 }
 
 template <typename RecordType>
-void NetworkManager<RecordType>::do_accept() {
-    connection_listener.async_accept(network_io_context,
-                                     [this](const asio::error_code& error, asio::ip::tcp::socket peer) {
-                                         handle_accept(error, std::move(peer));
-                                     });
+typename NetworkManager<RecordType>::SendBudgetPolicy NetworkManager<RecordType>::parse_send_budget_policy(const std::string& policy_name,
+                                                                                                                   unsigned int num_io_threads) {
+    if(policy_name.empty() || policy_name == "fail") {
+        return SendBudgetPolicy::FAIL;
+    } else if(policy_name == "block") {
+        // A sender blocked on the only I/O thread would stall the writes that could unblock it
+        if(num_io_threads < 2) {
+            throw std::invalid_argument("The \"block\" send budget policy needs at least 2 network threads");
+        }
+        return SendBudgetPolicy::BLOCK;
+    } else if(policy_name == "drop") {
+        return SendBudgetPolicy::DROP;
+    }
+    throw std::invalid_argument("Unknown send budget policy \"" + policy_name + "\"");
+}
+
+template <typename RecordType>
+void NetworkManager<RecordType>::start_listeners() {
+    const uint16_t listen_port = Configuration::getUInt16(Configuration::SECTION_SETUP, Configuration::CLIENT_PORT);
+    const asio::ip::tcp::endpoint tcp_endpoint(asio::ip::tcp::v4(), listen_port);
+    const bool use_io_uring = Configuration::getInstance().hasKey(Configuration::SECTION_SETUP, Configuration::USE_IO_URING)
+                              && Configuration::getBool(Configuration::SECTION_SETUP, Configuration::USE_IO_URING);
+#ifdef ADQ_HAS_IO_URING
+    if(use_io_uring) {
+        try {
+            io_uring_service = std::make_unique<IoUringService>(network_io_context, IoUringService::DEFAULT_ENTRIES);
+        } catch(std::system_error& e) {
+            logger->warn("io_uring is not available, falling back to the ASIO reactor: {}", e.what());
+        }
+    }
+    if(io_uring_service) {
+        listeners.emplace_back(std::make_unique<IoUringListener>(*io_uring_service, network_io_context, tcp_endpoint));
+    }
+#else
+    if(use_io_uring) {
+        logger->warn("io_uring is not supported on this platform, falling back to the ASIO reactor");
+    }
+#endif
+    if(listeners.empty()) {
+        listeners.emplace_back(std::make_unique<SocketListener<asio::ip::tcp>>(network_io_context, tcp_endpoint));
+    }
+    // Other clients on this host reach it over the local transport named in its own entry, if there is one
+    const TransportType local_transport = local_id + 1 < static_cast<int>(peers.size()) && get_peer(local_id).has_address
+                                                  ? get_peer(local_id).transport
+                                                  : TransportType::TCP;
+    if(local_transport != TransportType::TCP) {
+        local_listener_path = local_socket_path(listen_port, local_transport);
+        // A socket file left behind by an earlier run would make the bind fail
+        ::unlink(local_listener_path.c_str());
+        asio::local::stream_protocol::endpoint local_endpoint(local_listener_path);
+        if(local_transport == TransportType::UNIX) {
+            listeners.emplace_back(std::make_unique<SocketListener<asio::local::stream_protocol>>(network_io_context, local_endpoint));
+        } else {
+            listeners.emplace_back(std::make_unique<SharedMemoryListener>(network_io_context, local_endpoint));
+        }
+        logger->debug("Listening for local connections at {}", local_listener_path);
+    }
+    for(auto& listener : listeners) {
+        listener->start_accepting([this](const asio::error_code& error, std::unique_ptr<Transport> transport, int client_id,
+                                         const asio::ip::address& remote_address) {
+            handle_accept(error, std::move(transport), client_id, remote_address);
+        });
+    }
+}
+
+template <typename RecordType>
+std::string NetworkManager<RecordType>::local_socket_path(uint16_t port, TransportType transport) const {
+    return local_transport_dir + "/adq-" + std::to_string(port) + (transport == TransportType::UNIX ? ".sock" : ".shm");
+}
+
+template <typename RecordType>
+std::unique_ptr<Transport> NetworkManager<RecordType>::make_transport(const Peer& peer) {
+    // Give each new transport its own strand, so its handlers never run concurrently.
+    // Every transport introduces this client with its ID, so the peer can reuse the connection.
+    switch(peer.transport) {
+        case TransportType::UNIX:
+            return std::make_unique<SocketTransport<asio::local::stream_protocol>>(
+                asio::local::stream_protocol::socket(asio::make_strand(network_io_context)),
+                asio::local::stream_protocol::endpoint(local_socket_path(peer.endpoint.port(), TransportType::UNIX)),
+                local_id);
+        case TransportType::SHARED_MEMORY:
+            // The ring names are unique to each connection, since creating a ring replaces any with the same name.
+            // The process ID keeps them apart from the rings of an earlier run with the same client ID.
+            return std::make_unique<SharedMemoryTransport>(
+                asio::make_strand(network_io_context),
+                asio::local::stream_protocol::endpoint(local_socket_path(peer.endpoint.port(), TransportType::SHARED_MEMORY)),
+                "/adq-" + std::to_string(peer.endpoint.port()) + "-" + std::to_string(local_id) + "-"
+                    + std::to_string(::getpid()) + "-" + std::to_string(num_shared_memory_transports++),
+                shared_memory_ring_size, local_id);
+        case TransportType::TCP:
+        default:
+#ifdef ADQ_HAS_IO_URING
+            if(io_uring_service) {
+                return std::make_unique<IoUringTransport>(*io_uring_service, asio::make_strand(network_io_context),
+                                                          peer.endpoint, local_id);
+            }
+#endif
+            return std::make_unique<SocketTransport<asio::ip::tcp>>(
+                asio::ip::tcp::socket(asio::make_strand(network_io_context)), peer.endpoint, local_id);
+    }
+}
+
+template <typename RecordType>
+std::unique_ptr<Transport> NetworkManager<RecordType>::inject_faults(int peer_id, std::unique_ptr<Transport> transport) {
+    auto profile = fault_profiles.find(peer_id);
+    if(profile == fault_profiles.end()) {
+        return transport;
+    }
+    // Each transport gets its own random stream, which depends only on the seed and the order transports are created in
+    std::seed_seq transport_seed{fault_injection_seed, static_cast<std::uint64_t>(local_id + 1),
+                                 static_cast<std::uint64_t>(peer_id + 1), num_fault_injected_transports++};
+    std::uint64_t seed;
+    transport_seed.generate(reinterpret_cast<std::uint32_t*>(&seed), reinterpret_cast<std::uint32_t*>(&seed + 1));
+    return std::make_unique<FaultInjectingTransport>(std::move(transport), profile->second, seed);
 }
 
 template <typename RecordType>
 NetworkManager<RecordType>::~NetworkManager() {
     shutdown();
+    if(!local_listener_path.empty()) {
+        ::unlink(local_listener_path.c_str());
+    }
 }
 
 template <typename RecordType>
-void NetworkManager<RecordType>::handle_accept(const asio::error_code& error, asio::ip::tcp::socket new_socket) {
-    // Put the new socket in the map
-    asio::ip::tcp::endpoint client_ip = new_socket.remote_endpoint();
-    int client_id = ip_to_id_map.at(client_ip);
-    sockets_by_id.emplace(client_id, std::move(new_socket));
-    // Enqueue an async read for the first 4 bytes (size of the message)
-    start_size_read(client_id);
-    // Enqueue another accept operation for the connection listener so it keeps listening
-    do_accept();
+void NetworkManager<RecordType>::handle_accept(const asio::error_code& error, std::unique_ptr<Transport> transport, int client_id,
+                                               const asio::ip::address& remote_address) {
+    if(error) {
+        logger->error("Error accepting a connection: {}", error.message());
+        return;
+    }
+    // The ID came from the peer's hello, so it can't be trusted to index the peer table
+    if(client_id < UTILITY_NODE_ID || client_id + 1 >= static_cast<int>(peers.size())) {
+        logger->warn("Rejecting a connection from unknown client {}", client_id);
+        transport->close();
+        return;
+    }
+    // Local transports were already checked by their listeners; a TCP peer must connect from its own address
+    if(!remote_address.is_unspecified()) {
+        asio::ip::address source_address = remote_address;
+        if(source_address.is_v6() && source_address.to_v6().is_v4_mapped()) {
+            source_address = asio::ip::make_address_v4(asio::ip::v4_mapped, source_address.to_v6());
+        }
+        const Peer& claimed_peer = get_peer(client_id);
+        if(!claimed_peer.has_address || claimed_peer.endpoint.address() != source_address) {
+            logger->warn("Rejecting a connection from {} claiming to be client {}", source_address.to_string(), client_id);
+            transport->close();
+            return;
+        }
+    }
+    auto connection = std::make_shared<Connection>(inject_faults(client_id, std::move(transport)), ConnectionState::CONNECTED, false);
+    {
+        std::lock_guard<std::mutex> lock(connections_mutex);
+        Peer& peer = get_peer(client_id);
+        std::shared_ptr<Connection> existing = peer.connection;
+        if(existing && existing->outgoing && existing->state != ConnectionState::FAILED && local_id < client_id) {
+            /* Both clients connected to each other at once. They agree to keep the connection opened
+             * by the lower ID, so this one is only read from until the peer closes it, in case it
+             * already sent something on it. */
+            logger->trace("Client {} connected while a connection to it was already open; keeping ours", client_id);
+        } else {
+            if(existing) {
+                // The new connection takes over the old one's place in the LRU list
+                connection->lru_position = existing->lru_position;
+                connection_lru.splice(connection_lru.begin(), connection_lru, existing->lru_position);
+                close_when_flushed(existing);
+            } else {
+                make_room_for_connection();
+                connection->lru_position = connection_lru.insert(connection_lru.begin(), client_id);
+                ++num_open_connections;
+            }
+            peer.connection = connection;
+        }
+    }
+    // Enqueue an async read on the connection's strand, which will keep reading messages until the client disconnects
+    asio::post(connection->transport->get_executor(), [this, client_id, connection]() {
+        start_read(client_id, connection);
+    });
 }
 
 template <typename RecordType>
-void NetworkManager<RecordType>::start_size_read(int client_id) {
-    asio::async_read(sockets_by_id.at(client_id),
-                     asio::buffer(length_buffers.at(client_id)),
-                     [this, client_id](const asio::error_code& error, std::size_t bytes_transferred) {
-                         handle_size_read(client_id, error, bytes_transferred);
-                     });
+void NetworkManager<RecordType>::start_read(int client_id, std::shared_ptr<Connection> connection) {
+    uint8_t* free_space = connection->receive_buffer.prepare();
+    // The transport's handlers always run on the connection's strand
+    connection->transport->async_read_some(
+        asio::buffer(free_space, connection->receive_buffer.free_space()),
+        [this, client_id, connection](const asio::error_code& error, std::size_t bytes_read) {
+            handle_read(client_id, connection, error, bytes_read);
+        });
 }
 
 template <typename RecordType>
-void NetworkManager<RecordType>::handle_size_read(int client_id, const asio::error_code& error, std::size_t bytes_read) {
+void NetworkManager<RecordType>::handle_read(int client_id, std::shared_ptr<Connection> connection,
+                                             const asio::error_code& error, std::size_t bytes_read) {
     if(!error) {
-        // Read the size of the message from the buffer.
-        std::size_t message_size = reinterpret_cast<std::size_t*>(length_buffers.at(client_id).data())[0];
-        // Start an async read for the rest of the message
-        start_body_read(client_id, message_size);
-    } else if(error == asio::error::eof || error == asio::error::connection_aborted) {
-        logger->debug("Client {} disconnected before sending message length", client_id);
+        util::FramedReceiveBuffer& receive_buffer = connection->receive_buffer;
+        receive_buffer.commit(bytes_read);
+        // Dispatch every complete message in the buffer; a partial message will stay in the buffer until the next read
+        const uint8_t* message_body;
+        std::size_t message_size;
+        Peer& peer = get_peer(client_id);
+        connection->received_since_reap = true;
+        while(receive_buffer.next_frame(message_body, message_size)) {
+            logger->debug("Received a message of size {} from client {}", message_size, client_id);
+            ++peer.frames_received;
+            // Send it to the application-level handler
+            receive_message(receive_buffer.share_frame(message_body), message_size);
+        }
+        if(receive_buffer.has_oversized_frame()) {
+            logger->error("Client {} sent a frame larger than {} bytes; closing its connection",
+                          client_id, util::FramedReceiveBuffer::MAX_FRAME_SIZE);
+            // The rest of the stream can't be parsed, so close it now instead of waiting for writes to flush
+            remove_connection(client_id, connection);
+            discard_queued_frames(client_id, connection);
+            connection->transport->close();
+            return;
+        }
+        // Keep reading from the same connection
+        start_read(client_id, std::move(connection));
+    } else if(error == asio::error::operation_aborted) {
+        // The transport was closed or replaced by a new connection, so there is nothing to clean up
+        return;
+    } else if(error == asio::error::eof || error == asio::error::connection_reset) {
+        if(connection->receive_buffer.bytes_buffered() > 0) {
+            logger->debug("Client {} disconnected before sending entire message", client_id);
+        } else {
+            logger->debug("Client {} closed its connection after sending {} messages", client_id, get_peer(client_id).frames_received.load());
+        }
+        remove_connection(client_id, connection);
     } else {
-        logger->error("Unexpected error while reading message size from client {}: {}", client_id, error.message());
+        logger->error("Unexpected error while reading from client {}: {}", client_id, error.message());
+        remove_connection(client_id, connection);
     }
 }
 
 template <typename RecordType>
-void NetworkManager<RecordType>::start_body_read(int client_id, std::size_t body_size) {
-    // Create or resize a buffer to the correct size
-    incoming_message_buffers[client_id].resize(body_size);
-    asio::async_read(sockets_by_id.at(client_id),
-                     asio::buffer(incoming_message_buffers.at(client_id)),
-                     [this, client_id](const asio::error_code& error, std::size_t bytes_read) {
-                         handle_body_read(client_id, error, bytes_read);
-                     });
+typename NetworkManager<RecordType>::Peer& NetworkManager<RecordType>::get_peer(int client_id) {
+    // Negative indices wrap around to very large values, so at() rejects IDs below UTILITY_NODE_ID too
+    return peers.at(static_cast<std::size_t>(client_id + 1));
 }
 
 template <typename RecordType>
-void NetworkManager<RecordType>::handle_body_read(int client_id, const asio::error_code& error, std::size_t bytes_read) {
-    if(!error) {
-        logger->debug("Received a message of size {} from client {}", incoming_message_buffers[client_id].size(), client_id);
-        // Send it to the application-level handler
-        receive_message(incoming_message_buffers[client_id]);
-    } else if(error == asio::error::eof || error == asio::error::connection_aborted) {
-        logger->debug("Client {} disconnected before sending entire message", client_id);
-        sockets_by_id.erase(client_id);
-    } else {
-        logger->error("Unexpected error while reading message body from client {}: {}", client_id, error.message());
-        sockets_by_id.erase(client_id);
-    }
+template <typename MessageType>
+void NetworkManager<RecordType>::deliver_message(std::shared_ptr<MessageType> message) {
+    asio::post(delivery_strand, [this, message]() {
+        message_handler->handle_message(message);
+    });
 }
 
 template <typename RecordType>
-void NetworkManager<RecordType>::receive_message(const std::vector<uint8_t>& message_bytes) {
+void NetworkManager<RecordType>::receive_message(std::shared_ptr<const uint8_t> frame, std::size_t message_size,
+                                                 const asio::ip::udp::endpoint* datagram_source) {
     using namespace messaging;
+    const uint8_t* message_bytes = frame.get();
+    std::size_t num_messages;
+    if(message_size < sizeof(num_messages)) {
+        logger->warn("NetworkManager dropped a frame of size {}, which is too small to hold a batch", message_size);
+        return;
+    }
     // First, read the number of messages in the list
-    std::size_t num_messages = ((std::size_t*)message_bytes.data())[0];
-    const uint8_t* buffer = message_bytes.data() + sizeof(num_messages);
+    std::memcpy(&num_messages, message_bytes, sizeof(num_messages));
+    const uint8_t* buffer = message_bytes + sizeof(num_messages);
+    const uint8_t* const frame_end = message_bytes + message_size;
+    // Checks that a message of the given size, starting at buffer, ends within the frame
+    auto fits_in_frame = [&](std::size_t size) { return size <= static_cast<std::size_t>(frame_end - buffer); };
     // Deserialize that number of messages, moving the buffer pointer each time one is deserialized
     for(auto i = 0u; i < num_messages; ++i) {
+        if(buffer >= frame_end) {
+            logger->warn("NetworkManager received a batch that claimed to have {} messages, but only contained {}", num_messages, i);
+            break;
+        }
+        if(!fits_in_frame(sizeof(MessageType))) {
+            logger->warn("NetworkManager dropped the rest of a batch that ended in the middle of a message");
+            return;
+        }
         /* This is the exact same logic used in Message::from_bytes. We could just do
-         * auto message = mutils::from_bytes<messaging::Message>(nullptr, message_bytes.data());
+         * auto message = mutils::from_bytes<messaging::Message>(nullptr, message_bytes);
          * but then we would have to use dynamic_pointer_cast to figure out which subclass
          * was deserialized and call the right message_handler.handle_message() overload.
          */
-        MessageType message_type = ((MessageType*)(buffer))[0];
-        // Deserialize the correct message subclass based on the type, and call the correct handler
+        MessageType message_type;
+        std::memcpy(&message_type, buffer, sizeof(message_type));
+        if(datagram_source && message_type != PingMessage<RecordType>::type
+           && message_type != OverlayTransportMessage<RecordType>::type) {
+            logger->warn("NetworkManager dropped a datagram from {} with a message type that is never sent over UDP",
+                         datagram_source->address().to_string());
+            return;
+        }
+        // Deserialize the correct message subclass based on the type, and call the correct handler.
+        // A message that would run past the end of the frame means the rest of the frame can't be trusted.
         switch(message_type) {
             case OverlayTransportMessage<RecordType>::type: {
-                std::shared_ptr<OverlayTransportMessage<RecordType>> message(mutils::from_bytes<OverlayTransportMessage<RecordType>>(nullptr, buffer));
-                buffer += mutils::bytes_size(*message);
-                message_handler->handle_message(message);
+                // Overlay messages are delivered undeserialized, sharing ownership of the frame,
+                // so their length fields must be checked against the frame before the view can use them
+                const std::size_t size = OverlayTransportMessageView<RecordType>::validate(buffer, frame_end - buffer);
+                if(size == 0) {
+                    logger->warn("NetworkManager dropped a malformed overlay message");
+                    return;
+                }
+                if(datagram_source) {
+                    int claimed_sender;
+                    std::memcpy(&claimed_sender, buffer + sizeof(MessageType) + sizeof(int) + sizeof(bool), sizeof(claimed_sender));
+                    if(!is_datagram_from(claimed_sender, *datagram_source)) {
+                        logger->warn("NetworkManager dropped an overlay datagram from {} claiming to be from client {}",
+                                     datagram_source->address().to_string(), claimed_sender);
+                        return;
+                    }
+                }
+                auto message = std::make_shared<OverlayTransportMessageView<RecordType>>(
+                        std::shared_ptr<const uint8_t>(frame, buffer), size);
+                buffer += size;
+                deliver_message(std::move(message));
                 break;
             }
             case PingMessage<RecordType>::type: {
+                if(!fits_in_frame(mutils::bytes_size(PingMessage<RecordType>(0)))) {
+                    logger->warn("NetworkManager dropped a ping that ran past the end of its frame");
+                    return;
+                }
                 std::shared_ptr<PingMessage<RecordType>> message(mutils::from_bytes<PingMessage<RecordType>>(nullptr, buffer));
                 buffer += mutils::bytes_size(*message);
-                message_handler->handle_message(message);
+                // A forged response could otherwise hide a failed peer
+                if(datagram_source && !is_datagram_from(message->sender_id, *datagram_source)) {
+                    logger->warn("NetworkManager dropped a ping datagram from {} claiming to be from client {}",
+                                 datagram_source->address().to_string(), message->sender_id);
+                    return;
+                }
+                if(message->is_response) {
+                    handle_ping_response(message->sender_id);
+                }
+                deliver_message(std::move(message));
                 break;
             }
             case AggregationMessage<RecordType>::type: {
                 std::shared_ptr<AggregationMessage<RecordType>> message(mutils::from_bytes<AggregationMessage<RecordType>>(nullptr, buffer));
-                buffer += mutils::bytes_size(*message);
-                message_handler->handle_message(message);
+                const std::size_t size = mutils::bytes_size(*message);
+                if(!fits_in_frame(size)) {
+                    logger->warn("NetworkManager dropped an aggregation message that ran past the end of its frame");
+                    return;
+                }
+                buffer += size;
+                deliver_message(std::move(message));
                 break;
             }
             case QueryRequest<RecordType>::type: {
                 std::shared_ptr<QueryRequest<RecordType>> message(mutils::from_bytes<QueryRequest<RecordType>>(nullptr, buffer));
-                buffer += mutils::bytes_size(*message);
+                const std::size_t size = mutils::bytes_size(*message);
+                if(!fits_in_frame(size)) {
+                    logger->warn("NetworkManager dropped a QueryRequest that ran past the end of its frame");
+                    return;
+                }
+                buffer += size;
                 std::cout << "Received a QueryRequest: " << *message << std::endl;
-                message_handler->handle_message(message);
+                deliver_message(std::move(message));
                 break;
             }
             case SignatureRequest<RecordType>::type: {
                 std::shared_ptr<SignatureRequest<RecordType>> message(mutils::from_bytes<SignatureRequest<RecordType>>(nullptr, buffer));
-                buffer += mutils::bytes_size(*message);
-                message_handler->handle_message(message);
+                const std::size_t size = mutils::bytes_size(*message);
+                if(!fits_in_frame(size)) {
+                    logger->warn("NetworkManager dropped a SignatureRequest that ran past the end of its frame");
+                    return;
+                }
+                buffer += size;
+                deliver_message(std::move(message));
                 break;
             }
             case SignatureResponse<RecordType>::type: {
                 std::shared_ptr<SignatureResponse<RecordType>> message(mutils::from_bytes<SignatureResponse<RecordType>>(nullptr, buffer));
-                buffer += mutils::bytes_size(*message);
-                message_handler->handle_message(message);
+                const std::size_t size = mutils::bytes_size(*message);
+                if(!fits_in_frame(size)) {
+                    logger->warn("NetworkManager dropped a SignatureResponse that ran past the end of its frame");
+                    return;
+                }
+                buffer += size;
+                deliver_message(std::move(message));
                 break;
             }
             default:
+                // Without a known type, the message's size is unknown, so the rest of the batch can't be found
                 logger->warn("NetworkManager dropped a message with an invalid type.");
+                return;
+        }
+    }
+}
+
+template <typename RecordType>
+std::shared_ptr<typename NetworkManager<RecordType>::Connection> NetworkManager<RecordType>::get_connection(int recipient_id) {
+    std::lock_guard<std::mutex> lock(connections_mutex);
+    Peer& peer = get_peer(recipient_id);
+    if(!peer.connection) {
+        // A peer that connected to this client can be answered even if it is not in the client list
+        if(!peer.has_address) {
+            throw std::out_of_range("No address for client " + std::to_string(recipient_id) + " in the client list");
+        }
+        make_room_for_connection();
+        auto connection = std::make_shared<Connection>(inject_faults(recipient_id, make_transport(peer)),
+                                                       ConnectionState::CONNECTING, true);
+        connection->lru_position = connection_lru.insert(connection_lru.begin(), recipient_id);
+        peer.connection = connection;
+        ++num_open_connections;
+        connection->transport->async_connect([this, recipient_id, connection](const asio::error_code& error) {
+            handle_connect(recipient_id, connection, error);
+        });
+    } else {
+        // Move the existing connection to the front of the LRU list
+        connection_lru.splice(connection_lru.begin(), connection_lru, peer.connection->lru_position);
+    }
+    peer.connection->last_used = std::chrono::steady_clock::now();
+    return peer.connection;
+}
+
+template <typename RecordType>
+void NetworkManager<RecordType>::make_room_for_connection() {
+    while(!connection_lru.empty() && num_open_connections >= max_open_connections) {
+        logger->debug("Closing connection to client {} to stay under the limit of {} open connections",
+                      connection_lru.back(), max_open_connections);
+        close_connection(connection_lru.back());
+    }
+}
+
+template <typename RecordType>
+void NetworkManager<RecordType>::handle_connect(int recipient_id, std::shared_ptr<Connection> connection, const asio::error_code& error) {
+    if(error) {
+        logger->debug("Failed to connect to client {}: {}", recipient_id, error.message());
+        // Leave the connection in the map so that the next send can report the failure
+        connection->state = ConnectionState::FAILED;
+        discard_queued_frames(recipient_id, connection);
+        return;
+    }
+    connection->state = ConnectionState::CONNECTED;
+    logger->trace("Connected to client {}, sending {} queued messages", recipient_id,
+                  connection->control_queue.size() + connection->bulk_queue.size());
+    // The peer may answer on this same connection
+    start_read(recipient_id, connection);
+    flush_send_queue(recipient_id, connection);
+    if(connection->closing && connection->frames_in_flight.empty()) {
+        // The connection was evicted while connecting, with nothing queued to send
+        connection->transport->close();
+    }
+}
+
+template <typename RecordType>
+bool NetworkManager<RecordType>::check_connection_failed(int recipient_id, const std::shared_ptr<Connection>& connection) {
+    if(connection->state != ConnectionState::FAILED) {
+        return false;
+    }
+    remove_connection(recipient_id, connection);
+    return true;
+}
+
+template <typename RecordType>
+void NetworkManager<RecordType>::remove_connection(int peer_id, const std::shared_ptr<Connection>& connection) {
+    std::lock_guard<std::mutex> lock(connections_mutex);
+    if(get_peer(peer_id).connection == connection) {
+        close_connection(peer_id);
+    }
+}
+
+template <typename RecordType>
+void NetworkManager<RecordType>::close_connection(int peer_id) {
+    Peer& peer = get_peer(peer_id);
+    std::shared_ptr<Connection> connection = std::move(peer.connection);
+    connection_lru.erase(connection->lru_position);
+    --num_open_connections;
+    close_when_flushed(connection);
+}
+
+template <typename RecordType>
+void NetworkManager<RecordType>::close_when_flushed(const std::shared_ptr<Connection>& connection) {
+    // Let any frames that were already queued finish sending before closing the transport
+    asio::post(connection->transport->get_executor(), [connection]() {
+        connection->closing = true;
+        if(connection->state == ConnectionState::FAILED
+           || (connection->state == ConnectionState::CONNECTED && connection->frames_in_flight.empty())) {
+            connection->transport->close();
+        }
+    });
+}
+
+template <typename RecordType>
+void NetworkManager<RecordType>::reap_idle_connections() {
+    if(connection_idle_timeout.count() <= 0) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(connections_mutex);
+        const auto idle_cutoff = std::chrono::steady_clock::now() - connection_idle_timeout;
+        // The LRU list is ordered by last use, so the idle connections are all at the back
+        while(!connection_lru.empty()) {
+            const int peer_id = connection_lru.back();
+            Peer& peer = get_peer(peer_id);
+            if(peer.connection->last_used > idle_cutoff) {
                 break;
+            }
+            if(peer.connection->received_since_reap.exchange(false)) {
+                // The peer is still using the connection, so it counts as used now
+                peer.connection->last_used = std::chrono::steady_clock::now();
+                connection_lru.splice(connection_lru.begin(), connection_lru, peer.connection->lru_position);
+                continue;
+            }
+            logger->trace("Closing idle connection to client {}, after sending {} messages", peer_id, peer.frames_sent.load());
+            close_connection(peer_id);
+        }
+    }
+    // Check again after half the timeout, so no connection stays open much longer than the timeout
+    idle_reaper_timer.expires_after(connection_idle_timeout / 2);
+    idle_reaper_timer.async_wait([this](const asio::error_code& error) {
+        if(!error) {
+            reap_idle_connections();
+        }
+    });
+}
+
+template <typename RecordType>
+typename NetworkManager<RecordType>::BudgetDecision NetworkManager<RecordType>::reserve_send_budget(
+    int recipient_id, std::size_t frame_size, bool droppable) {
+    Peer& peer = get_peer(recipient_id);
+    std::unique_lock<std::mutex> lock(send_budget_mutex);
+    // An empty queue always accepts one frame, so a frame larger than the budget can still be sent
+    auto within_budgets = [&]() {
+        return (peer_send_budget == 0 || peer.bytes_queued == 0 || peer.bytes_queued + frame_size <= peer_send_budget)
+               && (total_send_budget == 0 || send_queue_metrics.total_bytes_queued == 0
+                   || send_queue_metrics.total_bytes_queued + frame_size <= total_send_budget);
+    };
+    if(!within_budgets()) {
+        if(send_budget_policy == SendBudgetPolicy::BLOCK) {
+            ++send_queue_metrics.producer_blocks;
+            send_budget_released.wait_for(lock, send_block_timeout, within_budgets);
+        }
+        if(!within_budgets()) {
+            if(droppable && send_budget_policy == SendBudgetPolicy::DROP) {
+                ++send_queue_metrics.frames_dropped;
+                return BudgetDecision::DROP;
+            }
+            ++send_queue_metrics.frames_rejected;
+            logger->warn("Send queue to client {} is over budget, with {} bytes queued to it and {} in total",
+                         recipient_id, peer.bytes_queued, send_queue_metrics.total_bytes_queued);
+            return BudgetDecision::REJECT;
         }
     }
+    peer.bytes_queued += frame_size;
+    send_queue_metrics.total_bytes_queued += frame_size;
+    send_queue_metrics.peak_total_bytes_queued = std::max(send_queue_metrics.peak_total_bytes_queued,
+                                                          send_queue_metrics.total_bytes_queued);
+    return BudgetDecision::ACCEPT;
 }
 
 template <typename RecordType>
-void NetworkManager<RecordType>::initialize_socket(int recipient_id) {
-    auto socket_map_find = sockets_by_id.lower_bound(recipient_id);
-    if(socket_map_find == sockets_by_id.end() || socket_map_find->first != recipient_id) {
-        sockets_by_id.emplace_hint(socket_map_find, recipient_id,
-                                   asio::ip::tcp::socket(network_io_context, id_to_ip_map.at(recipient_id)));
+void NetworkManager<RecordType>::release_send_budget(int recipient_id, std::size_t num_bytes) {
+    {
+        std::lock_guard<std::mutex> lock(send_budget_mutex);
+        get_peer(recipient_id).bytes_queued -= num_bytes;
+        send_queue_metrics.total_bytes_queued -= num_bytes;
     }
+    if(send_budget_policy == SendBudgetPolicy::BLOCK) {
+        send_budget_released.notify_all();
+    }
+}
+
+template <typename RecordType>
+bool NetworkManager<RecordType>::start_write(int recipient_id, std::shared_ptr<Connection> connection,
+                                             std::shared_ptr<util::FramedSendBuffer> send_buffer,
+                                             std::function<void(bool)> send_callback,
+                                             bool droppable,
+                                             SendLane lane) {
+    send_buffer->finish();
+    const BudgetDecision decision = reserve_send_budget(recipient_id, send_buffer->size(), droppable);
+    if(decision == BudgetDecision::DROP) {
+        logger->trace("Dropping a dummy message to client {}, its send queue is over budget", recipient_id);
+        return true;
+    }
+    if(decision == BudgetDecision::REJECT) {
+        // If this recipient is the one holding up the queue, reset its connection to free everything
+        // queued for it; the next send will reconnect. Otherwise only the total budget was exceeded.
+        const bool reset_connection = get_bytes_queued(recipient_id) > 0;
+        if(reset_connection) {
+            remove_connection(recipient_id, connection);
+        }
+        asio::post(connection->transport->get_executor(), [this, recipient_id, connection, send_callback, reset_connection]() {
+            if(reset_connection) {
+                discard_queued_frames(recipient_id, connection);
+                connection->transport->close();
+            }
+            if(send_callback) {
+                send_callback(false);
+            }
+        });
+        return false;
+    }
+    asio::post(connection->transport->get_executor(), [this, recipient_id, connection, send_buffer, send_callback, lane]() {
+        if(connection->state == ConnectionState::FAILED || connection->closing) {
+            logger->debug("Dropping a message of size {} to client {}, the connection is closed", send_buffer->size(), recipient_id);
+            release_send_budget(recipient_id, send_buffer->size());
+            if(send_callback) {
+                send_callback(false);
+            }
+            return;
+        }
+        auto& queue = lane == SendLane::CONTROL ? connection->control_queue : connection->bulk_queue;
+        queue.push_back({send_buffer, send_callback});
+        flush_send_queue(recipient_id, connection);
+    });
+    return true;
+}
+
+template <typename RecordType>
+template <typename FrameContainer>
+void NetworkManager<RecordType>::complete_frames(int recipient_id, FrameContainer& frames, bool success) {
+    std::size_t bytes_completed = 0;
+    for(auto& frame : frames) {
+        bytes_completed += frame.buffer->size();
+        if(frame.send_callback) {
+            frame.send_callback(success);
+        }
+    }
+    frames.clear();
+    if(bytes_completed > 0) {
+        release_send_budget(recipient_id, bytes_completed);
+    }
+}
+
+template <typename RecordType>
+void NetworkManager<RecordType>::discard_queued_frames(int recipient_id, const std::shared_ptr<Connection>& connection) {
+    complete_frames(recipient_id, connection->control_queue, false);
+    complete_frames(recipient_id, connection->bulk_queue, false);
+}
+
+template <typename RecordType>
+void NetworkManager<RecordType>::flush_send_queue(int recipient_id, const std::shared_ptr<Connection>& connection) {
+    if(connection->state != ConnectionState::CONNECTED || !connection->frames_in_flight.empty()
+       || !connection->has_queued_frames()) {
+        return;
+    }
+    // Combine the queued frames into one buffer sequence, so they all go out in a single gathered write
+    connection->write_buffers.clear();
+    auto take_front_frame = [&connection](std::deque<OutgoingFrame>& queue) {
+        const auto& frame_buffers = queue.front().buffer->buffers();
+        connection->write_buffers.insert(connection->write_buffers.end(), frame_buffers.begin(), frame_buffers.end());
+        connection->frames_in_flight.emplace_back(std::move(queue.front()));
+        queue.pop_front();
+    };
+    while(!connection->control_queue.empty()) {
+        take_front_frame(connection->control_queue);
+    }
+    std::size_t bulk_bytes = 0;
+    while(!connection->bulk_queue.empty()
+          && (bulk_bytes == 0 || bulk_bytes + connection->bulk_queue.front().buffer->size() <= MAX_BULK_WRITE_SIZE)) {
+        bulk_bytes += connection->bulk_queue.front().buffer->size();
+        take_front_frame(connection->bulk_queue);
+    }
+    logger->trace("Writing {} queued frames to client {}", connection->frames_in_flight.size(), recipient_id);
+    // The frames stay alive in frames_in_flight, and the handler keeps the connection alive, until the write finishes
+    connection->transport->async_write(connection->write_buffers,
+                                       [this, recipient_id, connection](const asio::error_code& error, std::size_t bytes_sent) {
+                                           handle_write_complete(recipient_id, connection, error, bytes_sent);
+                                       });
 }
 
 template <typename RecordType>
 bool NetworkManager<RecordType>::send(const std::list<std::shared_ptr<messaging::OverlayTransportMessage<RecordType>>>& messages, const int recipient_id) {
-    // Construct a new socket for this node if there is not one already in the map
-    initialize_socket(recipient_id);
-    std::size_t send_size = mutils::bytes_size(messages.size());
-    for(const auto& message : messages) {
-        send_size += mutils::bytes_size(*message);
+    // A batch containing only an empty round marker doesn't need a TCP connection
+    if(use_udp_control && messages.size() == 1 && messages.front()->get_body()->enclosed_body == nullptr) {
+        if(auto datagram = serialize_datagram(*messages.front())) {
+            send_datagram(recipient_id, datagram);
+            /* If the marker is lost, the recipient will wait for its round to time out, and it keeps
+             * waiting as long as this client answers its pings. Sending a second copy a little later
+             * makes that unlikely; a duplicate is harmless, since it is dropped as being for an old round. */
+            auto retransmit_timer = std::make_shared<asio::steady_timer>(control_socket.get_executor(), udp_retry_interval);
+            retransmit_timer->async_wait([this, recipient_id, datagram, retransmit_timer](const asio::error_code& error) {
+                if(!error) {
+                    send_datagram(recipient_id, datagram);
+                }
+            });
+            return true;
+        }
     }
-    // Serialize the messages into a buffer that is stored on the heap, so it will remain in scope during the asynchronous write
-    std::shared_ptr<std::vector<uint8_t>> send_buffer = std::make_shared<std::vector<uint8_t>>(sizeof(send_size) + send_size);
-    std::memcpy(send_buffer->data(), &send_size, sizeof(send_size));
-    std::size_t bytes_written = sizeof(send_size);
-    bytes_written += mutils::to_bytes(messages.size(), send_buffer->data() + bytes_written);
+    // Connect to this node if there is not a connection to it already in the map
+    std::shared_ptr<Connection> connection = get_connection(recipient_id);
+    if(check_connection_failed(recipient_id, connection)) {
+        return false;
+    }
+    // Gather the messages into a sequence of buffers that references their encrypted payloads in place.
+    // The send buffer holds on to the messages so the payloads stay valid during the asynchronous write.
+    auto send_buffer = util::FramedSendBuffer::create();
+    mutils::to_bytes(messages.size(), send_buffer->append(mutils::bytes_size(messages.size())));
+    bool only_round_markers = true;
     for(const auto& message : messages) {
-        bytes_written += mutils::to_bytes(*message, send_buffer->data() + bytes_written);
-    }
-    // Capture a copy of the send_buffer's shared_ptr so it stays alive until the write finishes
-    asio::async_write(sockets_by_id.at(recipient_id),
-                      asio::buffer(*send_buffer),
-                      [this, recipient_id, send_buffer](const asio::error_code& error, std::size_t bytes_sent) {
-                          handle_write_complete(recipient_id, error, bytes_sent);
-                      });
-    // Right now, this method assumes it's synchronous and has no way of getting a notification when the write completes,
-    // so just return true even though there might be an error reported to the write handler
-    return true;
+        message->gather_bytes(*send_buffer);
+        send_buffer->retain(message);
+        only_round_markers = only_round_markers && message->get_body()->enclosed_body == nullptr;
+    }
+    // There is no way of getting a notification when the write completes, so this returns true
+    // even though there might be an error reported to the write handler
+    return start_write(recipient_id, connection, send_buffer, nullptr, only_round_markers, SendLane::BULK);
 }
 
 template <typename RecordType>
 bool NetworkManager<RecordType>::send(const std::shared_ptr<messaging::AggregationMessage<RecordType>>& message, const int recipient_id) {
-    initialize_socket(recipient_id);
+    std::shared_ptr<Connection> connection = get_connection(recipient_id);
+    if(check_connection_failed(recipient_id, connection)) {
+        return false;
+    }
     const std::size_t num_messages = 1;
     std::size_t send_size = mutils::bytes_size(*message);
     // The utility doesn't need a "number of messages" header because it only accepts one message
     if(recipient_id != UTILITY_NODE_ID) {
         send_size += mutils::bytes_size(num_messages);
     }
-    std::shared_ptr<std::vector<uint8_t>> send_buffer = std::make_shared<std::vector<uint8_t>>(sizeof(send_size) + send_size);
-    std::memcpy(send_buffer->data(), &send_size, sizeof(send_size));
-    std::size_t bytes_written = sizeof(send_size);
+    auto send_buffer = util::FramedSendBuffer::create(send_size);
+    uint8_t* message_bytes = send_buffer->append(send_size);
+    std::size_t bytes_written = 0;
     if(recipient_id != UTILITY_NODE_ID) {
-        bytes_written += mutils::to_bytes(num_messages, send_buffer->data() + bytes_written);
-    }
-    bytes_written += mutils::to_bytes(*message, send_buffer->data() + bytes_written);
-    // Capture a copy of the send_buffer's shared_ptr so it stays alive until the write finishes
-    asio::async_write(sockets_by_id.at(recipient_id),
-                      asio::buffer(*send_buffer),
-                      [this, recipient_id, send_buffer](const asio::error_code& error, std::size_t bytes_sent) {
-                          handle_write_complete(recipient_id, error, bytes_sent);
-                      });
-    return true;
+        bytes_written += mutils::to_bytes(num_messages, message_bytes + bytes_written);
+    }
+    bytes_written += mutils::to_bytes(*message, message_bytes + bytes_written);
+    return start_write(recipient_id, connection, send_buffer);
 }
 
 template <typename RecordType>
-void NetworkManager<RecordType>::handle_write_complete(int recipient_id, const asio::error_code& error, std::size_t bytes_sent) {
+void NetworkManager<RecordType>::handle_write_complete(int recipient_id, const std::shared_ptr<Connection>& connection,
+                                                       const asio::error_code& error, std::size_t bytes_sent) {
+    if(!error) {
+        get_peer(recipient_id).frames_sent += connection->frames_in_flight.size();
+    }
+    complete_frames(recipient_id, connection->frames_in_flight, !error);
     if(error) {
         logger->error("Write failed to complete for client {}, after sending {} bytes. Error message: {}", recipient_id, bytes_sent, error.message());
-        sockets_by_id.erase(recipient_id);
-    } else {
-        logger->trace("Finished a write of size {} to client {}", bytes_sent, recipient_id);
+        // Anything still queued would be sent after a partial frame, so it can't be sent on this connection
+        discard_queued_frames(recipient_id, connection);
+        remove_connection(recipient_id, connection);
+        return;
+    }
+    logger->trace("Finished a write of size {} to client {}", bytes_sent, recipient_id);
+    if(connection->has_queued_frames()) {
+        flush_send_queue(recipient_id, connection);
+    } else if(connection->closing) {
+        // The connection was evicted while this write was in progress, and now it has nothing left to send
+        connection->transport->close();
     }
 }
 
 template <typename RecordType>
-bool NetworkManager<RecordType>::send(const std::shared_ptr<messaging::PingMessage<RecordType>>& message, const int recipient_id) {
-    initialize_socket(recipient_id);
+void NetworkManager<RecordType>::send(const std::shared_ptr<messaging::PingMessage<RecordType>>& message, const int recipient_id,
+                                      std::function<void(bool)> completion_handler, std::chrono::milliseconds deadline) {
+    if(use_udp_control) {
+        if(auto datagram = serialize_datagram(*message)) {
+            if(!completion_handler) {
+                send_datagram(recipient_id, std::move(datagram));
+            } else {
+                asio::post(control_socket.get_executor(), [=]() {
+                    start_udp_ping(recipient_id, datagram, completion_handler, deadline);
+                });
+            }
+            return;
+        }
+    }
+    std::shared_ptr<Connection> connection = get_connection(recipient_id);
+    if(check_connection_failed(recipient_id, connection)) {
+        logger->debug("Failed to send ping to client {}: connection failed", recipient_id);
+        if(completion_handler) {
+            asio::post(delivery_strand, [completion_handler]() { completion_handler(false); });
+        }
+        return;
+    }
     // Serialize the ping message
     const std::size_t num_messages = 1;
     std::size_t send_size = mutils::bytes_size(num_messages) + mutils::bytes_size(*message);
-    std::size_t buffer_size = send_size = sizeof(send_size);
-    uint8_t buffer[buffer_size];
-    std::memcpy(buffer, &send_size, sizeof(send_size));
-    std::size_t bytes_written = sizeof(send_size);
-    bytes_written += mutils::to_bytes(num_messages, buffer + bytes_written);
-    bytes_written += mutils::to_bytes(*message, buffer + bytes_written);
-    // Pings are used to detect failures, so I'll use a synchronous write for now so that I can detect the errors
-    asio::error_code error;
-    asio::write(sockets_by_id.at(recipient_id), asio::buffer(&buffer, buffer_size), error);
-    if(error) {
-        logger->debug("Failed to send ping to client {}: {}", recipient_id, error.message());
-        sockets_by_id.erase(recipient_id);
-        return false;
-    } else {
-        return true;
+    auto send_buffer = util::FramedSendBuffer::create(send_size);
+    uint8_t* message_bytes = send_buffer->append(send_size);
+    std::size_t bytes_written = mutils::to_bytes(num_messages, message_bytes);
+    bytes_written += mutils::to_bytes(*message, message_bytes + bytes_written);
+    if(!completion_handler) {
+        if(!start_write(recipient_id, connection, send_buffer)) {
+            logger->warn("Failed to send ping to client {}: its send queue is over budget", recipient_id);
+        }
+        return;
     }
+    // The deadline timer and the send callback both run on the connection's strand,
+    // so whichever one happens first can safely mark the ping as reported
+    auto deadline_timer = std::make_shared<asio::steady_timer>(connection->transport->get_executor(), deadline);
+    auto reported = std::make_shared<bool>(false);
+    auto report_result = [this, deadline_timer, reported, completion_handler](bool success) {
+        if(*reported) {
+            return;
+        }
+        *reported = true;
+        deadline_timer->cancel();
+        asio::post(delivery_strand, [completion_handler, success]() { completion_handler(success); });
+    };
+    deadline_timer->async_wait([this, recipient_id, report_result](const asio::error_code& error) {
+        if(!error) {
+            logger->debug("Ping to client {} was not sent before the deadline", recipient_id);
+            report_result(false);
+        }
+    });
+    start_write(recipient_id, connection, send_buffer, report_result);
+}
+
+template <typename RecordType>
+void NetworkManager<RecordType>::send(const std::shared_ptr<messaging::PingMessage<RecordType>>& message, const int recipient_id) {
+    send(message, recipient_id, nullptr, std::chrono::milliseconds::zero());
 }
 template <typename RecordType>
 bool NetworkManager<RecordType>::send(const std::shared_ptr<messaging::SignatureRequest<RecordType>>& message) {
-    initialize_socket(UTILITY_NODE_ID);
+    std::shared_ptr<Connection> connection = get_connection(UTILITY_NODE_ID);
+    if(check_connection_failed(UTILITY_NODE_ID, connection)) {
+        return false;
+    }
     std::size_t send_size = mutils::bytes_size(*message);
-    // Serialize the message into a buffer that is stored on the heap, so it will remain in scope during the asynchronous write
-    std::shared_ptr<std::vector<uint8_t>> send_buffer = std::make_shared<std::vector<uint8_t>>(sizeof(send_size) + send_size);
-    std::memcpy(send_buffer->data(), &send_size, sizeof(send_size));
-    std::size_t bytes_written = sizeof(send_size);
     // No "number of messages" header for the utility
-    bytes_written += mutils::to_bytes(*message, send_buffer->data() + bytes_written);
-    // Capture a copy of the send_buffer's shared_ptr so it stays alive until the write finishes
-    asio::async_write(sockets_by_id.at(UTILITY_NODE_ID),
-                      asio::buffer(*send_buffer),
-                      [this, send_buffer](const asio::error_code& error, std::size_t bytes_sent) {
-                          handle_write_complete(UTILITY_NODE_ID, error, bytes_sent);
-                      });
-    return true;
+    auto send_buffer = util::FramedSendBuffer::create(send_size);
+    mutils::to_bytes(*message, send_buffer->append(send_size));
+    return start_write(UTILITY_NODE_ID, connection, send_buffer);
 }
 template <typename RecordType>
 void NetworkManager<RecordType>::send(const std::shared_ptr<messaging::QueryRequest<RecordType>>& message, const int recipient_id) {
-    initialize_socket(recipient_id);
+    std::shared_ptr<Connection> connection = get_connection(recipient_id);
+    if(check_connection_failed(recipient_id, connection)) {
+        logger->warn("Could not send a message to client {}, it is unreachable", recipient_id);
+        return;
+    }
     const std::size_t num_messages = 1;
     std::size_t send_size = mutils::bytes_size(num_messages) + mutils::bytes_size(*message);
-    std::shared_ptr<std::vector<uint8_t>> send_buffer = std::make_shared<std::vector<uint8_t>>(sizeof(send_size) + send_size);
-    std::memcpy(send_buffer->data(), &send_size, sizeof(send_size));
-    std::size_t bytes_written = sizeof(send_size);
+    auto send_buffer = util::FramedSendBuffer::create(send_size);
+    uint8_t* message_bytes = send_buffer->append(send_size);
     // Send the number of messages (one), then the message itself
-    bytes_written += mutils::to_bytes(num_messages, send_buffer->data() + bytes_written);
-    bytes_written += mutils::to_bytes(*message, send_buffer->data() + bytes_written);
-    asio::async_write(sockets_by_id.at(recipient_id),
-                      asio::buffer(*send_buffer),
-                      [this, recipient_id, send_buffer](const asio::error_code& error, std::size_t bytes_sent) {
-                          handle_write_complete(recipient_id, error, bytes_sent);
-                      });
+    std::size_t bytes_written = mutils::to_bytes(num_messages, message_bytes);
+    bytes_written += mutils::to_bytes(*message, message_bytes + bytes_written);
+    if(!start_write(recipient_id, connection, send_buffer)) {
+        logger->warn("Could not send a QueryRequest to client {}, its send queue is over budget", recipient_id);
+    }
 }
 template <typename RecordType>
 void NetworkManager<RecordType>::send(const std::shared_ptr<messaging::SignatureResponse<RecordType>>& message, const int recipient_id) {
     // Exactly the same method as send(QueryRequest), just with a different argument type
-    initialize_socket(recipient_id);
+    std::shared_ptr<Connection> connection = get_connection(recipient_id);
+    if(check_connection_failed(recipient_id, connection)) {
+        logger->warn("Could not send a message to client {}, it is unreachable", recipient_id);
+        return;
+    }
     const std::size_t num_messages = 1;
     std::size_t send_size = mutils::bytes_size(num_messages) + mutils::bytes_size(*message);
-    std::shared_ptr<std::vector<uint8_t>> send_buffer = std::make_shared<std::vector<uint8_t>>(sizeof(send_size) + send_size);
-    std::memcpy(send_buffer->data(), &send_size, sizeof(send_size));
-    std::size_t bytes_written = sizeof(send_size);
-    bytes_written += mutils::to_bytes(num_messages, send_buffer->data() + bytes_written);
-    bytes_written += mutils::to_bytes(*message, send_buffer->data() + bytes_written);
-    asio::async_write(sockets_by_id.at(recipient_id),
-                      asio::buffer(*send_buffer),
-                      [this, recipient_id, send_buffer](const asio::error_code& error, std::size_t bytes_sent) {
-                          handle_write_complete(recipient_id, error, bytes_sent);
-                      });
+    auto send_buffer = util::FramedSendBuffer::create(send_size);
+    uint8_t* message_bytes = send_buffer->append(send_size);
+    std::size_t bytes_written = mutils::to_bytes(num_messages, message_bytes);
+    bytes_written += mutils::to_bytes(*message, message_bytes + bytes_written);
+    if(!start_write(recipient_id, connection, send_buffer)) {
+        logger->warn("Could not send a SignatureResponse to client {}, its send queue is over budget", recipient_id);
+    }
+}
+
+template <typename RecordType>
+template <typename MessageType>
+void NetworkManager<RecordType>::multicast(const std::shared_ptr<MessageType>& message, const std::vector<int>& recipient_ids) {
+    const std::size_t num_messages = 1;
+    const std::size_t payload_size = mutils::bytes_size(num_messages) + mutils::bytes_size(*message);
+    std::shared_ptr<const util::BufferPool::Buffer> payload;
+    {
+        auto payload_bytes = util::BufferPool::getInstance().acquire(payload_size);
+        std::size_t bytes_written = mutils::to_bytes(num_messages, payload_bytes->data());
+        mutils::to_bytes(*message, payload_bytes->data() + bytes_written);
+        payload = std::move(payload_bytes);
+    }
+    for(const int recipient_id : recipient_ids) {
+        std::shared_ptr<Connection> connection = get_connection(recipient_id);
+        if(check_connection_failed(recipient_id, connection)) {
+            logger->warn("Could not send a message to client {}, it is unreachable", recipient_id);
+            continue;
+        }
+        // Only the length header is written separately for each recipient; the payload is shared
+        auto send_buffer = util::FramedSendBuffer::create();
+        send_buffer->append_reference(payload->data(), payload_size);
+        send_buffer->retain(payload);
+        start_write(recipient_id, connection, send_buffer);
+    }
+}
+
+template <typename RecordType>
+template <typename MessageType>
+std::shared_ptr<const std::vector<uint8_t>> NetworkManager<RecordType>::serialize_datagram(const MessageType& message) {
+    const std::size_t num_messages = 1;
+    const std::size_t datagram_size = mutils::bytes_size(num_messages) + mutils::bytes_size(message);
+    if(datagram_size > MAX_DATAGRAM_SIZE) {
+        return nullptr;
+    }
+    auto datagram = std::make_shared<std::vector<uint8_t>>(datagram_size);
+    std::size_t bytes_written = mutils::to_bytes(num_messages, datagram->data());
+    mutils::to_bytes(message, datagram->data() + bytes_written);
+    return datagram;
+}
+
+template <typename RecordType>
+void NetworkManager<RecordType>::send_datagram(int recipient_id, std::shared_ptr<const std::vector<uint8_t>> datagram) {
+    const Peer& peer = get_peer(recipient_id);
+    if(!peer.has_address) {
+        throw std::out_of_range("No address for client " + std::to_string(recipient_id) + " in the client list");
+    }
+    asio::post(control_socket.get_executor(), [this, recipient_id, destination = peer.control_endpoint, datagram = std::move(datagram)]() {
+        auto enqueue = [this, destination, datagram]() {
+            datagram_queue.push_back({destination, datagram});
+            // Flush in a separate handler, so datagrams queued by the handlers that are already waiting join this batch
+            if(!datagram_flush_scheduled) {
+                datagram_flush_scheduled = true;
+                asio::post(control_socket.get_executor(), [this]() { flush_datagrams(); });
+            }
+        };
+        auto profile = fault_profiles.find(recipient_id);
+        if(profile == fault_profiles.end()) {
+            enqueue();
+            return;
+        }
+        if(std::uniform_real_distribution<double>(0, 1)(datagram_fault_engine) < profile->second.drop_probability) {
+            return;
+        }
+        // Unlike a stream, datagrams can arrive out of order, so each one is delayed independently
+        auto delay_timer = std::make_shared<asio::steady_timer>(control_socket.get_executor(),
+                                                                profile->second.sample_delay(datagram_fault_engine));
+        delay_timer->async_wait([delay_timer, enqueue](const asio::error_code& error) {
+            if(!error) {
+                enqueue();
+            }
+        });
+    });
+}
+
+template <typename RecordType>
+void NetworkManager<RecordType>::flush_datagrams() {
+    std::size_t num_sent = 0;
+    bool would_block = false;
+#ifdef __linux__
+    // Send up to DATAGRAM_BATCH_SIZE datagrams with each sendmmsg call
+    std::array<mmsghdr, DATAGRAM_BATCH_SIZE> headers;
+    std::array<iovec, DATAGRAM_BATCH_SIZE> iovecs;
+    while(num_sent < datagram_queue.size() && !would_block) {
+        const std::size_t batch_size = std::min(DATAGRAM_BATCH_SIZE, datagram_queue.size() - num_sent);
+        for(std::size_t i = 0; i < batch_size; ++i) {
+            OutgoingDatagram& datagram = datagram_queue[num_sent + i];
+            iovecs[i].iov_base = const_cast<uint8_t*>(datagram.bytes->data());
+            iovecs[i].iov_len = datagram.bytes->size();
+            std::memset(&headers[i], 0, sizeof(headers[i]));
+            headers[i].msg_hdr.msg_name = datagram.destination.data();
+            headers[i].msg_hdr.msg_namelen = datagram.destination.size();
+            headers[i].msg_hdr.msg_iov = &iovecs[i];
+            headers[i].msg_hdr.msg_iovlen = 1;
+        }
+        int result = ::sendmmsg(control_socket.native_handle(), headers.data(), batch_size, MSG_DONTWAIT);
+        if(result >= 0) {
+            num_sent += result;
+        } else if(errno == EAGAIN || errno == EWOULDBLOCK) {
+            would_block = true;
+        } else if(errno != EINTR) {
+            // The first datagram in the batch couldn't be sent (e.g. its destination is unreachable); skip it
+            logger->debug("Failed to send a control datagram: {}", std::strerror(errno));
+            ++num_sent;
+        }
+    }
+#else
+    while(num_sent < datagram_queue.size() && !would_block) {
+        const OutgoingDatagram& datagram = datagram_queue[num_sent];
+        asio::error_code error;
+        control_socket.send_to(asio::buffer(*datagram.bytes), datagram.destination, 0, error);
+        if(error == asio::error::would_block) {
+            would_block = true;
+        } else {
+            if(error) {
+                logger->debug("Failed to send a control datagram: {}", error.message());
+            }
+            ++num_sent;
+        }
+    }
+#endif
+    datagram_queue.erase(datagram_queue.begin(), datagram_queue.begin() + num_sent);
+    if(would_block) {
+        // Try again once the socket's send buffer has drained; datagram_flush_scheduled stays true until then
+        control_socket.async_wait(asio::ip::udp::socket::wait_write, [this](const asio::error_code& error) {
+            if(error != asio::error::operation_aborted) {
+                flush_datagrams();
+            }
+        });
+    } else {
+        datagram_flush_scheduled = false;
+    }
+}
+
+template <typename RecordType>
+void NetworkManager<RecordType>::start_datagram_receive() {
+    control_socket.async_wait(asio::ip::udp::socket::wait_read, [this](const asio::error_code& error) {
+        if(error == asio::error::operation_aborted) {
+            return;
+        }
+        if(error) {
+            logger->error("Error waiting for control datagrams: {}", error.message());
+        } else {
+            receive_datagrams();
+        }
+        start_datagram_receive();
+    });
+}
+
+template <typename RecordType>
+void NetworkManager<RecordType>::receive_datagrams() {
+    bool more_available = true;
+    while(more_available) {
+        // Overlay messages from the last batch may still be using the storage
+        if(datagram_receive_storage.use_count() > 1) {
+            datagram_receive_storage = util::BufferPool::getInstance().acquire(DATAGRAM_BATCH_SIZE * MAX_DATAGRAM_SIZE);
+        }
+        uint8_t* storage = datagram_receive_storage->data();
+        std::size_t num_received = 0;
+        std::array<std::size_t, DATAGRAM_BATCH_SIZE> datagram_sizes;
+        std::array<asio::ip::udp::endpoint, DATAGRAM_BATCH_SIZE> datagram_sources;
+#ifdef __linux__
+        std::array<mmsghdr, DATAGRAM_BATCH_SIZE> headers;
+        std::array<iovec, DATAGRAM_BATCH_SIZE> iovecs;
+        for(std::size_t i = 0; i < DATAGRAM_BATCH_SIZE; ++i) {
+            iovecs[i].iov_base = storage + i * MAX_DATAGRAM_SIZE;
+            iovecs[i].iov_len = MAX_DATAGRAM_SIZE;
+            std::memset(&headers[i], 0, sizeof(headers[i]));
+            headers[i].msg_hdr.msg_iov = &iovecs[i];
+            headers[i].msg_hdr.msg_iovlen = 1;
+            headers[i].msg_hdr.msg_name = datagram_sources[i].data();
+            headers[i].msg_hdr.msg_namelen = datagram_sources[i].capacity();
+        }
+        int result = ::recvmmsg(control_socket.native_handle(), headers.data(), DATAGRAM_BATCH_SIZE, MSG_DONTWAIT, nullptr);
+        if(result < 0) {
+            if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                logger->error("Failed to receive control datagrams: {}", std::strerror(errno));
+            }
+            return;
+        }
+        for(int i = 0; i < result; ++i) {
+            // A truncated datagram wasn't sent by a NetworkManager, so it can't be parsed
+            datagram_sizes[num_received] = (headers[i].msg_hdr.msg_flags & MSG_TRUNC) ? 0 : headers[i].msg_len;
+            datagram_sources[num_received++].resize(headers[i].msg_hdr.msg_namelen);
+        }
+#else
+        while(num_received < DATAGRAM_BATCH_SIZE) {
+            asio::error_code error;
+            std::size_t size = control_socket.receive_from(
+                    asio::buffer(storage + num_received * MAX_DATAGRAM_SIZE, MAX_DATAGRAM_SIZE),
+                    datagram_sources[num_received], 0, error);
+            if(error) {
+                break;
+            }
+            datagram_sizes[num_received++] = size;
+        }
+#endif
+        more_available = (num_received == DATAGRAM_BATCH_SIZE);
+        for(std::size_t i = 0; i < num_received; ++i) {
+            if(datagram_sizes[i] < sizeof(std::size_t)) {
+                logger->warn("NetworkManager dropped a malformed control datagram of size {}", datagram_sizes[i]);
+                continue;
+            }
+            const uint8_t* datagram = storage + i * MAX_DATAGRAM_SIZE;
+            if(!answer_ping_request(datagram, datagram_sizes[i], datagram_sources[i])) {
+                receive_message(std::shared_ptr<const uint8_t>(datagram_receive_storage, datagram), datagram_sizes[i],
+                                &datagram_sources[i]);
+            }
+        }
+    }
+}
+
+template <typename RecordType>
+bool NetworkManager<RecordType>::answer_ping_request(const uint8_t* datagram, std::size_t datagram_size,
+                                                     const asio::ip::udp::endpoint& source) {
+    using messaging::PingMessage;
+    std::size_t num_messages;
+    std::memcpy(&num_messages, datagram, sizeof(num_messages));
+    messaging::MessageType message_type;
+    // Anything too short to be a whole ping is left for receive_message to reject
+    if(num_messages != 1 || datagram_size < sizeof(num_messages) + mutils::bytes_size(PingMessage<RecordType>(local_id))) {
+        return false;
+    }
+    std::memcpy(&message_type, datagram + sizeof(num_messages), sizeof(message_type));
+    if(message_type != PingMessage<RecordType>::type) {
+        return false;
+    }
+    auto request = mutils::from_bytes<PingMessage<RecordType>>(nullptr, datagram + sizeof(num_messages));
+    if(request->is_response) {
+        return false;
+    }
+    // The reply goes to the claimed sender, so a forged ID would make this client send to an arbitrary peer
+    if(!is_datagram_from(request->sender_id, source)) {
+        logger->warn("Ignoring a ping from {} claiming to be from client {}", source.address().to_string(), request->sender_id);
+        return true;
+    }
+    logger->trace("Replying to a ping from client {}", request->sender_id);
+    send_datagram(request->sender_id, serialize_datagram(PingMessage<RecordType>(local_id, true)));
+    return true;
+}
+
+template <typename RecordType>
+bool NetworkManager<RecordType>::is_datagram_from(int sender_id, const asio::ip::udp::endpoint& source) {
+    if(sender_id < UTILITY_NODE_ID || sender_id + 1 >= static_cast<int>(peers.size())) {
+        return false;
+    }
+    const Peer& peer = get_peer(sender_id);
+    asio::ip::address source_address = source.address();
+    if(source_address.is_v6() && source_address.to_v6().is_v4_mapped()) {
+        source_address = asio::ip::make_address_v4(asio::ip::v4_mapped, source_address.to_v6());
+    }
+    return peer.has_address && peer.control_endpoint.address() == source_address
+           && peer.control_endpoint.port() == source.port();
+}
+
+template <typename RecordType>
+void NetworkManager<RecordType>::start_udp_ping(int recipient_id, std::shared_ptr<const std::vector<uint8_t>> datagram,
+                                                std::function<void(bool)> completion_handler, std::chrono::milliseconds deadline) {
+    auto ping = std::make_shared<PendingPing>(recipient_id, datagram, std::chrono::steady_clock::now() + deadline,
+                                              asio::steady_timer(control_socket.get_executor()),
+                                              std::move(completion_handler));
+    pending_pings[recipient_id].push_back(ping);
+    send_datagram(recipient_id, std::move(datagram));
+    schedule_ping_retry(std::move(ping));
+}
+
+template <typename RecordType>
+void NetworkManager<RecordType>::schedule_ping_retry(std::shared_ptr<PendingPing> ping) {
+    const auto now = std::chrono::steady_clock::now();
+    if(now >= ping->deadline) {
+        logger->debug("Ping to client {} was not answered before the deadline", ping->recipient_id);
+        complete_udp_ping(ping, false);
+        return;
+    }
+    ping->retry_timer.expires_at(std::min(ping->deadline, now + udp_retry_interval));
+    ping->retry_timer.async_wait([this, ping](const asio::error_code& error) {
+        // The timer is cancelled when the ping is completed, but it may have already expired
+        if(error == asio::error::operation_aborted || ping->completed) {
+            return;
+        }
+        if(std::chrono::steady_clock::now() < ping->deadline) {
+            send_datagram(ping->recipient_id, ping->bytes);
+        }
+        schedule_ping_retry(ping);
+    });
+}
+
+template <typename RecordType>
+void NetworkManager<RecordType>::complete_udp_ping(const std::shared_ptr<PendingPing>& ping, bool success) {
+    if(ping->completed) {
+        return;
+    }
+    ping->completed = true;
+    auto peer_pings = pending_pings.find(ping->recipient_id);
+    if(peer_pings != pending_pings.end()) {
+        peer_pings->second.remove(ping);
+        if(peer_pings->second.empty()) {
+            pending_pings.erase(peer_pings);
+        }
+    }
+    ping->retry_timer.cancel();
+    asio::post(delivery_strand, [completion_handler = std::move(ping->completion_handler), success]() {
+        completion_handler(success);
+    });
+}
+
+template <typename RecordType>
+void NetworkManager<RecordType>::handle_ping_response(int sender_id) {
+    asio::post(control_socket.get_executor(), [this, sender_id]() {
+        auto peer_pings = pending_pings.find(sender_id);
+        if(peer_pings == pending_pings.end()) {
+            return;
+        }
+        // Any response shows the peer is alive, so it answers every ping that is waiting on it
+        auto answered_pings = std::move(peer_pings->second);
+        pending_pings.erase(peer_pings);
+        for(const auto& ping : answered_pings) {
+            complete_udp_ping(ping, true);
+        }
+    });
+}
+
+template <typename RecordType>
+void NetworkManager<RecordType>::open_connections(const std::set<int>& peer_ids) {
+    std::size_t num_opened = 0;
+    for(const int peer_id : peer_ids) {
+        if(peer_id == local_id) {
+            continue;
+        }
+        // Opening more than the cache can hold would just evict the first ones again
+        if(num_opened == max_open_connections) {
+            logger->debug("Not opening connections to {} more peers, the limit is {} open connections",
+                          peer_ids.size() - num_opened, max_open_connections);
+            break;
+        }
+        try {
+            // A connection that failed earlier (e.g. before the peer was listening) is worth another try now
+            if(check_connection_failed(peer_id, get_connection(peer_id))) {
+                get_connection(peer_id);
+            }
+            ++num_opened;
+        } catch(std::out_of_range&) {
+            logger->warn("Can't open a connection to client {}, it is not in the client list", peer_id);
+        }
+    }
 }
 
 template <typename RecordType>
 void NetworkManager<RecordType>::run() {
+    // The calling thread is one of the I/O threads, so start one fewer than the configured number
+    std::vector<std::thread> extra_io_threads;
+    extra_io_threads.reserve(num_io_threads - 1);
+    for(unsigned int i = 1; i < num_io_threads; ++i) {
+        extra_io_threads.emplace_back([this]() { network_io_context.run(); });
+    }
     network_io_context.run();
+    for(auto& io_thread : extra_io_threads) {
+        io_thread.join();
+    }
 }
 
 template <typename RecordType>
@@ -327,4 +1349,21 @@ void NetworkManager<RecordType>::shutdown() {
     network_io_context.stop();
 }
 
+template <typename RecordType>
+void NetworkManager<RecordType>::post(std::function<void()> task) {
+    asio::post(delivery_strand, std::move(task));
+}
+
+template <typename RecordType>
+typename NetworkManager<RecordType>::SendQueueMetrics NetworkManager<RecordType>::get_send_queue_metrics() {
+    std::lock_guard<std::mutex> lock(send_budget_mutex);
+    return send_queue_metrics;
+}
+
+template <typename RecordType>
+std::size_t NetworkManager<RecordType>::get_bytes_queued(int peer_id) {
+    std::lock_guard<std::mutex> lock(send_budget_mutex);
+    return get_peer(peer_id).bytes_queued;
+}
+
 }  // namespace adq
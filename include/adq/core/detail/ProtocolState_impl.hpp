@@ -1,11 +1,13 @@
 #include "../ProtocolState.hpp"
 
+#include "adq/config/Configuration.hpp"
 #include "adq/core/CrusaderAgreementState.hpp"
 #include "adq/core/CryptoLibrary.hpp"
 #include "adq/core/NetworkManager.hpp"
 #include "adq/core/TreeAggregationState.hpp"
 #include "adq/messaging/ByteBody.hpp"
 #include "adq/messaging/MessageBody.hpp"
+#include "adq/messaging/OverlayTransportMessageView.hpp"
 #include "adq/messaging/PathOverlayMessage.hpp"
 #include "adq/messaging/PingMessage.hpp"
 #include "adq/messaging/QueryRequest.hpp"
@@ -14,11 +16,12 @@
 #include "adq/messaging/SignedValue.hpp"
 #include "adq/messaging/ValueContribution.hpp"
 #include "adq/messaging/ValueTuple.hpp"
-#include "adq/util/LinuxTimerManager.hpp"
 #include "adq/util/PathFinder.hpp"
 
 #include <spdlog/spdlog.h>
 
+#include <algorithm>
+#include <chrono>
 #include <memory>
 #include <vector>
 
@@ -26,31 +29,45 @@ namespace adq {
 
 template <typename RecordType>
 ProtocolState<RecordType>::ProtocolState(int num_clients, int local_client_id, NetworkManager<RecordType>& network_manager,
-                                         DataSource<RecordType>& data_source)
+                                         DataSource<RecordType>& data_source, util::TimerManager& timer_manager,
+                                         CryptoLibrary& crypto_library, FailureDetector& failure_detector,
+                                         util::WorkerPool& crypto_worker_pool)
     : logger(spdlog::get("global_logger")),
       protocol_phase(ProtocolPhase::IDLE),
       meter_id(local_client_id),
       num_meters(num_clients),
       log2n((int)std::ceil(std::log2(num_meters))),
       num_aggregation_groups(2 * FAILURES_TOLERATED + 1),
+      schedule(util::OverlaySchedule::for_num_nodes(num_clients)),
       overlay_round(-1),
       is_last_round(false),
+      query_declined(false),
       round_timeout_timer(-1),
+      round_timer_generation(0),
       ping_response_from_predecessor(false),
-      timers(std::make_unique<util::LinuxTimerManager>()),
+      future_round_horizon(Configuration::getInstance().hasKey(Configuration::SECTION_SETUP, Configuration::FUTURE_ROUND_HORIZON)
+                               ? std::max(1u, Configuration::getUInt32(Configuration::SECTION_SETUP, Configuration::FUTURE_ROUND_HORIZON))
+                               : DEFAULT_FUTURE_ROUND_HORIZON),
+      future_overlay_messages(future_round_horizon),
+      timers(timer_manager),
       network(network_manager),
       data_source(data_source),
-      crypto(Configuration::getString(Configuration::SECTION_SETUP, Configuration::PRIVATE_KEY_FILE),
-             make_client_key_paths(Configuration::getString(Configuration::SECTION_SETUP, Configuration::CLIENT_KEYS_FOLDER),
-                                   num_clients)),
+      crypto(crypto_library),
+      failure_detector(failure_detector),
+      crypto_workers(crypto_worker_pool),
       agreement_start_round(0) {}
 
+template <typename RecordType>
+ProtocolState<RecordType>::~ProtocolState() {
+    cancel_round_timer();
+}
+
 template <typename RecordType>
 void ProtocolState<RecordType>::start_query(std::shared_ptr<messaging::QueryRequest<RecordType>> query_request, const RecordType& contributed_data) {
     overlay_round = -1;
     is_last_round = false;
     ping_response_from_predecessor = false;
-    timers->cancel_timer(round_timeout_timer);
+    cancel_round_timer();
     proxy_values.clear();
     failed_meter_ids.clear();
     aggregation_phase_state = std::make_unique<TreeAggregationState<RecordType>>(meter_id, num_aggregation_groups, num_meters,
@@ -64,7 +81,31 @@ void ProtocolState<RecordType>::start_query(std::shared_ptr<messaging::QueryRequ
     agreement_phase_state = std::make_unique<CrusaderAgreementState<RecordType>>(meter_id, num_meters, query_request->query_number, crypto);
     // Blind my ValueTuple and send it to the utility to be signed
     auto blinded_contribution = crypto.rsa_blind(*my_contribution);
-    network.send(std::make_shared<messaging::SignatureRequest<RecordType>>(meter_id, blinded_contribution));
+    failure_detector.record_probe_sent(UTILITY_NODE_ID);
+    network.send(std::make_shared<messaging::SignatureRequest<RecordType>>(meter_id, query_request->query_number, blinded_contribution));
+}
+
+template <typename RecordType>
+std::set<int> ProtocolState<RecordType>::get_scheduled_peers() const {
+    // These are the same bounds end_overlay_round() uses for the Shuffle phase and both phases of Agreement
+    const int shuffle_rounds = 2 * FAILURES_TOLERATED + log2n * log2n + 1;
+    const int agreement_rounds = 4 * FAILURES_TOLERATED + 2 * log2n * log2n + 2;
+    std::set<int> peers;
+    for(int round = 0; round <= shuffle_rounds + agreement_rounds; ++round) {
+        const int target = schedule.gossip_target(meter_id, round);
+        if(target != meter_id) {
+            peers.insert(target);
+        }
+        // Every other meter is already a target, which happens long before the last round in small systems
+        if(static_cast<int>(peers.size()) >= num_meters - 1) {
+            break;
+        }
+    }
+    // The root of the aggregation tree has no parent, and sends its result to the utility instead
+    peers.insert(util::aggregation_tree_parent(meter_id, num_aggregation_groups, num_meters));
+    peers.insert(UTILITY_NODE_ID);
+    peers.erase(meter_id);
+    return peers;
 }
 
 template <typename RecordType>
@@ -81,24 +122,32 @@ void ProtocolState<RecordType>::handle_signature_response(messaging::SignatureRe
 }
 
 template <typename RecordType>
-void ProtocolState<RecordType>::handle_ping_message(const messaging::PingMessage<RecordType>& message) {
-    if(!message.is_response) {
-        // If this is a ping request, send a response back
-        auto reply = std::make_shared<messaging::PingMessage<RecordType>>(meter_id, true);
-        logger->trace("Meter {} replying to a ping from {}", meter_id, message.sender_id);
-        network.send(reply, message.sender_id);
-    } else if(message.sender_id == util::gossip_predecessor(meter_id, overlay_round, num_meters)) {
-        // If this is a ping response and we still care about it
-        //(the sender is our predecessor), take note
+void ProtocolState<RecordType>::record_liveness(int sender_id) {
+    if(sender_id < 0 || sender_id >= num_meters) {
+        return;
+    }
+    // If we still care about it (the sender is our predecessor), take note
+    if(sender_id == schedule.gossip_predecessor(meter_id, overlay_round)) {
         ping_response_from_predecessor = true;
     }
 }
 
+template <typename RecordType>
+bool ProtocolState<RecordType>::heard_from_recently(int other_meter_id) const {
+    return failure_detector.time_since_arrival(other_meter_id) < std::chrono::milliseconds(round_timeout(other_meter_id));
+}
+
+template <typename RecordType>
+int ProtocolState<RecordType>::round_timeout(int predecessor) const {
+    const int rtt_multiple = failure_detector.is_suspected(predecessor) ? SUSPECTED_ROUND_TIMEOUT_RTT_MULTIPLE : ROUND_TIMEOUT_RTT_MULTIPLE;
+    const int timeout = rtt_multiple * failure_detector.round_trip_percentile(predecessor, ROUND_TIMEOUT_PERCENTILE).count();
+    return std::min(MAX_ROUND_TIMEOUT, std::max(MIN_ROUND_TIMEOUT, timeout));
+}
+
 template <typename RecordType>
 void ProtocolState<RecordType>::handle_overlay_message(messaging::OverlayTransportMessage<RecordType>& message) {
     if(is_in_overlay_phase()) {
-        timers->cancel_timer(round_timeout_timer);
-        round_timeout_timer = timers->register_timer(OVERLAY_ROUND_TIMEOUT, [this]() { handle_round_timeout(); });
+        start_round_timer(schedule.gossip_predecessor(meter_id, overlay_round));
     }
     // The only valid MessageBody for an OverlayTransportMessage is an OverlayMessage
     auto overlay_message = std::static_pointer_cast<messaging::OverlayMessage<RecordType>>(message.body);
@@ -112,7 +161,7 @@ void ProtocolState<RecordType>::handle_overlay_message(messaging::OverlayTranspo
             // Pop remaining_path into destination and add to waiting_messages
             path_overlay_message->destination = path_overlay_message->remaining_path.front();
             path_overlay_message->remaining_path.pop_front();
-            waiting_messages.emplace_back(path_overlay_message);
+            waiting_messages[path_overlay_message->destination].emplace_back(path_overlay_message);
         }
     }
     // Dummy messages will have a null payload
@@ -124,7 +173,7 @@ void ProtocolState<RecordType>::handle_overlay_message(messaging::OverlayTranspo
          * have its destination already set to the next hop by the superclass handle_overlay_message.
          */
         if(auto enclosed_message = std::dynamic_pointer_cast<messaging::OverlayMessage<RecordType>>(overlay_message->enclosed_body)) {
-            waiting_messages.emplace_back(enclosed_message);
+            waiting_messages[enclosed_message->destination].emplace_back(enclosed_message);
         } else if(overlay_message->destination == meter_id) {
             if(protocol_phase == ProtocolPhase::SHUFFLE) {
                 handle_shuffle_phase_message(*overlay_message);
@@ -138,6 +187,19 @@ void ProtocolState<RecordType>::handle_overlay_message(messaging::OverlayTranspo
     }
 }
 
+template <typename RecordType>
+void ProtocolState<RecordType>::handle_overlay_message(const messaging::OverlayTransportMessageView<RecordType>& message) {
+    std::unique_ptr<messaging::OverlayTransportMessage<RecordType>> materialized_message;
+    if(message.is_encrypted() && message.has_enclosed_body()) {
+        // Skip deserializing the ciphertext into a ByteBody, since it would only be copied again to decrypt it
+        materialized_message = message.materialize_decrypted(
+                crypto.rsa_decrypt<RecordType>(message.enclosed_bytes(), message.enclosed_bytes_size()));
+    } else {
+        materialized_message = message.materialize();
+    }
+    handle_overlay_message(*materialized_message);
+}
+
 template <typename RecordType>
 void ProtocolState<RecordType>::handle_shuffle_phase_message(const messaging::OverlayMessage<RecordType>& message) {
     // Drop messages that are received in the wrong phase (i.e. not ValueContributions) or have the wrong round number
@@ -170,17 +232,17 @@ void ProtocolState<RecordType>::handle_aggregation_message(messaging::Aggregatio
 template <typename RecordType>
 void ProtocolState<RecordType>::start_aggregate_phase() {
     // Since we're now done with the overlay, stop the timeout waiting for the next round
-    timers->cancel_timer(round_timeout_timer);
+    cancel_round_timer();
     // Initialize aggregation helper
     aggregation_phase_state->initialize(failed_meter_ids);
     // If this node is a leaf, aggregation might be done already
     send_aggregate_if_done();
     // If not done already, check future messages for aggregation messages already received from children
     if(is_in_aggregate_phase()) {
-        for(auto message_iter = future_aggregation_messages.begin();
-            message_iter != future_aggregation_messages.end();) {
-            handle_aggregation_message(**message_iter);
-            message_iter = future_aggregation_messages.erase(message_iter);
+        std::vector<std::shared_ptr<messaging::AggregationMessage<RecordType>>> received_messages;
+        received_messages.swap(future_aggregation_messages);
+        for(const auto& message : received_messages) {
+            handle_aggregation_message(*message);
         }
     }
     // Set this because we're done with the overlay
@@ -201,14 +263,15 @@ void ProtocolState<RecordType>::encrypted_multicast_to_proxies(std::shared_ptr<m
     // Find independent paths starting at round 0
     auto proxy_paths = util::find_paths(meter_id, contribution->value_tuple.proxies, num_meters, 0);
     logger->trace("Client {} picked these proxy paths: {}", meter_id, proxy_paths);
-    for(const auto& proxy_path : proxy_paths) {
-        // Create an encrypted onion for this path and send it
-        outgoing_messages.emplace_back(
-            messaging::build_encrypted_onion(proxy_path,
-                                             std::static_pointer_cast<messaging::MessageBody<RecordType>>(contribution),  // unnecessary cast from derived to base
-                                             contribution->value_tuple.query_num,
-                                             crypto));
-    }
+    // Each layer of an onion depends on the one inside it, but onions for different paths are independent
+    std::vector<std::shared_ptr<messaging::OverlayMessage<RecordType>>> onions(proxy_paths.size());
+    crypto_workers.parallel_for(proxy_paths.size(), [&](std::size_t path_index) {
+        onions[path_index] = messaging::build_encrypted_onion(proxy_paths[path_index],
+                                                              std::static_pointer_cast<messaging::MessageBody<RecordType>>(contribution),  // unnecessary cast from derived to base
+                                                              contribution->value_tuple.query_num,
+                                                              crypto);
+    });
+    outgoing_messages.insert(outgoing_messages.end(), onions.begin(), onions.end());
     // Start the overlay by ending "round -1", which will send the messages at the start of round 0
     end_overlay_round();
 }
@@ -232,11 +295,14 @@ void ProtocolState<RecordType>::end_overlay_round() {
                              proxy_value->value_tuple.proxies.end(), other_proxies.begin(), meter_id);
             // Find paths that start at the next round - we send before receive, so we've already sent messages for the current round
             auto proxy_paths = util::find_paths(meter_id, other_proxies, num_meters, overlay_round + 1);
+            // Every proxy gets the same SignedValue, so serialize it once and only encrypt it separately for each one
+            std::vector<uint8_t> signed_value_bytes(mutils::bytes_size(*signed_value));
+            mutils::to_bytes(*signed_value, signed_value_bytes.data());
             for(const auto& proxy_path : proxy_paths) {
                 // Encrypt with the destination's public key, but don't make an onion
                 auto path_message = std::make_shared<messaging::PathOverlayMessage<RecordType>>(
                     get_current_query_num(), proxy_path, signed_value);
-                crypto.rsa_encrypt(*path_message, proxy_path.back());
+                crypto.rsa_encrypt(*path_message, signed_value_bytes.data(), signed_value_bytes.size(), proxy_path.back());
                 outgoing_messages.emplace_back(path_message);
             }
         }
@@ -270,7 +336,7 @@ void ProtocolState<RecordType>::end_overlay_round() {
 
 template <typename RecordType>
 void ProtocolState<RecordType>::common_end_overlay_round() {
-    timers->cancel_timer(round_timeout_timer);
+    cancel_round_timer();
     // If the last round is ending, the only thing we need to do is cancel the timeout
     if(is_last_round)
         return;
@@ -280,33 +346,22 @@ void ProtocolState<RecordType>::common_end_overlay_round() {
     // Send outgoing messages at the start of the next round
     send_overlay_message_batch();
 
-    round_timeout_timer = timers->register_timer(OVERLAY_ROUND_TIMEOUT, [this]() { handle_round_timeout(); });
+    const int predecessor = schedule.gossip_predecessor(meter_id, overlay_round);
+    start_round_timer(predecessor);
 
-    const int predecessor = util::gossip_predecessor(meter_id, overlay_round, num_meters);
     if(failed_meter_ids.find(predecessor) == failed_meter_ids.end()) {
-        // Send a ping to the predecessor meter to see if it's still alive
-        auto ping = std::make_shared<messaging::PingMessage<RecordType>>(meter_id, false);
-        // This turns out to be really important: Checking whether this ping succeeds
-        // is the most common way of detecting that a node has failed
-        auto success = network.send(ping, predecessor);
-        if(!success) {
-            logger->debug("Meter {} detected that meter {} is down", meter_id, predecessor);
-            failed_meter_ids.emplace(predecessor);
+        if(heard_from_recently(predecessor)) {
+            // Its recent traffic counts as a ping response; it will be pinged if the round times out
+            ping_response_from_predecessor = true;
+        } else {
+            // Send a ping to the predecessor meter to see if it's still alive
+            ping_predecessor(predecessor);
         }
     }
 
     // Check future messages in case messages for the next round have already been received
-    ptr_list<messaging::OverlayTransportMessage<RecordType>> received_messages;
-    for(auto message_iter = future_overlay_messages.begin();
-        message_iter != future_overlay_messages.end();) {
-        if((*message_iter)->sender_round == overlay_round &&
-           (*message_iter)->get_body()->query_num == get_current_query_num()) {
-            received_messages.emplace_back(*message_iter);
-            message_iter = future_overlay_messages.erase(message_iter);
-        } else {
-            ++message_iter;
-        }
-    }
+    std::vector<std::shared_ptr<messaging::OverlayTransportMessage<RecordType>>> received_messages;
+    received_messages.swap(future_overlay_messages[overlay_round % future_round_horizon]);
 
     // Cache the last known value of overlay_round, because end_overlay_round()
     // might be called from inside one of these handle()s, so we might already
@@ -325,19 +380,17 @@ void ProtocolState<RecordType>::common_end_overlay_round() {
 
 template <typename RecordType>
 void ProtocolState<RecordType>::send_overlay_message_batch() {
-    const int comm_target = util::gossip_target(meter_id, overlay_round, num_meters);
+    const int comm_target = schedule.gossip_target(meter_id, overlay_round);
     ptr_list<messaging::OverlayTransportMessage<RecordType>> messages_to_send;
-    // First, check waiting messages to see if some are now in the right round
-    for(auto message_iter = waiting_messages.begin();
-        message_iter != waiting_messages.end();) {
-        if((*message_iter)->destination == comm_target) {
-            // wrap it up in a new OverlayTransportMessage, then delete from waiting_messages
+    // First, send the waiting messages whose next hop is this round's target
+    auto waiting_bucket = waiting_messages.find(comm_target);
+    if(waiting_bucket != waiting_messages.end()) {
+        for(const auto& waiting_message : waiting_bucket->second) {
             messages_to_send.emplace_back(std::make_shared<messaging::OverlayTransportMessage<RecordType>>(
-                meter_id, overlay_round, false, *message_iter));
-            message_iter = waiting_messages.erase(message_iter);
-        } else {
-            ++message_iter;
+                meter_id, overlay_round, false, waiting_message));
         }
+        // Keep the emptied bucket, since this target will come around again
+        waiting_bucket->second.clear();
     }
     // Next, check messages generated by the protocol this round to see if they should be sent or held
     for(const auto& overlay_message : outgoing_messages) {
@@ -345,7 +398,7 @@ void ProtocolState<RecordType>::send_overlay_message_batch() {
             messages_to_send.emplace_back(std::make_shared<messaging::OverlayTransportMessage<RecordType>>(
                 meter_id, overlay_round, false, overlay_message));
         } else {
-            waiting_messages.emplace_back(overlay_message);
+            waiting_messages[overlay_message->destination].emplace_back(overlay_message);
         }
     }
     outgoing_messages.clear();
@@ -376,24 +429,81 @@ template <typename RecordType>
 void ProtocolState<RecordType>::handle_round_timeout() {
     if(ping_response_from_predecessor) {
         ping_response_from_predecessor = false;
-        const int predecessor = util::gossip_predecessor(meter_id, overlay_round, num_meters);
+        const int predecessor = schedule.gossip_predecessor(meter_id, overlay_round);
         logger->trace("Meter {} continuing to wait for round {}, got a response from {} recently", meter_id, overlay_round, predecessor);
-        round_timeout_timer = timers->register_timer(OVERLAY_ROUND_TIMEOUT, [this]() { handle_round_timeout(); });
-        auto ping = std::make_shared<messaging::PingMessage<RecordType>>(meter_id, false);
-        auto success = network.send(ping, predecessor);
-        if(!success) {
-            logger->debug("Meter {} detected that meter {} just went down after responding to a ping", meter_id, predecessor);
-            failed_meter_ids.emplace(predecessor);
-        }
+        start_round_timer(predecessor);
+        ping_predecessor(predecessor);
     } else {
         logger->debug("Meter {} timed out waiting for an overlay message for round {}", meter_id, overlay_round);
         end_overlay_round();
     }
 }
 
+template <typename RecordType>
+void ProtocolState<RecordType>::start_round_timer(int predecessor) {
+    timers.cancel_timer(round_timeout_timer);
+    const int generation = ++round_timer_generation;
+    std::weak_ptr<ProtocolState> weak_this = this->weak_from_this();
+    NetworkManager<RecordType>& network_manager = network;
+    round_timeout_timer = timers.register_timer(round_timeout(predecessor), [weak_this, generation, &network_manager]() {
+        network_manager.post([weak_this, generation]() {
+            auto state = weak_this.lock();
+            if(state && state->round_timer_generation == generation) {
+                state->handle_round_timeout();
+            }
+        });
+    });
+}
+
+template <typename RecordType>
+void ProtocolState<RecordType>::cancel_round_timer() {
+    timers.cancel_timer(round_timeout_timer);
+    ++round_timer_generation;
+}
+
+template <typename RecordType>
+void ProtocolState<RecordType>::ping_predecessor(int predecessor) {
+    auto ping = std::make_shared<messaging::PingMessage<RecordType>>(meter_id, false);
+    failure_detector.record_probe_sent(predecessor);
+    const int ping_query_num = get_current_query_num();
+    const int ping_round = overlay_round;
+    // This turns out to be really important: Checking whether this ping succeeds
+    // is the most common way of detecting that a node has failed
+    // The query's state may be discarded before the ping completes
+    std::weak_ptr<ProtocolState> weak_this = this->weak_from_this();
+    network.send(ping, predecessor,
+                 [weak_this, predecessor, ping_query_num, ping_round](bool success) {
+                     auto state = weak_this.lock();
+                     if(!success && state) {
+                         state->handle_ping_failure(predecessor, ping_query_num, ping_round);
+                     }
+                 },
+                 std::chrono::milliseconds(round_timeout(predecessor)));
+}
+
+template <typename RecordType>
+void ProtocolState<RecordType>::handle_ping_failure(int predecessor, int ping_query_num, int ping_round) {
+    // The failed_meter_ids set is reset for each query, so a failure from an earlier query is stale
+    if(ping_query_num != get_current_query_num()) {
+        return;
+    }
+    logger->debug("Meter {} detected that meter {} is down", meter_id, predecessor);
+    failed_meter_ids.emplace(predecessor);
+    // If we are still waiting on that predecessor, there is no point in waiting any longer
+    if(ping_round == overlay_round && is_in_overlay_phase() && !is_last_round) {
+        logger->trace("Meter {} ending round early, predecessor {} is dead", meter_id, predecessor);
+        end_overlay_round();
+    }
+}
+
 template <typename RecordType>
 void ProtocolState<RecordType>::buffer_future_message(std::shared_ptr<messaging::OverlayTransportMessage<RecordType>> message) {
-    future_overlay_messages.push_back(std::move(message));
+    if(message->sender_round <= overlay_round || message->sender_round > overlay_round + future_round_horizon) {
+        logger->debug("Meter {}, in round {}, discarded a message from meter {} for round {}, which is beyond its buffer",
+                      meter_id, overlay_round, message->sender_id, message->sender_round);
+        return;
+    }
+    future_overlay_messages[message->sender_round % future_round_horizon].emplace_back(std::move(message));
 }
 template <typename RecordType>
 void ProtocolState<RecordType>::buffer_future_message(std::shared_ptr<messaging::AggregationMessage<RecordType>> message) {
@@ -2,18 +2,22 @@
 #include "adq/config/Configuration.hpp"
 #include "adq/core/DataSource.hpp"
 #include "adq/core/ProtocolState.hpp"
+#include "adq/util/LinuxTimerManager.hpp"
 #include "adq/util/Overlay.hpp"
 
 #include "adq/messaging/AggregationMessage.hpp"
 #include "adq/messaging/OverlayMessage.hpp"
 #include "adq/messaging/OverlayTransportMessage.hpp"
+#include "adq/messaging/OverlayTransportMessageView.hpp"
 #include "adq/messaging/PingMessage.hpp"
 #include "adq/messaging/QueryRequest.hpp"
 
 #include <spdlog/fmt/ostr.h>
 #include <spdlog/spdlog.h>
 
+#include <algorithm>
 #include <memory>
+#include <thread>
 
 namespace adq {
 
@@ -23,42 +27,125 @@ QueryClient<RecordType>::QueryClient(int num_clients,
     : my_id(Configuration::getInt32(Configuration::SECTION_SETUP, Configuration::CLIENT_ID)),
       num_clients(num_clients),
       logger(spdlog::get("global_logger")),
+      overlay_schedule(util::OverlaySchedule::for_num_nodes(num_clients)),
       network_manager(this),
-      query_protocol_state(num_clients, my_id, network_manager, *data_source),
-      data_source(std::move(data_source)) {}
+      timers(std::make_unique<util::LinuxTimerManager>()),
+      crypto(Configuration::getString(Configuration::SECTION_SETUP, Configuration::PRIVATE_KEY_FILE),
+             make_client_key_paths(Configuration::getString(Configuration::SECTION_SETUP, Configuration::CLIENT_KEYS_FOLDER),
+                                   num_clients)),
+      failure_detector(std::chrono::milliseconds(ProtocolState<RecordType>::OVERLAY_ROUND_TIMEOUT
+                                                 / ProtocolState<RecordType>::ROUND_TIMEOUT_RTT_MULTIPLE),
+                       UTILITY_NODE_ID, num_clients - 1),
+      // The thread that builds onions also works on them, so it doesn't need a pool thread of its own
+      crypto_workers(Configuration::getInstance().hasKey(Configuration::SECTION_SETUP, Configuration::NUM_CRYPTO_THREADS)
+                         ? Configuration::getUInt32(Configuration::SECTION_SETUP, Configuration::NUM_CRYPTO_THREADS)
+                         : std::max(1u, std::thread::hardware_concurrency()) - 1),
+      data_source(std::move(data_source)),
+      // A finished query's state is kept for about as long as it takes the next batch of queries to run
+      max_tracked_queries(2 * (Configuration::getInstance().hasKey(Configuration::SECTION_SETUP, Configuration::MAX_CONCURRENT_QUERIES)
+                                   ? std::max(1u, Configuration::getUInt32(Configuration::SECTION_SETUP, Configuration::MAX_CONCURRENT_QUERIES))
+                                   : ProtocolState<RecordType>::DEFAULT_MAX_CONCURRENT_QUERIES)),
+      oldest_tracked_query(0) {}
+
+template <typename RecordType>
+ProtocolState<RecordType>* QueryClient<RecordType>::get_query_state(int query_num) {
+    auto state_iter = query_states.find(query_num);
+    if(state_iter != query_states.end()) {
+        return state_iter->second.get();
+    }
+    if(query_num < oldest_tracked_query || discarded_queries.count(query_num) > 0) {
+        return nullptr;
+    }
+    state_iter = query_states.emplace(query_num, std::make_shared<ProtocolState<RecordType>>(
+                                                     num_clients, my_id, network_manager, *data_source, *timers, crypto,
+                                                     failure_detector, crypto_workers))
+                     .first;
+    // Discard the oldest states of queries that are finished, never ones running or waiting for their QueryRequest
+    for(auto old_state = query_states.begin(); query_states.size() > max_tracked_queries && old_state != query_states.end();) {
+        if(old_state->second->is_finished() && old_state != state_iter) {
+            logger->trace("Client {} discarding the state of query {}", my_id, old_state->first);
+            discarded_queries.insert(old_state->first);
+            old_state = query_states.erase(old_state);
+        } else {
+            ++old_state;
+        }
+    }
+    // A query below many discarded ones has almost certainly been lost, so stop waiting for it
+    if(discarded_queries.size() > max_tracked_queries) {
+        oldest_tracked_query = *discarded_queries.begin() + 1;
+        discarded_queries.erase(discarded_queries.begin());
+    }
+    while(!discarded_queries.empty() && *discarded_queries.begin() == oldest_tracked_query) {
+        discarded_queries.erase(discarded_queries.begin());
+        ++oldest_tracked_query;
+    }
+    return state_iter->second.get();
+}
 
 template <typename RecordType>
 void QueryClient<RecordType>::handle_message(std::shared_ptr<messaging::QueryRequest<RecordType>> message) {
+    ProtocolState<RecordType>* query_protocol_state = get_query_state(message->query_number);
+    if(query_protocol_state == nullptr || query_protocol_state->get_current_query_num() >= 0 || query_protocol_state->is_finished()) {
+        logger->warn("Client {} ignored a request for query {}, which it has already run", my_id, message->query_number);
+        return;
+    }
     // Forward the serialized function call to the DataSource object
     RecordType data_to_contribute = data_source->select_functions.at(message->select_function_opcode)(message->select_serialized_args.data());
     bool should_contribute = data_source->filter_functions.at(message->filter_function_opcode)(data_to_contribute, message->filter_serialized_args.data());
     if(should_contribute) {
-        query_protocol_state.start_query(message, data_to_contribute);
+        // Connect to every peer this query will need now, so the connects overlap with Setup
+        // instead of delaying the first message to each peer in the middle of an overlay round
+        network_manager.open_connections(query_protocol_state->get_scheduled_peers());
+        query_protocol_state->start_query(message, data_to_contribute);
+    } else {
+        query_protocol_state->decline_query();
     }
 }
 
 template <typename RecordType>
 void QueryClient<RecordType>::handle_message(std::shared_ptr<messaging::PingMessage<RecordType>> message) {
-    query_protocol_state.handle_ping_message(*message);
+    if(!message->is_response) {
+        // If this is a ping request, send a response back
+        auto reply = std::make_shared<messaging::PingMessage<RecordType>>(my_id, true);
+        logger->trace("Meter {} replying to a ping from {}", my_id, message->sender_id);
+        network_manager.send(reply, message->sender_id);
+        failure_detector.record_arrival(message->sender_id);
+    } else {
+        failure_detector.record_probe_answered(message->sender_id);
+    }
+    // Either way, the sender is alive, which every running query may want to know
+    for(const auto& query_state : query_states) {
+        query_state.second->record_liveness(message->sender_id);
+    }
 }
 
 template <typename RecordType>
-void QueryClient<RecordType>::handle_message(std::shared_ptr<messaging::OverlayTransportMessage<RecordType>> message) {
-    if(util::gossip_target(message->sender_id, message->sender_round, num_clients) == my_id) {
-        std::shared_ptr<messaging::OverlayMessage<RecordType>> wrapped_message = message->get_body();
-        if(wrapped_message->query_num > query_protocol_state.get_current_query_num()) {
-            // If the message is for a future query, buffer it until I get the query-start message
-            query_protocol_state.buffer_future_message(message);
-        } else if(wrapped_message->query_num < query_protocol_state.get_current_query_num()) {
-            logger->warn("Client {} discarded an obsolete message from client {} for an old query: {}", my_id, message->sender_id, *message);
-            // At this point, we know the message is for the current query
-        } else if(message->sender_round == query_protocol_state.get_current_overlay_round()) {
-            query_protocol_state.handle_overlay_message(*message);
-        } else if(message->sender_round > query_protocol_state.get_current_overlay_round()) {
+void QueryClient<RecordType>::handle_message(std::shared_ptr<messaging::OverlayTransportMessageView<RecordType>> message) {
+    // The headers are read directly from the receive buffer; the message is only deserialized if it will be kept
+    const int sender_id = message->sender_id();
+    const int sender_round = message->sender_round();
+    // Any overlay message, even one that is discarded, shows that the sender is alive
+    failure_detector.record_arrival(sender_id);
+    for(const auto& query_state : query_states) {
+        query_state.second->record_liveness(sender_id);
+    }
+    if(overlay_schedule.gossip_target(sender_id, sender_round) == my_id) {
+        const int query_num = message->query_num();
+        ProtocolState<RecordType>* query_protocol_state = get_query_state(query_num);
+        if(query_protocol_state == nullptr) {
+            logger->warn("Client {} discarded an obsolete message from client {} for an old query: {}", my_id, sender_id, *message);
+        } else if(query_num > query_protocol_state->get_current_query_num()) {
+            // If the query hasn't started here yet, buffer the message until I get the query-start message
+            query_protocol_state->buffer_future_message(std::shared_ptr<messaging::OverlayTransportMessage<RecordType>>(message->materialize()));
+            // At this point, we know the message is for a query that has started
+        } else if(sender_round == query_protocol_state->get_current_overlay_round()) {
+            query_protocol_state->handle_overlay_message(*message);
+        } else if(sender_round > query_protocol_state->get_current_overlay_round()) {
             // If it's a message for a future round, buffer it until my round advances
-            query_protocol_state.buffer_future_message(message);
+            query_protocol_state->buffer_future_message(std::shared_ptr<messaging::OverlayTransportMessage<RecordType>>(message->materialize()));
         } else {
-            logger->debug("Client {}, already in round {}, rejected a message from client {} as too old: {}", my_id, query_protocol_state.get_current_overlay_round(), message->sender_id, *message);
+            logger->debug("Client {}, already in round {} of query {}, rejected a message from client {} as too old: {}", my_id,
+                          query_protocol_state->get_current_overlay_round(), query_num, sender_id, *message);
         }
     } else {
         logger->warn("Client {} rejected a message because it has the wrong gossip target: {}", my_id, *message);
@@ -67,6 +154,13 @@ void QueryClient<RecordType>::handle_message(std::shared_ptr<messaging::OverlayT
 
 template <typename RecordType>
 void QueryClient<RecordType>::handle_message(std::shared_ptr<messaging::AggregationMessage<RecordType>> message) {
+    failure_detector.record_arrival(message->sender_id);
+    auto state_iter = query_states.find(message->query_num);
+    if(state_iter == query_states.end()) {
+        logger->warn("Meter {} rejected a message from meter {} for a query it is not running: {}", my_id, message->sender_id, *message);
+        return;
+    }
+    ProtocolState<RecordType>& query_protocol_state = *state_iter->second;
     if(util::aggregation_group_for(message->sender_id, query_protocol_state.get_num_aggregation_groups(), num_clients) ==
        util::aggregation_group_for(my_id, query_protocol_state.get_num_aggregation_groups(), num_clients)) {
         if(query_protocol_state.is_in_aggregate_phase()) {
@@ -81,7 +175,14 @@ void QueryClient<RecordType>::handle_message(std::shared_ptr<messaging::Aggregat
 }
 template <typename RecordType>
 void QueryClient<RecordType>::handle_message(std::shared_ptr<messaging::SignatureResponse<RecordType>> message) {
-    query_protocol_state.handle_signature_response(*message);
+    // The utility's response time includes signing, so it says little about latency to the meters
+    failure_detector.record_response(UTILITY_NODE_ID);
+    auto state_iter = query_states.find(message->query_num);
+    if(state_iter == query_states.end() || state_iter->second->get_current_query_num() != message->query_num) {
+        logger->warn("Client {} ignored a signature for query {}, which it is not running", my_id, message->query_num);
+        return;
+    }
+    state_iter->second->handle_signature_response(*message);
 }
 
 template <typename RecordType>
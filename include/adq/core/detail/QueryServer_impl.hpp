@@ -9,12 +9,16 @@
 #include "adq/messaging/QueryRequest.hpp"
 #include "adq/messaging/SignatureRequest.hpp"
 #include "adq/messaging/SignatureResponse.hpp"
+#include "adq/util/BufferPool.hpp"
 #include "adq/util/LinuxTimerManager.hpp"
 
 #include <spdlog/fmt/ostr.h>
 #include <spdlog/spdlog.h>
 
+#include <algorithm>
 #include <cmath>
+#include <numeric>
+#include <vector>
 
 namespace adq {
 
@@ -29,7 +33,11 @@ QueryServer<RecordType>::QueryServer(int num_clients)
                                                          Configuration::CLIENT_KEYS_FOLDER),
                                 num_clients)),
       timer_library(std::make_unique<util::LinuxTimerManager>()),
-      query_timeout_time(compute_timeout_time(num_clients)) {}
+      failure_detector(std::chrono::milliseconds(NETWORK_ROUNDTRIP_TIMEOUT / ProtocolState<RecordType>::ROUND_TIMEOUT_RTT_MULTIPLE),
+                       0, num_clients - 1),
+      max_concurrent_queries(Configuration::getInstance().hasKey(Configuration::SECTION_SETUP, Configuration::MAX_CONCURRENT_QUERIES)
+                                 ? std::max(1u, Configuration::getUInt32(Configuration::SECTION_SETUP, Configuration::MAX_CONCURRENT_QUERIES))
+                                 : ProtocolState<RecordType>::DEFAULT_MAX_CONCURRENT_QUERIES) {}
 
 template <typename RecordType>
 QueryServer<RecordType>::~QueryServer() {
@@ -48,93 +56,158 @@ void QueryServer<RecordType>::shut_down() {
 
 template <typename RecordType>
 void QueryServer<RecordType>::start_query(std::shared_ptr<messaging::QueryRequest<RecordType>> query) {
-    curr_query_meters_signed.clear();
-    query_num = query->query_number;
-    curr_query_results.clear();
+    const int query_num = query->query_number;
     logger->info("Starting query {}", query_num);
-    query_finished = false;
-    for(int meter_id = 0; meter_id < num_meters; ++meter_id) {
-        network.send(query, meter_id);
+    {
+        std::lock_guard<std::mutex> lock(queries_mutex);
+        active_queries[query_num] = ActiveQuery{-1, 0, {}, {}};
+        int log2n = std::ceil(std::log2(num_meters));
+        int rounds_for_query = 6 * ProtocolState<RecordType>::FAILURES_TOLERATED +
+                               3 * log2n * log2n + 3 +
+                               (int)std::ceil(std::log2(num_meters / (double)(2 * ProtocolState<RecordType>::FAILURES_TOLERATED + 1)));
+        set_query_timeout(query_num, rounds_for_query * network_roundtrip_timeout());
     }
-    int log2n = std::ceil(std::log2(num_meters));
-    int rounds_for_query = 6 * ProtocolState<RecordType>::FAILURES_TOLERATED +
-                           3 * log2n * log2n + 3 +
-                           (int)std::ceil(std::log2(num_meters / (double)(2 * ProtocolState<RecordType>::FAILURES_TOLERATED + 1)));
-    query_timeout_timer = timer_library->register_timer(rounds_for_query * NETWORK_ROUNDTRIP_TIMEOUT, [this]() {
-        logger->debug("Utility timed out waiting for query {} after receiving no messages", query_num);
-        end_query();
+    std::vector<int> meter_ids(num_meters);
+    std::iota(meter_ids.begin(), meter_ids.end(), 0);
+    for(const int meter_id : meter_ids) {
+        failure_detector.record_probe_sent(meter_id);
+    }
+    network.multicast(query, meter_ids);
+}
+
+template <typename RecordType>
+void QueryServer<RecordType>::set_query_timeout(int query_num, int delay_ms) {
+    ActiveQuery& query = active_queries.at(query_num);
+    const int generation = ++query.timeout_generation;
+    query.timeout_timer = timer_library->register_timer(delay_ms, [this, query_num, generation]() {
+        // Handle the timeout on the delivery strand, so it can't run concurrently with a message handler
+        network.post([this, query_num, generation]() {
+            std::size_t num_results;
+            {
+                std::lock_guard<std::mutex> lock(queries_mutex);
+                auto query_iter = active_queries.find(query_num);
+                if(query_iter == active_queries.end() || query_iter->second.timeout_generation != generation) {
+                    return;
+                }
+                num_results = query_iter->second.results.size();
+            }
+            logger->debug("Utility timed out waiting for query {} after receiving {} messages", query_num, num_results);
+            end_query(query_num);
+        });
     });
 }
 
 template <typename RecordType>
 void QueryServer<RecordType>::start_queries(const std::list<std::shared_ptr<messaging::QueryRequest<RecordType>>>& queries) {
-    if(queries.empty())
-        return;
-    for(const auto& query : queries) pending_batch_queries.push(query);
-    std::shared_ptr<messaging::QueryRequest<RecordType>> first_query = pending_batch_queries.top();
-    pending_batch_queries.pop();
-    start_query(first_query);
+    std::vector<std::shared_ptr<messaging::QueryRequest<RecordType>>> queries_to_start;
+    {
+        std::lock_guard<std::mutex> lock(queries_mutex);
+        for(const auto& query : queries) pending_batch_queries.push(query);
+        while(!pending_batch_queries.empty() && active_queries.size() + queries_to_start.size() < max_concurrent_queries) {
+            queries_to_start.emplace_back(pending_batch_queries.top());
+            pending_batch_queries.pop();
+        }
+    }
+    for(const auto& query : queries_to_start) {
+        start_query(query);
+    }
 }
 
 template <typename RecordType>
-void QueryServer<RecordType>::end_query() {
+void QueryServer<RecordType>::end_query(int query_num) {
     std::shared_ptr<messaging::AggregationMessageValue<RecordType>> query_result;
-    for(const auto& result : curr_query_results) {
-        logger->debug("Utility results: {}", curr_query_results);
-        // Is this the right way to iterate through a multiset and find out the count of each element?
-        if((int)curr_query_results.count(result) >= ProtocolState<RecordType>::FAILURES_TOLERATED + 1) {
-            query_result = result->get_body();
-            break;
+    std::shared_ptr<messaging::QueryRequest<RecordType>> next_query;
+    {
+        std::lock_guard<std::mutex> lock(queries_mutex);
+        auto query_iter = active_queries.find(query_num);
+        if(query_iter == active_queries.end()) {
+            return;
+        }
+        timer_library->cancel_timer(query_iter->second.timeout_timer);
+        const auto& query_results = query_iter->second.results;
+        for(const auto& result : query_results) {
+            logger->debug("Utility results for query {}: {}", query_num, query_results);
+            // Is this the right way to iterate through a multiset and find out the count of each element?
+            if((int)query_results.count(result) >= ProtocolState<RecordType>::FAILURES_TOLERATED + 1) {
+                query_result = result->get_body();
+                break;
+            }
+        }
+        active_queries.erase(query_iter);
+        if((int)all_query_results.size() <= query_num) {
+            all_query_results.resize(query_num + 1);
+        }
+        all_query_results[query_num] = query_result;
+        if(!pending_batch_queries.empty() && active_queries.size() < max_concurrent_queries) {
+            next_query = pending_batch_queries.top();
+            pending_batch_queries.pop();
         }
     }
-    curr_query_results.clear();
-    if((int)all_query_results.size() <= query_num) {
-        all_query_results.resize(query_num + 1);
-    }
-    all_query_results[query_num] = query_result;
     if(query_result == nullptr) {
         logger->error("Query {} failed! No results received by timeout.", query_num);
     } else {
         logger->info("Query {} finished, result was {}", query_num, *query_result);
     }
-    query_finished = true;
+    const auto send_metrics = network.get_send_queue_metrics();
+    logger->debug("Send queues after query {}: {} bytes queued, peak {} bytes, {} dummy messages dropped, {} messages rejected, {} blocked sends",
+                  query_num, send_metrics.total_bytes_queued, send_metrics.peak_total_bytes_queued,
+                  send_metrics.frames_dropped, send_metrics.frames_rejected, send_metrics.producer_blocks);
+    const auto pool_metrics = util::BufferPool::getInstance().get_metrics();
+    logger->debug("Buffer pool after query {}: {} bytes in use, high-water mark {} bytes, {} bytes free, {} heap allocations, {} reuses",
+                  query_num, pool_metrics.bytes_in_use, pool_metrics.peak_bytes_in_use, pool_metrics.bytes_free,
+                  pool_metrics.heap_allocations, pool_metrics.reuses);
     for(const auto& callback_pair : query_callbacks) {
         callback_pair.second(query_num, query_result);
     }
-    if(!pending_batch_queries.empty()) {
-        auto next_query = pending_batch_queries.top();
-        pending_batch_queries.pop();
+    if(next_query) {
         start_query(next_query);
     }
 }
 
 template <typename RecordType>
 void QueryServer<RecordType>::handle_message(std::shared_ptr<messaging::SignatureRequest<RecordType>> message) {
-    if(curr_query_meters_signed.find(message->sender_id) == curr_query_meters_signed.end()) {
-        auto signed_value = crypto_library.rsa_sign_blinded(*message->get_body());
-        network.send(std::make_shared<messaging::SignatureResponse<RecordType>>(UTILITY_NODE_ID, signed_value), message->sender_id);
-        curr_query_meters_signed.insert(message->sender_id);
+    // A meter blinds its contribution before asking for a signature, so this measures more than the network
+    failure_detector.record_response(message->sender_id);
+    {
+        std::lock_guard<std::mutex> lock(queries_mutex);
+        auto query_iter = active_queries.find(message->query_num);
+        if(query_iter == active_queries.end()) {
+            logger->warn("Utility ignored a signature request from meter {} for query {}, which is not running", message->sender_id, message->query_num);
+            return;
+        }
+        if(!query_iter->second.meters_signed.insert(message->sender_id).second) {
+            return;
+        }
     }
+    auto signed_value = crypto_library.rsa_sign_blinded(*message->get_body());
+    network.send(std::make_shared<messaging::SignatureResponse<RecordType>>(UTILITY_NODE_ID, message->query_num, signed_value), message->sender_id);
 }
 
 template <typename RecordType>
 void QueryServer<RecordType>::handle_message(std::shared_ptr<messaging::AggregationMessage<RecordType>> message) {
     logger->trace("Utility received an aggregation message: {}", *message);
-    curr_query_results.insert(message);
-    // Clear the timeout, since we got a message
-    timer_library->cancel_timer(query_timeout_timer);
-    // Check if this was definitely the last result from the query
-    if(!query_finished && ((int)curr_query_results.size() > 2 * ProtocolState<RecordType>::FAILURES_TOLERATED)) {
-        end_query();
+    failure_detector.record_arrival(message->sender_id);
+    bool query_complete;
+    {
+        std::lock_guard<std::mutex> lock(queries_mutex);
+        auto query_iter = active_queries.find(message->query_num);
+        if(query_iter == active_queries.end()) {
+            logger->debug("Utility ignored a result for query {}, which has already finished", message->query_num);
+            return;
+        }
+        ActiveQuery& query = query_iter->second;
+        query.results.insert(message);
+        // Clear the timeout, since we got a message
+        timer_library->cancel_timer(query.timeout_timer);
+        // Check if this was definitely the last result from the query
+        query_complete = (int)query.results.size() > 2 * ProtocolState<RecordType>::FAILURES_TOLERATED;
+        // If the query isn't finished, set a new timeout for the next result message
+        if(!query_complete) {
+            set_query_timeout(message->query_num, compute_timeout_time());
+        }
     }
-    // If the query isn't finished, set a new timeout for the next result message
-    if(!query_finished) {
-        query_timeout_timer = timer_library->register_timer(
-            query_timeout_time,
-            [this]() {
-                logger->debug("Utility timed out waiting for query {} after receiving {} messages", query_num, curr_query_results.size());
-                end_query();
-            });
+    if(query_complete) {
+        end_query(message->query_num);
     }
 }
 
@@ -152,7 +225,7 @@ bool QueryServer<RecordType>::deregister_query_callback(const int callback_id) {
 }
 
 template <typename RecordType>
-void QueryServer<RecordType>::handle_message(std::shared_ptr<messaging::OverlayTransportMessage<RecordType>> message) {
+void QueryServer<RecordType>::handle_message(std::shared_ptr<messaging::OverlayTransportMessageView<RecordType>> message) {
     logger->warn("Server received an OverlayTransport message. Ignoring it.");
 }
 
@@ -172,9 +245,16 @@ void QueryServer<RecordType>::handle_message(std::shared_ptr<messaging::Signatur
 }
 
 template <typename RecordType>
-int QueryServer<RecordType>::compute_timeout_time(const int num_meters) {
+int QueryServer<RecordType>::network_roundtrip_timeout() const {
+    const int timeout = ProtocolState<RecordType>::ROUND_TIMEOUT_RTT_MULTIPLE
+                        * failure_detector.response_time_percentile(ProtocolState<RecordType>::ROUND_TIMEOUT_PERCENTILE).count();
+    return std::min(ProtocolState<RecordType>::MAX_ROUND_TIMEOUT, std::max(ProtocolState<RecordType>::MIN_ROUND_TIMEOUT, timeout));
+}
+
+template <typename RecordType>
+int QueryServer<RecordType>::compute_timeout_time() const {
     int messages_for_aggregation = (int)std::ceil(std::log2((double)num_meters / (double)(2 * ProtocolState<RecordType>::FAILURES_TOLERATED + 1)));
-    return messages_for_aggregation * NETWORK_ROUNDTRIP_TIMEOUT;
+    return messages_for_aggregation * network_roundtrip_timeout();
 }
 
 }  // namespace adq
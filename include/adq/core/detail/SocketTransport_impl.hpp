@@ -0,0 +1,111 @@
+#pragma once
+
+#include "../SocketTransport.hpp"
+
+#include <asio.hpp>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace adq {
+
+template <typename Protocol>
+void SocketTransport<Protocol>::async_connect(ConnectHandler handler) {
+    socket.async_connect(peer_endpoint, [this, handler](const asio::error_code& error) {
+        if(error) {
+            handler(error);
+            return;
+        }
+        // The handler owns this transport (through its connection), so hello_id outlives the write
+        asio::async_write(socket, asio::buffer(&hello_id, sizeof(int)),
+                          [handler](const asio::error_code& error, std::size_t) { handler(error); });
+    });
+}
+
+template <typename Protocol>
+void SocketTransport<Protocol>::async_read_some(asio::mutable_buffer buffer, IoHandler handler) {
+    socket.async_read_some(buffer, std::move(handler));
+}
+
+template <typename Protocol>
+void SocketTransport<Protocol>::async_write(const std::vector<asio::const_buffer>& buffers, IoHandler handler) {
+    asio::async_write(socket, buffers, std::move(handler));
+}
+
+template <typename Protocol>
+void SocketTransport<Protocol>::close() {
+    asio::error_code ignored_error;
+    socket.close(ignored_error);
+}
+
+template <typename Protocol>
+void SocketListener<Protocol>::start_accepting(AcceptHandler handler) {
+    accept_handler = std::move(handler);
+    do_accept();
+}
+
+template <typename Protocol>
+void SocketListener<Protocol>::do_accept() {
+    // Each accepted socket gets its own strand, so its handlers never run concurrently
+    acceptor.async_accept(asio::make_strand(io_context),
+                          [this](const asio::error_code& error, typename Protocol::socket socket) {
+                              if(error == asio::error::operation_aborted) {
+                                  return;
+                              }
+                              if(error) {
+                                  accept_handler(error, nullptr, 0, asio::ip::address());
+                              } else {
+                                  read_hello(std::move(socket));
+                              }
+                              do_accept();
+                          });
+}
+
+template <typename Protocol>
+void SocketListener<Protocol>::read_hello(typename Protocol::socket socket) {
+    asio::error_code identify_error;
+    // A TCP peer is identified by its address; a local one must at least belong to the same user
+    asio::ip::address remote_address;
+    if constexpr(std::is_same_v<Protocol, asio::ip::tcp>) {
+        remote_address = socket.remote_endpoint(identify_error).address();
+    } else if(!is_same_user(socket.native_handle())) {
+        identify_error = asio::error::access_denied;
+    }
+    if(identify_error) {
+        asio::error_code ignored_error;
+        socket.close(ignored_error);
+        accept_handler(identify_error, nullptr, 0, asio::ip::address());
+        return;
+    }
+    // Wait for the client to send its ID before handing over the connection
+    auto accepted_socket = std::make_shared<typename Protocol::socket>(std::move(socket));
+    auto hello_id = std::make_shared<int>();
+    // The timer shares the socket's strand, so it can close the socket without racing the read
+    auto hello_timer = std::make_shared<asio::steady_timer>(accepted_socket->get_executor(), HELLO_TIMEOUT);
+    hello_timer->async_wait([accepted_socket](const asio::error_code& error) {
+        if(!error) {
+            asio::error_code ignored_error;
+            accepted_socket->close(ignored_error);
+        }
+    });
+    asio::async_read(*accepted_socket, asio::buffer(hello_id.get(), sizeof(int)),
+                     [this, accepted_socket, hello_id, hello_timer, remote_address](const asio::error_code& error, std::size_t) {
+                         hello_timer->cancel();
+                         if(error) {
+                             // Only the hello timer closes the socket before the read finishes
+                             accept_handler(error == asio::error::operation_aborted ? asio::error::timed_out : error,
+                                            nullptr, 0, asio::ip::address());
+                             return;
+                         }
+                         accept_handler(error, std::make_unique<SocketTransport<Protocol>>(std::move(*accepted_socket)),
+                                        *hello_id, remote_address);
+                     });
+}
+
+template <typename Protocol>
+void SocketListener<Protocol>::close() {
+    asio::error_code ignored_error;
+    acceptor.close(ignored_error);
+}
+
+}  // namespace adq
@@ -3,6 +3,7 @@
 #include "MessageBody.hpp"
 #include "MessageBodyType.hpp"
 #include "adq/mutils-serialization/SerializationSupport.hpp"
+#include "adq/util/FramedSendBuffer.hpp"
 
 #include <cstdint>
 #include <ostream>
@@ -83,6 +84,12 @@ public:
     std::size_t to_bytes(uint8_t* buffer) const;
     void post_object(const std::function<void(uint8_t const* const, std::size_t)>& f) const;
     static std::unique_ptr<ByteBody<RecordType>> from_bytes(mutils::DeserializationManager* m, uint8_t const* buffer);
+    /**
+     * Appends this ByteBody to an outgoing frame in the same format as to_bytes,
+     * but references the byte array in place instead of copying it. The
+     * ByteBody must not be modified until the frame has been sent.
+     */
+    void gather_bytes(util::FramedSendBuffer& buffer) const;
 };
 
 // template <typename RecordType>
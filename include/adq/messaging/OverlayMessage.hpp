@@ -3,6 +3,7 @@
 #include "MessageBody.hpp"
 #include "MessageBodyType.hpp"
 #include "adq/core/InternalTypes.hpp"
+#include "adq/util/FramedSendBuffer.hpp"
 #include "adq/util/Hash.hpp"
 
 #include <memory>
@@ -64,6 +65,14 @@ public:
 
     void post_object(const std::function<void(uint8_t const* const, std::size_t)>& consumer_function) const;
 
+    /**
+     * Appends this OverlayMessage to an outgoing frame, in the same format as
+     * to_bytes. If the enclosed body is an encrypted ByteBody, its bytes are
+     * referenced in place rather than copied into the frame.
+     * @param buffer The frame to append the message to
+     */
+    virtual void gather_bytes(util::FramedSendBuffer& buffer) const;
+
     /**
      * Creates a new OverlayMessage by deserializing the contents of
      * {@code buffer}, blindly assuming that the buffer is large enough to contain
@@ -88,6 +97,14 @@ protected:
      */
     std::size_t to_bytes_common(uint8_t* buffer) const;
 
+    /**
+     * Helper method for implementing gather_bytes; appends the superclass
+     * (OverlayMessage) fields and the enclosed body to the frame, without
+     * a MessageBodyType.
+     * @param buffer The frame to append the fields to
+     */
+    void gather_bytes_common(util::FramedSendBuffer& buffer) const;
+
     /**
      * Helper method for implementing from_bytes; deserializes the superclass
      * (OverlayMessage) fields from buffer into the corresponding fields of
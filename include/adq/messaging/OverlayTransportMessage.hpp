@@ -42,6 +42,12 @@ public:
     std::size_t bytes_size() const;
     std::size_t to_bytes(uint8_t* buffer) const;
     void post_object(const std::function<void(uint8_t const* const, std::size_t)>&) const;
+    /**
+     * Appends this message to an outgoing frame in the same format as
+     * to_bytes, without copying any encrypted payloads in the body.
+     * @param buffer The frame to append the message to
+     */
+    void gather_bytes(util::FramedSendBuffer& buffer) const;
     static std::unique_ptr<OverlayTransportMessage<RecordType>> from_bytes(mutils::DeserializationManager* m, uint8_t const* buffer);
 };
 
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "MessageBody.hpp"
+#include "MessageBodyType.hpp"
+#include "MessageType.hpp"
+#include "adq/core/InternalTypes.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <ostream>
+
+namespace adq {
+namespace messaging {
+
+/**
+ * A read-only view of a serialized OverlayTransportMessage that is still in
+ * the buffer it was received into. The header fields of the transport message
+ * and its OverlayMessage body are decoded from the buffer only when they are
+ * accessed, and an encrypted body is exposed as a pointer into the buffer, so
+ * a message can be checked, routed, or decrypted without first deserializing
+ * (and copying) the whole onion. Call materialize() to get an ordinary
+ * OverlayTransportMessage once the message actually needs to be kept or
+ * modified.
+ *
+ * The view shares ownership of the receive buffer, so the buffer's storage
+ * will not be reused while the view exists. Since the fields come straight
+ * from the network, a view may only be constructed over bytes that passed
+ * validate(), which checks every length field against the bytes available.
+ *
+ * @tparam RecordType The data type being collected by queries in this instantiation
+ * of the query system
+ */
+template <typename RecordType>
+class OverlayTransportMessageView {
+private:
+    /** Points to the first byte of the serialized OverlayTransportMessage */
+    std::shared_ptr<const uint8_t> message_bytes;
+    /** The size of the entire serialized OverlayTransportMessage, as found by validate() */
+    std::size_t message_size;
+    /** The offset of the OverlayMessage fields shared by all body types (starting with query_num) */
+    std::size_t common_fields_offset;
+
+    template <typename T>
+    T read_field(std::size_t offset) const {
+        T value;
+        std::memcpy(&value, message_bytes.get() + offset, sizeof(value));
+        return value;
+    }
+    /** The offset of the enclosed body, if there is one */
+    std::size_t enclosed_body_offset() const;
+    /** Builds the OverlayMessage or PathOverlayMessage described by the header, with the given enclosed body */
+    std::shared_ptr<OverlayMessage<RecordType>> materialize_body(std::shared_ptr<MessageBody<RecordType>> enclosed_body) const;
+
+public:
+    /** The offset of the OverlayMessage body within the serialized OverlayTransportMessage */
+    static constexpr std::size_t BODY_OFFSET = sizeof(MessageType) + sizeof(int) + sizeof(bool) + sizeof(int);
+
+    /**
+     * Checks that the bytes at the start of a buffer are a well-formed
+     * OverlayTransportMessage, without deserializing it: its body must be an
+     * OVERLAY or PATH_OVERLAY body, no path or byte count may be negative,
+     * an encrypted body must enclose a ByteBody, and every nested body must
+     * end within the available bytes. Bodies of types with no fixed layout
+     * are measured by deserializing them.
+     * @param message_bytes A pointer to the start of the message
+     * @param available_size The number of bytes the message may occupy
+     * @return The size of the serialized message, or 0 if it is malformed
+     */
+    static std::size_t validate(const uint8_t* message_bytes, std::size_t available_size);
+
+    /**
+     * Constructs a view of a serialized OverlayTransportMessage.
+     * @param message_bytes A pointer to the start of the message, which
+     * must own (or share ownership of) the buffer containing it
+     * @param message_size The size of the message, as returned by validate()
+     */
+    OverlayTransportMessageView(std::shared_ptr<const uint8_t> message_bytes, std::size_t message_size);
+
+    int sender_round() const { return read_field<int>(sizeof(MessageType)); }
+    bool is_final_message() const { return read_field<bool>(sizeof(MessageType) + sizeof(int)); }
+    int sender_id() const { return read_field<int>(sizeof(MessageType) + sizeof(int) + sizeof(bool)); }
+    /** @return The type of the body, which will be either OVERLAY or PATH_OVERLAY */
+    MessageBodyType body_type() const { return read_field<MessageBodyType>(BODY_OFFSET); }
+    int query_num() const { return read_field<int>(common_fields_offset); }
+    int destination() const { return read_field<int>(common_fields_offset + sizeof(int)); }
+    bool is_encrypted() const { return read_field<bool>(common_fields_offset + 2 * sizeof(int)); }
+    bool flood() const { return read_field<bool>(common_fields_offset + 2 * sizeof(int) + sizeof(bool)); }
+    /** @return The remaining path of a PathOverlayMessage body, or an empty list for any other body */
+    std::list<int> remaining_path() const;
+    bool has_enclosed_body() const { return read_field<bool>(common_fields_offset + 2 * sizeof(int) + 2 * sizeof(bool)); }
+    /** @return The type of the enclosed body. Only valid if has_enclosed_body() is true. */
+    MessageBodyType enclosed_body_type() const { return read_field<MessageBodyType>(enclosed_body_offset()); }
+    /**
+     * @return A pointer to the contents of the enclosed body, which must be a
+     * ByteBody (as it is whenever is_encrypted() is true). The pointer is
+     * valid for the lifetime of this view.
+     */
+    const uint8_t* enclosed_bytes() const;
+    /** @return The number of bytes in the ByteBody returned by enclosed_bytes() */
+    std::size_t enclosed_bytes_size() const;
+    /** @return The size of the entire serialized OverlayTransportMessage */
+    std::size_t bytes_size() const { return message_size; }
+
+    /**
+     * Deserializes the message this view refers to.
+     * @return An OverlayTransportMessage equal to the one that was serialized
+     */
+    std::unique_ptr<OverlayTransportMessage<RecordType>> materialize() const;
+    /**
+     * Deserializes the headers of the message this view refers to, replacing
+     * its encrypted body with a body that has already been decrypted (e.g. by
+     * CryptoLibrary directly from enclosed_bytes()). This avoids copying the
+     * ciphertext out of the receive buffer.
+     * @param decrypted_body The decrypted contents of the enclosed body
+     * @return An OverlayTransportMessage with the same headers as the serialized
+     * one, whose body is no longer marked as encrypted
+     */
+    std::unique_ptr<OverlayTransportMessage<RecordType>> materialize_decrypted(
+            std::shared_ptr<MessageBody<RecordType>> decrypted_body) const;
+};
+
+template <typename RecordType>
+std::ostream& operator<<(std::ostream& out, const OverlayTransportMessageView<RecordType>& message);
+
+}  // namespace messaging
+}  // namespace adq
+
+#include "detail/OverlayTransportMessageView_impl.hpp"
@@ -37,6 +37,7 @@ public:
     std::size_t to_bytes(uint8_t* buffer) const;
     void post_object(const std::function<void(uint8_t const* const, std::size_t)>& consumer_function) const;
     std::size_t bytes_size() const;
+    void gather_bytes(util::FramedSendBuffer& buffer) const override;
     static std::unique_ptr<PathOverlayMessage<RecordType>> from_bytes(mutils::DeserializationManager* m, uint8_t const* buffer);
 
 protected:
@@ -44,6 +45,7 @@ protected:
     PathOverlayMessage() : OverlayMessage<RecordType>() {}
     // Tell C++ I want to use inheritance
     using OverlayMessage<RecordType>::to_bytes_common;
+    using OverlayMessage<RecordType>::gather_bytes_common;
 };
 
 template <typename RecordType>
@@ -26,8 +26,11 @@ public:
     // Tell C++ I want to use inheritance
     using Message<RecordType>::body;
 
-    SignatureRequest(const int sender_id, std::shared_ptr<ByteBody<RecordType>> encrypted_value)
-        : Message<RecordType>(sender_id, std::move(encrypted_value)) {}
+    /** The query that the blinded value is for */
+    int query_num;
+
+    SignatureRequest(const int sender_id, const int query_num, std::shared_ptr<ByteBody<RecordType>> encrypted_value)
+        : Message<RecordType>(sender_id, std::move(encrypted_value)), query_num(query_num) {}
     virtual ~SignatureRequest() = default;
 
     /** Returns a pointer to the message body cast to the correct type for this message */
@@ -25,8 +25,11 @@ public:
     using body_type = ByteBody<RecordType>;
     using Message<RecordType>::body;
 
-    SignatureResponse(const int sender_id, std::shared_ptr<ByteBody<RecordType>> encrypted_response)
-        : Message<RecordType>(sender_id, std::move(encrypted_response)){};
+    /** The query that the signature is for */
+    int query_num;
+
+    SignatureResponse(const int sender_id, const int query_num, std::shared_ptr<ByteBody<RecordType>> encrypted_response)
+        : Message<RecordType>(sender_id, std::move(encrypted_response)), query_num(query_num) {}
     virtual ~SignatureResponse() = default;
 
     /** Returns a pointer to the message body cast to the correct type for this message */
@@ -51,6 +51,15 @@ void ByteBody<RecordType>::post_object(const std::function<void(uint8_t const* c
     mutils::post_object(f, bytes);
 }
 template <typename RecordType>
+void ByteBody<RecordType>::gather_bytes(util::FramedSendBuffer& buffer) const {
+    // The serialized vector is an int element count followed by the elements
+    const int num_bytes = bytes.size();
+    uint8_t* header = buffer.append(mutils::bytes_size(type) + mutils::bytes_size(num_bytes));
+    std::size_t header_written = mutils::to_bytes(type, header);
+    mutils::to_bytes(num_bytes, header + header_written);
+    buffer.append_reference(bytes.data(), bytes.size());
+}
+template <typename RecordType>
 std::unique_ptr<ByteBody<RecordType>> ByteBody<RecordType>::from_bytes(mutils::DeserializationManager* m, uint8_t const* buffer) {
     // Skip past the MessageBodyType, then deserialize the vector
     return std::make_unique<ByteBody<RecordType>>(
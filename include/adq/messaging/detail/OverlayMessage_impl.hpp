@@ -108,6 +108,37 @@ std::size_t OverlayMessage<RecordType>::to_bytes(uint8_t* buffer) const {
     return bytes_written;
 }
 
+template <typename RecordType>
+void OverlayMessage<RecordType>::gather_bytes_common(util::FramedSendBuffer& buffer) const {
+    const bool remaining_body = (enclosed_body != nullptr);
+    uint8_t* header = buffer.append(mutils::bytes_size(query_num) + mutils::bytes_size(destination)
+                                    + mutils::bytes_size(is_encrypted) + mutils::bytes_size(flood)
+                                    + mutils::bytes_size(remaining_body));
+    std::size_t bytes_written = 0;
+    bytes_written += mutils::to_bytes(query_num, header + bytes_written);
+    bytes_written += mutils::to_bytes(destination, header + bytes_written);
+    bytes_written += mutils::to_bytes(is_encrypted, header + bytes_written);
+    bytes_written += mutils::to_bytes(flood, header + bytes_written);
+    bytes_written += mutils::to_bytes(remaining_body, header + bytes_written);
+    if(!remaining_body) {
+        return;
+    }
+    // Encrypted layers and nested overlay messages can be gathered; anything else is small enough to just serialize
+    if(auto byte_body = dynamic_cast<const ByteBody<RecordType>*>(enclosed_body.get())) {
+        byte_body->gather_bytes(buffer);
+    } else if(auto overlay_body = dynamic_cast<const OverlayMessage<RecordType>*>(enclosed_body.get())) {
+        overlay_body->gather_bytes(buffer);
+    } else {
+        enclosed_body->to_bytes(buffer.append(enclosed_body->bytes_size()));
+    }
+}
+
+template <typename RecordType>
+void OverlayMessage<RecordType>::gather_bytes(util::FramedSendBuffer& buffer) const {
+    mutils::to_bytes(type, buffer.append(mutils::bytes_size(type)));
+    gather_bytes_common(buffer);
+}
+
 template <typename RecordType>
 std::unique_ptr<OverlayMessage<RecordType>> OverlayMessage<RecordType>::from_bytes(mutils::DeserializationManager* p, uint8_t const* buffer) {
     std::size_t bytes_read = 0;
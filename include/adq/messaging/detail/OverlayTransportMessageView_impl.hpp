@@ -0,0 +1,186 @@
+#pragma once
+
+#include "../OverlayTransportMessageView.hpp"
+
+#include "adq/messaging/OverlayMessage.hpp"
+#include "adq/messaging/OverlayTransportMessage.hpp"
+#include "adq/messaging/PathOverlayMessage.hpp"
+#include "adq/mutils-serialization/SerializationSupport.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <ostream>
+
+namespace adq {
+namespace messaging {
+
+template <typename RecordType>
+constexpr std::size_t OverlayTransportMessageView<RecordType>::BODY_OFFSET;
+
+template <typename RecordType>
+std::size_t OverlayTransportMessageView<RecordType>::validate(const uint8_t* message_bytes, std::size_t available_size) {
+    // Each check compares a length with the bytes left after offset, so the sums can't overflow
+    std::size_t offset = BODY_OFFSET;
+    auto has_room = [&](std::size_t size) { return offset <= available_size && size <= available_size - offset; };
+    bool top_level = true;
+    bool encrypted = false;
+    // An onion nests each layer's body at the end of the one before it, so walk the layers in a loop
+    while(true) {
+        MessageBodyType type;
+        if(!has_room(sizeof(type))) {
+            return 0;
+        }
+        std::memcpy(&type, message_bytes + offset, sizeof(type));
+        if(top_level && type != MessageBodyType::OVERLAY && type != MessageBodyType::PATH_OVERLAY) {
+            return 0;
+        }
+        if(encrypted && type != MessageBodyType::BYTES) {
+            return 0;
+        }
+        switch(type) {
+            case MessageBodyType::BYTES: {
+                int num_bytes;
+                if(!has_room(sizeof(type) + sizeof(num_bytes))) {
+                    return 0;
+                }
+                std::memcpy(&num_bytes, message_bytes + offset + sizeof(type), sizeof(num_bytes));
+                offset += sizeof(type) + sizeof(num_bytes);
+                if(num_bytes < 0 || !has_room(num_bytes)) {
+                    return 0;
+                }
+                return offset + num_bytes;
+            }
+            case MessageBodyType::PATH_OVERLAY:
+            case MessageBodyType::OVERLAY: {
+                std::size_t header_size = sizeof(type);
+                if(type == MessageBodyType::PATH_OVERLAY) {
+                    int path_length;
+                    if(!has_room(sizeof(type) + sizeof(path_length))) {
+                        return 0;
+                    }
+                    std::memcpy(&path_length, message_bytes + offset + sizeof(type), sizeof(path_length));
+                    if(path_length < 0 || static_cast<std::size_t>(path_length) > available_size / sizeof(int)) {
+                        return 0;
+                    }
+                    header_size += sizeof(path_length) + path_length * sizeof(int);
+                }
+                // query_num, destination, is_encrypted, flood, remaining_body
+                const std::size_t is_encrypted_offset = header_size + 2 * sizeof(int);
+                const std::size_t remaining_body_offset = is_encrypted_offset + 2 * sizeof(bool);
+                header_size = remaining_body_offset + sizeof(bool);
+                if(!has_room(header_size)) {
+                    return 0;
+                }
+                bool remaining_body;
+                std::memcpy(&encrypted, message_bytes + offset + is_encrypted_offset, sizeof(encrypted));
+                std::memcpy(&remaining_body, message_bytes + offset + remaining_body_offset, sizeof(remaining_body));
+                offset += header_size;
+                if(!remaining_body) {
+                    return offset;
+                }
+                top_level = false;
+                break;
+            }
+            case MessageBodyType::AGREEMENT_VALUE:
+            case MessageBodyType::SIGNED_VALUE:
+            case MessageBodyType::VALUE_CONTRIBUTION:
+            case MessageBodyType::AGGREGATION_VALUE: {
+                // Unencrypted payloads have variable-length layouts, but they are small and rarely relayed
+                const std::size_t body_size = mutils::bytes_size(*mutils::from_bytes<MessageBody<RecordType>>(nullptr, message_bytes + offset));
+                if(!has_room(body_size)) {
+                    return 0;
+                }
+                return offset + body_size;
+            }
+            default:
+                return 0;
+        }
+    }
+}
+
+template <typename RecordType>
+OverlayTransportMessageView<RecordType>::OverlayTransportMessageView(std::shared_ptr<const uint8_t> message_bytes,
+                                                                     std::size_t message_size)
+    : message_bytes(std::move(message_bytes)),
+      message_size(message_size),
+      common_fields_offset(BODY_OFFSET + sizeof(MessageBodyType)) {
+    // A PathOverlayMessage puts its remaining_path, an int count followed by that many ints, before the common fields
+    if(body_type() == MessageBodyType::PATH_OVERLAY) {
+        common_fields_offset += sizeof(int) + read_field<int>(common_fields_offset) * sizeof(int);
+    }
+}
+
+template <typename RecordType>
+std::size_t OverlayTransportMessageView<RecordType>::enclosed_body_offset() const {
+    // query_num, destination, is_encrypted, flood, remaining_body
+    return common_fields_offset + 2 * sizeof(int) + 3 * sizeof(bool);
+}
+
+template <typename RecordType>
+std::list<int> OverlayTransportMessageView<RecordType>::remaining_path() const {
+    if(body_type() != MessageBodyType::PATH_OVERLAY) {
+        return {};
+    }
+    return *mutils::from_bytes<std::list<int>>(nullptr, message_bytes.get() + BODY_OFFSET + sizeof(MessageBodyType));
+}
+
+template <typename RecordType>
+const uint8_t* OverlayTransportMessageView<RecordType>::enclosed_bytes() const {
+    // A serialized ByteBody is its type, then the vector's int element count, then the bytes
+    return message_bytes.get() + enclosed_body_offset() + sizeof(MessageBodyType) + sizeof(int);
+}
+
+template <typename RecordType>
+std::size_t OverlayTransportMessageView<RecordType>::enclosed_bytes_size() const {
+    return read_field<int>(enclosed_body_offset() + sizeof(MessageBodyType));
+}
+
+template <typename RecordType>
+std::shared_ptr<OverlayMessage<RecordType>> OverlayTransportMessageView<RecordType>::materialize_body(
+        std::shared_ptr<MessageBody<RecordType>> enclosed_body) const {
+    std::shared_ptr<OverlayMessage<RecordType>> body;
+    if(body_type() == MessageBodyType::PATH_OVERLAY) {
+        // The PathOverlayMessage constructor takes the destination as the first element of the path
+        std::list<int> path = remaining_path();
+        path.push_front(destination());
+        body = std::make_shared<PathOverlayMessage<RecordType>>(query_num(), path, std::move(enclosed_body));
+    } else {
+        body = std::make_shared<OverlayMessage<RecordType>>(query_num(), destination(), std::move(enclosed_body));
+    }
+    body->flood = flood();
+    return body;
+}
+
+template <typename RecordType>
+std::unique_ptr<OverlayTransportMessage<RecordType>> OverlayTransportMessageView<RecordType>::materialize() const {
+    return mutils::from_bytes<OverlayTransportMessage<RecordType>>(nullptr, message_bytes.get());
+}
+
+template <typename RecordType>
+std::unique_ptr<OverlayTransportMessage<RecordType>> OverlayTransportMessageView<RecordType>::materialize_decrypted(
+        std::shared_ptr<MessageBody<RecordType>> decrypted_body) const {
+    // The body's is_encrypted flag defaults to false when it is constructed
+    return std::make_unique<OverlayTransportMessage<RecordType>>(sender_id(), sender_round(), is_final_message(),
+                                                                 materialize_body(std::move(decrypted_body)));
+}
+
+template <typename RecordType>
+std::ostream& operator<<(std::ostream& out, const OverlayTransportMessageView<RecordType>& message) {
+    out << "{SenderRound=" << message.sender_round() << "|Final=" << std::boolalpha << message.is_final_message()
+        << "|{QueryNum=" << message.query_num() << "|Destination=" << message.destination() << "|Body=";
+    if(!message.has_enclosed_body()) {
+        out << "null";
+    } else if(message.is_encrypted()) {
+        out << "<" << message.enclosed_bytes_size() << " encrypted bytes>";
+    } else {
+        out << "<serialized type " << static_cast<int16_t>(message.enclosed_body_type()) << ">";
+    }
+    out << "}}";
+    return out;
+}
+
+}  // namespace messaging
+}  // namespace adq
@@ -58,6 +58,18 @@ void OverlayTransportMessage<RecordType>::post_object(const std::function<void(c
     Message<RecordType>::post_object(function);
 }
 
+template <typename RecordType>
+void OverlayTransportMessage<RecordType>::gather_bytes(util::FramedSendBuffer& buffer) const {
+    // The header fields, including Message's sender_id, then the OverlayMessage body
+    uint8_t* header = buffer.append(mutils::bytes_size(type) + mutils::bytes_size(sender_round)
+                                    + mutils::bytes_size(is_final_message) + mutils::bytes_size(this->sender_id));
+    std::size_t bytes_written = mutils::to_bytes(type, header);
+    bytes_written += mutils::to_bytes(sender_round, header + bytes_written);
+    bytes_written += mutils::to_bytes(is_final_message, header + bytes_written);
+    bytes_written += mutils::to_bytes(this->sender_id, header + bytes_written);
+    get_body()->gather_bytes(buffer);
+}
+
 template <typename RecordType>
 std::unique_ptr<OverlayTransportMessage<RecordType>> OverlayTransportMessage<RecordType>::from_bytes(mutils::DeserializationManager* m, const uint8_t* buffer) {
     std::size_t bytes_read = 0;
@@ -37,6 +37,14 @@ std::size_t PathOverlayMessage<RecordType>::to_bytes(uint8_t* buffer) const {
     return bytes_written;
 }
 
+template <typename RecordType>
+void PathOverlayMessage<RecordType>::gather_bytes(util::FramedSendBuffer& buffer) const {
+    uint8_t* header = buffer.append(mutils::bytes_size(type) + mutils::bytes_size(remaining_path));
+    std::size_t bytes_written = mutils::to_bytes(type, header);
+    mutils::to_bytes(remaining_path, header + bytes_written);
+    gather_bytes_common(buffer);
+}
+
 template <typename RecordType>
 void PathOverlayMessage<RecordType>::post_object(const std::function<void(const uint8_t* const, std::size_t)>& function) const {
     uint8_t buffer[bytes_size()];
@@ -19,17 +19,19 @@ const constexpr MessageType SignatureRequest<RecordType>::type;
 
 template<typename RecordType>
 std::size_t SignatureRequest<RecordType>::bytes_size() const {
-    return mutils::bytes_size(type) + Message<RecordType>::bytes_size();
+    return mutils::bytes_size(type) + mutils::bytes_size(query_num) + Message<RecordType>::bytes_size();
 }
 template<typename RecordType>
 std::size_t SignatureRequest<RecordType>::to_bytes(uint8_t* buffer) const {
     std::size_t bytes_written = mutils::to_bytes(type, buffer);
+    bytes_written += mutils::to_bytes(query_num, buffer + bytes_written);
     bytes_written += Message<RecordType>::to_bytes(buffer + bytes_written);
     return bytes_written;
 }
 template<typename RecordType>
 void SignatureRequest<RecordType>::post_object(const std::function<void(const uint8_t* const, std::size_t)>& function) const {
     mutils::post_object(function, type);
+    mutils::post_object(function, query_num);
     Message<RecordType>::post_object(function);
 }
 template<typename RecordType>
@@ -38,12 +40,15 @@ std::unique_ptr<SignatureRequest<RecordType>> SignatureRequest<RecordType>::from
     MessageType message_type;
     std::memcpy(&message_type, buffer + bytes_read, sizeof(MessageType));
     bytes_read += sizeof(MessageType);
+    int query_num;
+    std::memcpy(&query_num, buffer + bytes_read, sizeof(query_num));
+    bytes_read += sizeof(query_num);
 
     int sender_id;
     std::memcpy(&sender_id, buffer + bytes_read, sizeof(sender_id));
     bytes_read += sizeof(sender_id);
     std::shared_ptr<body_type> body_shared = mutils::from_bytes<body_type>(m, buffer + bytes_read);
-    return std::make_unique<SignatureRequest<RecordType>>(sender_id, body_shared);
+    return std::make_unique<SignatureRequest<RecordType>>(sender_id, query_num, body_shared);
 }
 
 template<typename RecordType>
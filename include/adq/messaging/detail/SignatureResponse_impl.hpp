@@ -26,12 +26,13 @@ std::ostream& operator<<(std::ostream& out, const SignatureResponse<RecordType>&
 
 template <typename RecordType>
 std::size_t SignatureResponse<RecordType>::bytes_size() const {
-    return mutils::bytes_size(type) + Message<RecordType>::bytes_size();
+    return mutils::bytes_size(type) + mutils::bytes_size(query_num) + Message<RecordType>::bytes_size();
 }
 
 template <typename RecordType>
 std::size_t SignatureResponse<RecordType>::to_bytes(uint8_t* buffer) const {
     std::size_t bytes_written = mutils::to_bytes(type, buffer);
+    bytes_written += mutils::to_bytes(query_num, buffer + bytes_written);
     bytes_written += Message<RecordType>::to_bytes(buffer + bytes_written);
     return bytes_written;
 }
@@ -39,6 +40,7 @@ std::size_t SignatureResponse<RecordType>::to_bytes(uint8_t* buffer) const {
 template <typename RecordType>
 void SignatureResponse<RecordType>::post_object(const std::function<void(const uint8_t* const, std::size_t)>& function) const {
     mutils::post_object(function, type);
+    mutils::post_object(function, query_num);
     Message<RecordType>::post_object(function);
 }
 
@@ -48,12 +50,15 @@ std::unique_ptr<SignatureResponse<RecordType>> SignatureResponse<RecordType>::fr
     MessageType message_type;
     std::memcpy(&message_type, buffer + bytes_read, sizeof(MessageType));
     bytes_read += sizeof(MessageType);
+    int query_num;
+    std::memcpy(&query_num, buffer + bytes_read, sizeof(query_num));
+    bytes_read += sizeof(query_num);
 
     int sender_id;
     std::memcpy(&sender_id, buffer + bytes_read, sizeof(int));
     bytes_read += sizeof(int);
     std::shared_ptr<body_type> body_shared = mutils::from_bytes<body_type>(m, buffer + bytes_read);
-    return std::make_unique<SignatureResponse<RecordType>>(sender_id, body_shared);
+    return std::make_unique<SignatureResponse<RecordType>>(sender_id, query_num, body_shared);
 }
 
 }  // namespace messaging
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace adq {
+namespace util {
+
+/**
+ * A process-wide pool of byte buffers for the network layer, so that the
+ * storage for frames being sent and received is recycled instead of being
+ * allocated and freed for every message.
+ *
+ * Buffers come in power-of-two size classes, from MIN_BUFFER_SIZE up to
+ * MAX_BUFFER_SIZE; a request is rounded up to the next class, and the
+ * returned vector's size() is the full size of its class. Each thread keeps
+ * a small cache of free buffers of each class (none, for the largest
+ * classes), which it can use without taking a lock, and exchanges buffers with a shared free list (under a
+ * per-class lock) when its cache runs empty or overflows. Since buffers are
+ * usually acquired on one thread and released on another (e.g. a frame is
+ * built by the protocol thread, then freed by the I/O thread that wrote it),
+ * the shared lists are what move buffers back to the threads that need them.
+ *
+ * Requests larger than MAX_BUFFER_SIZE are allocated and freed directly.
+ */
+class BufferPool {
+public:
+    using Buffer = std::vector<uint8_t>;
+
+    /** Counters describing the pool's memory use */
+    struct Metrics {
+        /** The bytes of pooled buffers that are currently handed out */
+        std::size_t bytes_in_use;
+        /** The largest value bytes_in_use has reached; this is the pool's high-water mark */
+        std::size_t peak_bytes_in_use;
+        /** The bytes of free buffers held in the shared free lists (not counting thread caches) */
+        std::size_t bytes_free;
+        /** The number of buffers that had to be allocated from the heap */
+        std::uint64_t heap_allocations;
+        /** The number of requests that were satisfied by a recycled buffer */
+        std::uint64_t reuses;
+    };
+
+    /** The size of the smallest class of buffers */
+    static constexpr std::size_t MIN_BUFFER_SIZE = 256;
+    /** The number of size classes; the largest is MIN_BUFFER_SIZE * 2^(NUM_SIZE_CLASSES - 1) */
+    static constexpr std::size_t NUM_SIZE_CLASSES = 17;
+    /** The size of the largest class of buffers (16 MiB) */
+    static constexpr std::size_t MAX_BUFFER_SIZE = MIN_BUFFER_SIZE << (NUM_SIZE_CLASSES - 1);
+    /** The most free buffers of each class that one thread keeps for itself */
+    static constexpr std::size_t THREAD_CACHE_SIZE = 8;
+    /**
+     * The most bytes of free buffers of each class that one thread keeps for
+     * itself, which limits the cache to fewer than THREAD_CACHE_SIZE buffers
+     * for large classes, and disables it for classes larger than this
+     */
+    static constexpr std::size_t MAX_THREAD_CACHE_BYTES_PER_CLASS = 1024 * 1024;
+    /** The most bytes of free buffers of each class kept in the shared free list; any more are freed */
+    static constexpr std::size_t MAX_FREE_BYTES_PER_CLASS = 16 * 1024 * 1024;
+
+private:
+    struct SizeClass {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<Buffer>> free_buffers;
+    };
+    /** A thread's private free buffers, which are given back to the pool when the thread exits */
+    struct ThreadCache {
+        std::array<std::vector<std::unique_ptr<Buffer>>, NUM_SIZE_CLASSES> free_buffers;
+        ~ThreadCache();
+    };
+    std::array<SizeClass, NUM_SIZE_CLASSES> size_classes;
+    std::atomic<std::size_t> bytes_in_use;
+    std::atomic<std::size_t> peak_bytes_in_use;
+    std::atomic<std::size_t> bytes_free;
+    std::atomic<std::uint64_t> heap_allocations;
+    std::atomic<std::uint64_t> reuses;
+
+    BufferPool();
+    static ThreadCache& thread_cache();
+    /** @return The most free buffers of a size class that one thread's cache may hold */
+    static constexpr std::size_t thread_cache_capacity(std::size_t size_class) {
+        return std::min(THREAD_CACHE_SIZE, MAX_THREAD_CACHE_BYTES_PER_CLASS / (MIN_BUFFER_SIZE << size_class));
+    }
+    /** Returns a buffer to the calling thread's cache, or to the shared free list if the cache is full */
+    void release(Buffer* buffer);
+    /** Moves buffers from a thread cache to the shared free list of their class */
+    void give_back(std::size_t size_class, std::vector<std::unique_ptr<Buffer>>& buffers, std::size_t count);
+
+public:
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    static BufferPool& getInstance();
+
+    /**
+     * Gets a buffer of at least the requested size. Its contents are
+     * unspecified. The buffer returns to the pool when the last copy of the
+     * pointer is destroyed, on whichever thread that happens.
+     *
+     * @param min_size The minimum number of bytes needed
+     * @return A buffer whose size() is the size of the smallest class that
+     * can hold min_size bytes (or exactly min_size, if that is larger than
+     * MAX_BUFFER_SIZE)
+     */
+    std::shared_ptr<Buffer> acquire(std::size_t min_size);
+
+    /** @return A snapshot of the pool's counters */
+    Metrics get_metrics() const;
+
+    /**
+     * @param size A buffer size
+     * @return The index of the smallest size class that can hold that many bytes
+     */
+    static std::size_t size_class_for(std::size_t size);
+};
+
+}  // namespace util
+}  // namespace adq
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "BufferPool.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace adq {
+namespace util {
+
+/**
+ * A reusable receive buffer for a stream connection that carries a sequence
+ * of length-prefixed frames, where each frame is a std::size_t header giving
+ * the length of the body followed by that many bytes of body. Bytes are read
+ * from the socket directly into the free space at the end of the buffer, and
+ * complete frames are parsed out of the front of the buffer without copying.
+ * Any partial frame left over after parsing is moved back to the start of the
+ * buffer when more space is needed, so the same storage can be used for the
+ * entire lifetime of a connection.
+ *
+ * The storage is reference-counted, so a frame can outlive the next read by
+ * holding the pointer returned by share_frame(). While any such reference is
+ * outstanding, prepare() moves the connection on to fresh storage rather than
+ * overwriting bytes that are still in use. The storage comes from the
+ * BufferPool, and goes back to it once the last frame in it is released.
+ *
+ * A frame, including its header, must fit in the BufferPool's largest
+ * buffer. The header comes from the peer, so a larger length is treated as
+ * a corrupt stream: next_frame() stops returning frames, and
+ * has_oversized_frame() reports it so the connection can be closed.
+ */
+class FramedReceiveBuffer {
+public:
+    /** The type of the length header at the start of each frame. */
+    using frame_size_t = std::size_t;
+    /** The amount of space allocated for a new buffer. */
+    static constexpr std::size_t DEFAULT_CAPACITY = 64 * 1024;
+    /** The minimum amount of free space that prepare() will make available for a read. */
+    static constexpr std::size_t MIN_READ_SIZE = 4 * 1024;
+    /** The largest frame body that will be accepted */
+    static constexpr std::size_t MAX_FRAME_SIZE = BufferPool::MAX_BUFFER_SIZE - sizeof(frame_size_t);
+
+private:
+    std::shared_ptr<std::vector<uint8_t>> buffer;
+    /** The offset of the first byte that has not yet been parsed into a frame */
+    std::size_t read_offset;
+    /** The offset of the first byte of free space after the received data */
+    std::size_t write_offset;
+
+public:
+    FramedReceiveBuffer(std::size_t initial_capacity = DEFAULT_CAPACITY);
+
+    /**
+     * Makes room at the end of the buffer for another read from the socket,
+     * moving any unparsed bytes to the front of the buffer or growing the
+     * buffer if necessary. If the unparsed bytes contain the header of a frame,
+     * enough space will be made for the entire frame to be received at once.
+     * Calling this invalidates any pointers previously returned by next_frame(),
+     * unless they were passed to share_frame().
+     *
+     * @return A pointer to the start of the free space in the buffer
+     */
+    uint8_t* prepare();
+    /**
+     * @return The number of bytes of free space available at the pointer
+     * returned by the most recent call to prepare().
+     */
+    std::size_t free_space() const { return buffer->size() - write_offset; }
+    /**
+     * Records that some bytes have been written into the free space returned
+     * by prepare(), so that they will be considered by next_frame().
+     *
+     * @param bytes_received The number of bytes written into the buffer
+     */
+    void commit(std::size_t bytes_received);
+    /**
+     * Checks whether a complete frame has been received, and if so, consumes
+     * it from the buffer and returns the location of its body. The returned
+     * pointer remains valid until the next call to prepare() or clear().
+     *
+     * @param frame_body Will be set to point to the body of the frame, if there is one
+     * @param frame_size Will be set to the size of the frame body, if there is one
+     * @return True if a complete frame was found, false if more bytes must be received
+     */
+    bool next_frame(const uint8_t*& frame_body, std::size_t& frame_size);
+    /**
+     * @return True if the next unparsed frame's header gives a length larger
+     * than MAX_FRAME_SIZE, which means no more frames can be parsed
+     */
+    bool has_oversized_frame() const;
+    /**
+     * Extends the lifetime of a frame returned by next_frame() beyond the next
+     * call to prepare(). The returned pointer shares ownership of the buffer's
+     * current storage, so the frame's bytes will not be overwritten or freed
+     * until it (and any copies of it) are destroyed.
+     *
+     * @param frame_body A pointer returned by the most recent call to next_frame()
+     * @return An owning pointer to the same bytes
+     */
+    std::shared_ptr<const uint8_t> share_frame(const uint8_t* frame_body) const;
+    /** @return The number of received bytes that have not yet been parsed into a frame */
+    std::size_t bytes_buffered() const { return write_offset - read_offset; }
+    /** Discards any buffered bytes, e.g. because the connection was reset. */
+    void clear();
+};
+
+}  // namespace util
+}  // namespace adq
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "BufferPool.hpp"
+
+#include <asio.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace adq {
+namespace util {
+
+/**
+ * An outgoing length-prefixed frame, in the same format that is parsed by
+ * FramedReceiveBuffer, that is assembled as a sequence of buffers rather than
+ * one contiguous array. Small fields are copied into a scratch area owned by
+ * the FramedSendBuffer, while large byte arrays (such as encrypted message
+ * bodies) can be referenced in place, so they are not copied before being
+ * handed to the socket in a single gathered write. Any objects that own
+ * referenced storage should be passed to retain() so they stay alive until
+ * the write completes.
+ *
+ * The scratch area is a BufferPool buffer, and FramedSendBuffers made with
+ * create() are recycled once the last reference to them is dropped, so
+ * sending a frame does not need to allocate anything in the steady state.
+ */
+class FramedSendBuffer {
+public:
+    /** The type of the length header at the start of each frame. */
+    using frame_size_t = std::size_t;
+    /** Byte arrays smaller than this are copied into the scratch area rather than referenced. */
+    static constexpr std::size_t MIN_REFERENCE_SIZE = 256;
+    /** The most unused FramedSendBuffers kept for reuse by create() */
+    static constexpr std::size_t MAX_RECYCLED_BUFFERS = 256;
+
+private:
+    /**
+     * One piece of the frame. If data is null, the segment is a range of the
+     * scratch area starting at scratch_offset; otherwise, it is external storage.
+     */
+    struct Segment {
+        const uint8_t* data;
+        std::size_t scratch_offset;
+        std::size_t length;
+    };
+    std::shared_ptr<BufferPool::Buffer> scratch;
+    /** The number of bytes of scratch that are in use; the rest of it is free space */
+    std::size_t scratch_size;
+    std::vector<Segment> segments;
+    /** The buffer sequence built by finish(), which points into scratch and the referenced storage */
+    std::vector<asio::const_buffer> buffer_sequence;
+    std::vector<std::shared_ptr<const void>> retained_objects;
+    std::size_t total_size;
+
+    /** Empties this frame so it can be reused, keeping the capacity of its segment lists */
+    void reset(std::size_t scratch_capacity);
+    /** Resets a FramedSendBuffer made by create() and keeps it for reuse, or deletes it if enough are kept already */
+    static void recycle(FramedSendBuffer* send_buffer);
+
+public:
+    /**
+     * Constructs an empty frame, with space reserved for the length header.
+     *
+     * @param scratch_capacity The number of bytes to preallocate for the scratch area
+     */
+    FramedSendBuffer(std::size_t scratch_capacity = 0);
+
+    /**
+     * Gets an empty frame, reusing one that was made by an earlier call and
+     * has since been released if there is one.
+     *
+     * @param scratch_capacity The number of bytes to preallocate for the scratch area
+     * @return A new or recycled FramedSendBuffer, which will be recycled when
+     * the last copy of the pointer is destroyed
+     */
+    static std::shared_ptr<FramedSendBuffer> create(std::size_t scratch_capacity = 0);
+
+    /**
+     * Adds space for some bytes to the end of the frame, in the scratch area.
+     * The returned pointer remains valid only until the next call to append().
+     *
+     * @param num_bytes The number of bytes to add
+     * @return A pointer to the new bytes, which the caller should fill in
+     */
+    uint8_t* append(std::size_t num_bytes);
+    /**
+     * Adds a byte array to the end of the frame by reference, or by copying it
+     * into the scratch area if it is smaller than MIN_REFERENCE_SIZE. The
+     * referenced bytes must not be modified or freed until the frame is sent.
+     *
+     * @param data A pointer to the bytes to add
+     * @param num_bytes The number of bytes to add
+     */
+    void append_reference(const uint8_t* data, std::size_t num_bytes);
+    /**
+     * Keeps an object alive for as long as this FramedSendBuffer exists; used
+     * to hold on to the owners of any storage passed to append_reference().
+     */
+    void retain(std::shared_ptr<const void> object);
+    /** @return The number of bytes in the frame body, not including the header */
+    std::size_t body_size() const { return total_size - sizeof(frame_size_t); }
+    /**
+     * Writes the length header and returns the buffer sequence for the entire
+     * frame. Nothing more should be appended after calling this.
+     *
+     * @return A sequence of buffers that can be passed to asio::async_write
+     */
+    const std::vector<asio::const_buffer>& finish();
+    /** @return The buffer sequence built by the last call to finish() */
+    const std::vector<asio::const_buffer>& buffers() const { return buffer_sequence; }
+    /** @return The total number of bytes in the frame, including the header */
+    std::size_t size() const { return total_size; }
+};
+
+}  // namespace util
+}  // namespace adq
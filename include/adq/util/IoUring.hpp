@@ -0,0 +1,119 @@
+#pragma once
+
+/* io_uring is only available on Linux, and only if the kernel headers are new
+ * enough to declare it. Define ADQ_DISABLE_IO_URING to leave it out entirely. */
+#if defined(__linux__) && __has_include(<linux/io_uring.h>) && !defined(ADQ_DISABLE_IO_URING)
+#define ADQ_HAS_IO_URING 1
+#endif
+
+#ifdef ADQ_HAS_IO_URING
+
+#include <linux/io_uring.h>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace adq {
+namespace util {
+
+/**
+ * A minimal wrapper around a Linux io_uring instance, using the raw system
+ * calls so that it does not depend on liburing. It maps the submission and
+ * completion queues, hands out submission queue entries to fill in, and
+ * submits every entry that has been filled in with a single system call.
+ *
+ * This class is not thread-safe; all of its methods must be called by the
+ * same thread (or strand).
+ */
+class IoUring {
+private:
+    int ring_fd;
+    /* Pointers into the mapped submission queue */
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_ring_mask;
+    unsigned* sq_array;
+    io_uring_sqe* sqes;
+    /* Pointers into the mapped completion queue */
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_ring_mask;
+    io_uring_cqe* cqes;
+    /* The mappings, so they can be unmapped */
+    void* sq_mapping;
+    std::size_t sq_mapping_size;
+    void* cq_mapping;
+    std::size_t cq_mapping_size;
+    std::size_t sqes_mapping_size;
+    unsigned sq_entries;
+    /** The tail of the submission queue including entries that have not been submitted yet */
+    unsigned local_sq_tail;
+    /** The number of entries that have been filled in since the last submit() */
+    unsigned num_unsubmitted;
+
+public:
+    /**
+     * Creates an io_uring instance and maps its queues.
+     *
+     * @param entries The minimum number of submission queue entries
+     * @throws std::system_error if the kernel does not support io_uring, or
+     * if the process is not allowed to use it
+     */
+    explicit IoUring(unsigned entries);
+    ~IoUring();
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    /**
+     * Gets the next free submission queue entry, cleared to zero, which will
+     * be submitted by the next call to submit().
+     *
+     * @return A pointer to the entry, or null if the submission queue is full
+     */
+    io_uring_sqe* get_sqe();
+
+    /**
+     * Submits every entry that has been filled in since the last call, with
+     * one system call.
+     *
+     * @return The number of entries submitted, or a negative errno value if
+     * the kernel could not accept them right now (e.g. -EBUSY if the
+     * completion queue is overflowing), in which case they stay queued
+     */
+    int submit();
+
+    /** @return The number of entries that have been filled in but not submitted */
+    unsigned pending_submissions() const { return num_unsubmitted; }
+
+    /**
+     * Calls a function on each completion queue entry that is available, in
+     * order, then marks them all as consumed.
+     *
+     * @param handle_completion A function that takes a const io_uring_cqe&
+     * @return The number of completions handled
+     */
+    template <typename Function>
+    unsigned for_each_completion(Function&& handle_completion) {
+        unsigned head = *cq_head;
+        const unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        unsigned num_completions = 0;
+        for(; head != tail; ++head, ++num_completions) {
+            handle_completion(cqes[head & *cq_ring_mask]);
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        return num_completions;
+    }
+
+    /**
+     * Registers an eventfd that the kernel will signal whenever it posts a
+     * completion, so the completion queue can be watched by an event loop.
+     *
+     * @throws std::system_error if the eventfd could not be registered
+     */
+    void register_eventfd(int event_fd);
+};
+
+}  // namespace util
+}  // namespace adq
+
+#endif  // ADQ_HAS_IO_URING
@@ -33,8 +33,9 @@ private:
     /** Semaphore used by the timer signal handler to safely tell the
      * callback-executing thread that a timer has fired. */
     sem_t timers_fired_semaphore;
-    /** Synchronizes access to cancelled_timers between the callback-executing
-     * thread and cancel_timer(). */
+    /** Synchronizes access to cancelled_timers, timer_handles, timer_callbacks,
+     * and next_id between the callback-executing thread, register_timer(),
+     * and cancel_timer(), which may be called from any thread. */
     std::mutex cancelled_timers_mutex;
     /** Shuts down the callback-executing thread when true. */
     std::atomic<bool> thread_shutdown;
@@ -9,6 +9,8 @@ namespace util {
 /**
  * Calculates the gossip target for a node in the given round by evaluating
  * g(i,t) = i + 2^t mod N, where N is the number of nodes in the system.
+ * This looks up the shared OverlaySchedule for N on every call; code that
+ * computes many targets should get the schedule once and use it directly.
  *
  * @param source_id The ID of the source node.
  * @param round The current round number (time)
@@ -20,6 +22,7 @@ int gossip_target(const int source_id, const int round, const int group_size);
 /**
  * Calculates the predecessor of a node in the overlay graph by evaluating
  * g^-1(j,t) = j - 2^t mod N, where N is the number of nodes in the system.
+ * Like gossip_target, this looks up the shared OverlaySchedule for N.
  *
  * @param target_id The ID of the target node
  * @param round The current round number (time)
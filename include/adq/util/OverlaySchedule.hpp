@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace adq {
+namespace util {
+
+/**
+ * A precomputed table of the gossip overlay's schedule for a system of a
+ * given size, so that gossip_target and gossip_predecessor are an array
+ * lookup instead of a modular exponentiation.
+ *
+ * In round t, node i sends to i + 2^t mod N. The sequence 2^t mod N is
+ * eventually periodic: after at most log2(N) rounds it enters a cycle of at
+ * most N values, so storing one pass through that cycle gives the offset for
+ * every round. A negative round (which can only come from a faulty peer) is
+ * taken as the unsigned 32-bit exponent it converts to, which is what the
+ * modular exponentiation this replaced computed, so that all nodes still
+ * agree on its target.
+ *
+ * A schedule never changes once it is built, so the shared instance returned
+ * by for_num_nodes() can be used from any thread without locking.
+ */
+class OverlaySchedule {
+private:
+    const int num_nodes;
+    /** offsets[t] = 2^t mod num_nodes, for every round up to the end of the first pass through the cycle */
+    std::vector<int> offsets;
+    /** The first round that is part of the cycle */
+    int cycle_start;
+    /** The number of rounds in the cycle */
+    int cycle_length;
+
+public:
+    /**
+     * Builds the schedule for a system of the given size.
+     * @param num_nodes The total number of nodes in the system
+     */
+    explicit OverlaySchedule(int num_nodes);
+
+    /**
+     * Gets the process-wide schedule for a system of the given size, building
+     * it the first time it is requested. The returned reference remains valid
+     * for the rest of the program.
+     * @param num_nodes The total number of nodes in the system
+     * @return The shared schedule for that size
+     */
+    static const OverlaySchedule& for_num_nodes(int num_nodes);
+
+    int get_num_nodes() const { return num_nodes; }
+
+    /**
+     * @param round A round number
+     * @return 2^round mod N, where a negative round is converted to uint32_t
+     */
+    int offset(int round) const {
+        if(round >= 0 && round < static_cast<int>(offsets.size())) {
+            return offsets[round];
+        }
+        // Every exponent outside the table is in the cycle
+        const std::uint64_t exponent = static_cast<std::uint32_t>(round);
+        return offsets[cycle_start + (exponent - cycle_start) % cycle_length];
+    }
+
+    /**
+     * @param source_id The ID of the source node
+     * @param round The round number
+     * @return The ID of the node that source_id sends to in that round
+     */
+    int gossip_target(int source_id, int round) const {
+        const int target = source_id + offset(round);
+        return target >= num_nodes ? target - num_nodes : target;
+    }
+
+    /**
+     * @param target_id The ID of the target node
+     * @param round The round number
+     * @return The ID of the node that sends to target_id in that round
+     */
+    int gossip_predecessor(int target_id, int round) const {
+        const int source = target_id - offset(round);
+        return source < 0 ? source + num_nodes : source;
+    }
+};
+
+}  // namespace util
+}  // namespace adq
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace adq {
+namespace util {
+
+/**
+ * A single-producer, single-consumer byte ring buffer in a POSIX shared
+ * memory segment, which lets two processes on the same host stream bytes to
+ * each other without going through the kernel. The writer and the reader
+ * each advance their own position counter, so neither ever takes a lock.
+ *
+ * The ring only moves bytes; it does not block or notify. Each side can set
+ * a "waiting" flag before it goes to sleep on some other notification
+ * channel, so the other side knows to wake it after it makes progress.
+ */
+class SharedMemoryRing {
+private:
+    /** The layout of the start of the shared memory segment; the ring's data follows it */
+    struct Header {
+        /** The total number of bytes ever written; only modified by the writer */
+        std::atomic<std::uint64_t> write_position;
+        /** The total number of bytes ever read; only modified by the reader */
+        std::atomic<std::uint64_t> read_position;
+        std::atomic<bool> reader_waiting;
+        std::atomic<bool> writer_waiting;
+        std::uint64_t capacity;
+    };
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free && std::atomic<bool>::is_always_lock_free,
+                  "Shared-memory atomics must be lock-free to work across processes");
+
+    std::string name;
+    Header* header;
+    uint8_t* data;
+    std::size_t mapped_size;
+    /**
+     * A private copy of the ring's capacity, checked against the mapped size
+     * when the ring is opened, so the other process can't make this one read
+     * or write past the end of the mapping by changing the header.
+     */
+    const std::size_t capacity;
+
+    SharedMemoryRing(const std::string& name, void* mapping, std::size_t mapped_size, std::size_t capacity);
+
+public:
+    ~SharedMemoryRing();
+    SharedMemoryRing(const SharedMemoryRing&) = delete;
+    SharedMemoryRing& operator=(const SharedMemoryRing&) = delete;
+
+    /**
+     * Creates a new, empty ring in a shared memory segment, replacing any
+     * existing segment with the same name.
+     *
+     * @param name The name of the segment, which must start with a '/'
+     * @param capacity The number of bytes the ring can hold
+     * @throws std::system_error if the segment could not be created
+     */
+    static std::unique_ptr<SharedMemoryRing> create(const std::string& name, std::size_t capacity);
+    /**
+     * Maps a ring that was created by another process.
+     *
+     * @param name The name the ring was created with
+     * @throws std::system_error if the segment could not be opened, or if
+     * its header gives a capacity that doesn't fit in the segment
+     */
+    static std::unique_ptr<SharedMemoryRing> open(const std::string& name);
+    /**
+     * Removes the ring's name from the system, so no other process can open
+     * it. The memory stays mapped until both sides have destroyed their
+     * SharedMemoryRing objects.
+     */
+    void unlink();
+
+    /**
+     * Copies as many bytes as will fit into the ring. Must only be called by the writer.
+     * @return The number of bytes written, which may be less than num_bytes if the ring is full
+     */
+    std::size_t write(const uint8_t* bytes, std::size_t num_bytes);
+    /**
+     * Copies as many bytes as are available out of the ring. Must only be called by the reader.
+     * @return The number of bytes read, which may be less than max_bytes if the ring is empty
+     */
+    std::size_t read(uint8_t* buffer, std::size_t max_bytes);
+    /** @return The number of bytes that have been written but not yet read, which is at most the capacity */
+    std::size_t bytes_available() const;
+    /** @return The number of bytes that can be written before the ring is full */
+    std::size_t free_space() const { return capacity - bytes_available(); }
+
+    /** Called by the reader before it waits for a notification that more bytes are available. */
+    void set_reader_waiting(bool waiting) { header->reader_waiting.store(waiting); }
+    /**
+     * Called by the writer after writing, to find out whether the reader needs to be woken up.
+     * @return True if the reader was waiting; the flag is cleared
+     */
+    bool take_reader_waiting() { return header->reader_waiting.exchange(false); }
+    /** Called by the writer before it waits for a notification that space has been freed. */
+    void set_writer_waiting(bool waiting) { header->writer_waiting.store(waiting); }
+    /**
+     * Called by the reader after reading, to find out whether the writer needs to be woken up.
+     * @return True if the writer was waiting; the flag is cleared
+     */
+    bool take_writer_waiting() { return header->writer_waiting.exchange(false); }
+};
+
+}  // namespace util
+}  // namespace adq
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace adq {
+namespace util {
+
+/**
+ * A fixed-size pool of threads for splitting CPU-heavy work, such as public-key
+ * encryption, into independent pieces that run at the same time.
+ *
+ * Work is submitted with parallel_for(), which blocks until every piece is
+ * done. The calling thread works on pieces too, so a pool with no threads
+ * simply runs everything on the caller, and a call never waits for a pool
+ * thread to become free before making progress.
+ */
+class WorkerPool {
+private:
+    std::vector<std::thread> workers;
+    std::mutex tasks_mutex;
+    std::condition_variable tasks_available;
+    std::deque<std::function<void()>> tasks;
+    /** Set by the destructor to tell the workers to exit */
+    bool shutting_down;
+    void worker_main();
+
+public:
+    /**
+     * @param num_threads The number of threads to start, in addition to the
+     * threads that will call parallel_for()
+     */
+    explicit WorkerPool(std::size_t num_threads);
+    ~WorkerPool();
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    std::size_t get_num_threads() const { return workers.size(); }
+
+    /**
+     * Calls body(i) for every i from 0 to count - 1, spread across the pool's
+     * threads and the calling thread, and returns once all the calls have
+     * finished. The calls may run in any order, and at the same time, so body
+     * must be safe to call concurrently with different indices.
+     * @param count The number of pieces of work
+     * @param body The function that does one piece of work
+     * @throws Whatever the first call to body that threw an exception threw,
+     * after all the other calls have finished
+     */
+    void parallel_for(std::size_t count, const std::function<void(std::size_t)>& body);
+};
+
+}  // namespace util
+}  // namespace adq
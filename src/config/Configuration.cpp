@@ -26,6 +26,23 @@ const std::string Configuration::SERVER_PUBLIC_KEY_FILE = "server_key_file";
 const std::string Configuration::CLIENT_LIST_FILE = "client_list_file";
 const std::string Configuration::CLIENT_KEYS_FOLDER = "client_keys_folder";
 const std::string Configuration::CLIENT_KEY_FILE_PREFIX = "client_key_file_prefix";
+const std::string Configuration::NUM_NETWORK_THREADS = "num_network_threads";
+const std::string Configuration::NUM_CRYPTO_THREADS = "num_crypto_threads";
+const std::string Configuration::MAX_OPEN_CONNECTIONS = "max_open_connections";
+const std::string Configuration::CONNECTION_IDLE_TIMEOUT = "connection_idle_timeout_ms";
+const std::string Configuration::UDP_CONTROL_MESSAGES = "udp_control_messages";
+const std::string Configuration::UDP_RETRY_INTERVAL = "udp_retry_interval_ms";
+const std::string Configuration::LOCAL_TRANSPORT_DIR = "local_transport_dir";
+const std::string Configuration::SHARED_MEMORY_RING_SIZE = "shared_memory_ring_size";
+const std::string Configuration::USE_IO_URING = "use_io_uring";
+const std::string Configuration::PEER_SEND_BUDGET = "peer_send_budget_bytes";
+const std::string Configuration::TOTAL_SEND_BUDGET = "total_send_budget_bytes";
+const std::string Configuration::SEND_BUDGET_POLICY = "send_budget_policy";
+const std::string Configuration::SEND_BLOCK_TIMEOUT = "send_block_timeout_ms";
+const std::string Configuration::FAULT_INJECTION_FILE = "fault_injection_file";
+const std::string Configuration::FAULT_INJECTION_SEED = "fault_injection_seed";
+const std::string Configuration::MAX_CONCURRENT_QUERIES = "max_concurrent_queries";
+const std::string Configuration::FUTURE_ROUND_HORIZON = "future_round_horizon";
 
 std::atomic<int> Configuration::initialize_state = 0;
 
@@ -117,6 +134,14 @@ char Configuration::getChar(const std::string& section, const std::string& key)
 
 std::map<int, asio::ip::tcp::endpoint> read_ip_map_from_file(const std::string& client_list_file) {
     std::map<int, asio::ip::tcp::endpoint> meter_ips_by_id;
+    for(const auto& id_address_pair : read_peer_list_from_file(client_list_file)) {
+        meter_ips_by_id.emplace(id_address_pair.first, id_address_pair.second.endpoint);
+    }
+    return meter_ips_by_id;
+}
+
+std::map<int, PeerAddress> read_peer_list_from_file(const std::string& client_list_file) {
+    std::map<int, PeerAddress> peers_by_id;
 
     std::ifstream ip_table_stream(client_list_file);
     std::string line;
@@ -125,15 +150,28 @@ std::map<int, asio::ip::tcp::endpoint> read_ip_map_from_file(const std::string&
         int meter_id;
         std::string ip_address_string;
         int port_num;
+        std::string transport_name;
         // ID and IP address are just separated by a space, so we can use the standard stream extractor
         id_ip_entry >> meter_id;
         id_ip_entry >> ip_address_string;
         id_ip_entry >> port_num;
+        // The transport column is optional, and leaves transport_name empty if it is missing
+        id_ip_entry >> transport_name;
+        TransportType transport;
+        if(transport_name.empty() || transport_name == "tcp") {
+            transport = TransportType::TCP;
+        } else if(transport_name == "unix") {
+            transport = TransportType::UNIX;
+        } else if(transport_name == "shm") {
+            transport = TransportType::SHARED_MEMORY;
+        } else {
+            throw std::invalid_argument("Unknown transport \"" + transport_name + "\" for client " + std::to_string(meter_id));
+        }
         asio::ip::address ip_address = asio::ip::make_address(ip_address_string);
-        meter_ips_by_id.emplace(meter_id, asio::ip::tcp::endpoint(ip_address, port_num));
+        peers_by_id.emplace(meter_id, PeerAddress{asio::ip::tcp::endpoint(ip_address, port_num), transport});
     }
 
-    return meter_ips_by_id;
+    return peers_by_id;
 }
 
 std::map<int, std::string> make_client_key_paths(const std::string& client_keys_folder, int num_clients) {
@@ -0,0 +1,160 @@
+#include "adq/core/FailureDetector.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace adq {
+
+constexpr std::size_t FailureDetector::HISTORY_SIZE;
+constexpr std::size_t FailureDetector::MIN_SAMPLES;
+constexpr double FailureDetector::PHI_THRESHOLD;
+constexpr std::chrono::milliseconds FailureDetector::MIN_INTERVAL_STDDEV;
+constexpr std::chrono::seconds FailureDetector::PROBE_EXPIRY;
+
+FailureDetector::FailureDetector(std::chrono::milliseconds default_round_trip_time, int lowest_peer_id, int highest_peer_id)
+    : default_round_trip_time(default_round_trip_time),
+      lowest_peer_id(lowest_peer_id),
+      highest_peer_id(highest_peer_id) {}
+
+bool FailureDetector::is_known_peer(int peer_id) const {
+    return peer_id >= lowest_peer_id && peer_id <= highest_peer_id;
+}
+
+void FailureDetector::add_sample(std::deque<clock_type::duration>& history, clock_type::duration sample) {
+    if(history.size() == HISTORY_SIZE) {
+        history.pop_front();
+    }
+    history.push_back(sample);
+}
+
+FailureDetector::clock_type::duration FailureDetector::percentile_of(std::deque<clock_type::duration> samples, double fraction) {
+    const std::size_t rank = std::min(samples.size(), std::max<std::size_t>(1, std::ceil(fraction * samples.size()))) - 1;
+    std::nth_element(samples.begin(), samples.begin() + rank, samples.end());
+    return samples[rank];
+}
+
+void FailureDetector::record_probe_sent(int peer_id) {
+    if(!is_known_peer(peer_id)) {
+        return;
+    }
+    const auto now = clock_type::now();
+    std::lock_guard<std::mutex> lock(histories_mutex);
+    PeerHistory& history = peer_histories[peer_id];
+    if(!history.has_probe_outstanding || now - history.probe_sent_time > PROBE_EXPIRY) {
+        history.probe_sent_time = now;
+        history.has_probe_outstanding = true;
+    }
+}
+
+void FailureDetector::record_probe_answered(int peer_id) {
+    answer_probe(peer_id, true);
+}
+
+void FailureDetector::record_response(int peer_id) {
+    answer_probe(peer_id, false);
+}
+
+void FailureDetector::answer_probe(int peer_id, bool shared_sample) {
+    if(!is_known_peer(peer_id)) {
+        return;
+    }
+    const auto now = clock_type::now();
+    std::lock_guard<std::mutex> lock(histories_mutex);
+    PeerHistory& history = peer_histories[peer_id];
+    if(history.has_probe_outstanding && now - history.probe_sent_time <= PROBE_EXPIRY) {
+        const auto round_trip_time = now - history.probe_sent_time;
+        add_sample(history.round_trip_times, round_trip_time);
+        add_sample(shared_sample ? all_round_trip_times : all_response_times, round_trip_time);
+    }
+    history.has_probe_outstanding = false;
+    if(history.has_arrived) {
+        add_sample(history.arrival_intervals, now - history.last_arrival);
+    }
+    history.last_arrival = now;
+    history.has_arrived = true;
+}
+
+void FailureDetector::record_arrival(int peer_id) {
+    if(!is_known_peer(peer_id)) {
+        return;
+    }
+    const auto now = clock_type::now();
+    std::lock_guard<std::mutex> lock(histories_mutex);
+    PeerHistory& history = peer_histories[peer_id];
+    if(history.has_arrived) {
+        add_sample(history.arrival_intervals, now - history.last_arrival);
+    }
+    history.last_arrival = now;
+    history.has_arrived = true;
+}
+
+double FailureDetector::phi(int peer_id) const {
+    const auto now = clock_type::now();
+    std::lock_guard<std::mutex> lock(histories_mutex);
+    auto history_iter = peer_histories.find(peer_id);
+    if(history_iter == peer_histories.end() || !history_iter->second.has_arrived
+       || history_iter->second.arrival_intervals.empty()) {
+        return 0;
+    }
+    const PeerHistory& history = history_iter->second;
+    using milliseconds_d = std::chrono::duration<double, std::milli>;
+    double mean = 0;
+    for(const auto& interval : history.arrival_intervals) {
+        mean += milliseconds_d(interval).count();
+    }
+    mean /= history.arrival_intervals.size();
+    double variance = 0;
+    for(const auto& interval : history.arrival_intervals) {
+        const double difference = milliseconds_d(interval).count() - mean;
+        variance += difference * difference;
+    }
+    variance /= history.arrival_intervals.size();
+    const double stddev = std::max(std::sqrt(variance), milliseconds_d(MIN_INTERVAL_STDDEV).count());
+    const double silence = milliseconds_d(now - history.last_arrival).count();
+    // A logistic approximation of the normal CDF (as used by Akka's detector), which stays accurate far into the tail
+    const double y = (silence - mean) / stddev;
+    const double e = std::exp(-y * (1.5976 + 0.070566 * y * y));
+    if(silence > mean) {
+        return -std::log10(e / (1.0 + e));
+    } else {
+        return -std::log10(1.0 - 1.0 / (1.0 + e));
+    }
+}
+
+FailureDetector::clock_type::duration FailureDetector::time_since_arrival(int peer_id) const {
+    std::lock_guard<std::mutex> lock(histories_mutex);
+    auto history_iter = peer_histories.find(peer_id);
+    if(history_iter == peer_histories.end() || !history_iter->second.has_arrived) {
+        return clock_type::duration::max();
+    }
+    return clock_type::now() - history_iter->second.last_arrival;
+}
+
+std::chrono::milliseconds FailureDetector::round_trip_percentile(int peer_id, double fraction) const {
+    std::unique_lock<std::mutex> lock(histories_mutex);
+    auto history_iter = peer_histories.find(peer_id);
+    if(history_iter == peer_histories.end() || history_iter->second.round_trip_times.size() < MIN_SAMPLES) {
+        lock.unlock();
+        return round_trip_percentile(fraction);
+    }
+    return std::chrono::ceil<std::chrono::milliseconds>(percentile_of(history_iter->second.round_trip_times, fraction));
+}
+
+std::chrono::milliseconds FailureDetector::round_trip_percentile(double fraction) const {
+    std::lock_guard<std::mutex> lock(histories_mutex);
+    if(all_round_trip_times.size() < MIN_SAMPLES) {
+        return std::chrono::ceil<std::chrono::milliseconds>(default_round_trip_time);
+    }
+    return std::chrono::ceil<std::chrono::milliseconds>(percentile_of(all_round_trip_times, fraction));
+}
+
+std::chrono::milliseconds FailureDetector::response_time_percentile(double fraction) const {
+    std::unique_lock<std::mutex> lock(histories_mutex);
+    if(all_response_times.size() < MIN_SAMPLES) {
+        lock.unlock();
+        return round_trip_percentile(fraction);
+    }
+    return std::chrono::ceil<std::chrono::milliseconds>(percentile_of(all_response_times, fraction));
+}
+
+}  // namespace adq
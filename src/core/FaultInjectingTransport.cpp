@@ -0,0 +1,227 @@
+#include "adq/core/FaultInjectingTransport.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+namespace adq {
+
+std::chrono::microseconds FaultProfile::sample_delay(std::mt19937_64& random_engine) const {
+    double delay_us = delay.count();
+    if(jitter.count() > 0) {
+        switch(distribution) {
+            case DelayDistribution::UNIFORM:
+                delay_us += std::uniform_real_distribution<double>(-jitter.count(), jitter.count())(random_engine);
+                break;
+            case DelayDistribution::NORMAL:
+                delay_us += std::normal_distribution<double>(0, jitter.count())(random_engine);
+                break;
+            case DelayDistribution::PARETO: {
+                // A shape of 3 gives a heavy tail with a finite variance; shifting by the scale keeps the mean at delay
+                const double shape = 3;
+                const double scale = jitter.count();
+                const double uniform = std::uniform_real_distribution<double>(0, 1)(random_engine);
+                delay_us += scale / std::pow(1 - uniform, 1 / shape) - scale * shape / (shape - 1);
+                break;
+            }
+        }
+    }
+    return std::chrono::microseconds(static_cast<std::int64_t>(std::max(0.0, delay_us)));
+}
+
+namespace {
+/** Applies one key=value setting from a rule to a profile */
+void apply_fault_setting(FaultProfile& profile, const std::string& key, const std::string& value) {
+    if(key == "delay_ms") {
+        profile.delay = std::chrono::microseconds(static_cast<std::int64_t>(std::stod(value) * 1000));
+    } else if(key == "jitter_ms") {
+        profile.jitter = std::chrono::microseconds(static_cast<std::int64_t>(std::stod(value) * 1000));
+    } else if(key == "distribution") {
+        if(value == "uniform") {
+            profile.distribution = FaultProfile::DelayDistribution::UNIFORM;
+        } else if(value == "normal") {
+            profile.distribution = FaultProfile::DelayDistribution::NORMAL;
+        } else if(value == "pareto") {
+            profile.distribution = FaultProfile::DelayDistribution::PARETO;
+        } else {
+            throw std::invalid_argument("Unknown delay distribution \"" + value + "\"");
+        }
+    } else if(key == "bandwidth_kbps") {
+        profile.bandwidth_bytes_per_second = std::stoull(value) * 1000 / 8;
+    } else if(key == "drop") {
+        profile.drop_probability = std::stod(value);
+    } else if(key == "reset") {
+        profile.reset_probability = std::stod(value);
+    } else {
+        throw std::invalid_argument("Unknown fault injection setting \"" + key + "\"");
+    }
+}
+}  // namespace
+
+std::map<int, FaultProfile> read_fault_profiles_from_file(const std::string& fault_file, int local_id,
+                                                          const std::vector<int>& peer_ids) {
+    std::ifstream fault_stream(fault_file);
+    if(!fault_stream) {
+        throw std::invalid_argument("Can't open fault injection file " + fault_file);
+    }
+    std::map<int, FaultProfile> profiles_by_peer;
+    std::string line;
+    while(std::getline(fault_stream, line)) {
+        std::istringstream rule(line);
+        std::string from_id;
+        std::string to_id;
+        if(!(rule >> from_id) || from_id[0] == '#') {
+            continue;
+        }
+        if(!(rule >> to_id)) {
+            throw std::invalid_argument("Fault injection rule has no destination: " + line);
+        }
+        if(from_id != "*" && std::stoi(from_id) != local_id) {
+            continue;
+        }
+        std::vector<std::pair<std::string, std::string>> settings;
+        std::string setting;
+        while(rule >> setting) {
+            const std::size_t equals = setting.find('=');
+            if(equals == std::string::npos) {
+                throw std::invalid_argument("Fault injection setting is not key=value: " + setting);
+            }
+            settings.emplace_back(setting.substr(0, equals), setting.substr(equals + 1));
+        }
+        for(const int peer_id : peer_ids) {
+            if(peer_id == local_id || (to_id != "*" && std::stoi(to_id) != peer_id)) {
+                continue;
+            }
+            FaultProfile& profile = profiles_by_peer[peer_id];
+            for(const auto& key_value : settings) {
+                apply_fault_setting(profile, key_value.first, key_value.second);
+            }
+        }
+    }
+    return profiles_by_peer;
+}
+
+FaultInjectingTransport::State::State(std::unique_ptr<Transport> inner, const FaultProfile& profile, std::uint64_t seed)
+    : inner(std::move(inner)),
+      profile(profile),
+      random_engine(seed),
+      transmit_timer(this->inner->get_executor()),
+      delivery_timer(this->inner->get_executor()),
+      delivery_in_progress(false),
+      close_requested(false),
+      closed(false) {}
+
+FaultInjectingTransport::FaultInjectingTransport(std::unique_ptr<Transport> inner, const FaultProfile& profile,
+                                                 std::uint64_t seed)
+    : state(std::make_shared<State>(std::move(inner), profile, seed)) {}
+
+FaultInjectingTransport::~FaultInjectingTransport() {
+    // Any deliveries still pending keep the state alive until they have gone out
+    asio::post(state->inner->get_executor(), [state = state]() {
+        if(!state->closed) {
+            state->close_requested = true;
+            if(state->pending_deliveries.empty() && !state->delivery_in_progress) {
+                close_now(state);
+            }
+        }
+    });
+}
+
+void FaultInjectingTransport::async_connect(ConnectHandler handler) {
+    state->inner->async_connect(std::move(handler));
+}
+
+void FaultInjectingTransport::async_read_some(asio::mutable_buffer buffer, IoHandler handler) {
+    state->inner->async_read_some(buffer, std::move(handler));
+}
+
+void FaultInjectingTransport::async_write(const std::vector<asio::const_buffer>& buffers, IoHandler handler) {
+    const std::size_t total_size = asio::buffer_size(buffers);
+    if(state->closed || state->delivery_error) {
+        const asio::error_code error = state->closed ? asio::error_code(asio::error::operation_aborted) : state->delivery_error;
+        asio::post(get_executor(), [handler, error]() { handler(error, 0); });
+        return;
+    }
+    std::uniform_real_distribution<double> coin(0, 1);
+    if(coin(state->random_engine) < state->profile.reset_probability) {
+        close_now(state);
+        asio::post(get_executor(), [handler]() { handler(asio::error::connection_reset, 0); });
+        return;
+    }
+    // The write occupies the simulated link for as long as its bytes take to transmit
+    const auto now = std::chrono::steady_clock::now();
+    const auto transmit_start = std::max(now, state->link_free_at);
+    std::chrono::steady_clock::duration transmit_time(0);
+    if(state->profile.bandwidth_bytes_per_second > 0) {
+        transmit_time = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(static_cast<double>(total_size) / state->profile.bandwidth_bytes_per_second));
+    }
+    state->link_free_at = transmit_start + transmit_time;
+    if(coin(state->random_engine) >= state->profile.drop_probability) {
+        // The caller may free its buffers once the write completes, so deliver a copy
+        auto bytes = util::BufferPool::getInstance().acquire(total_size);
+        asio::buffer_copy(asio::buffer(*bytes), buffers);
+        const auto deliver_at = std::max(state->link_free_at + state->profile.sample_delay(state->random_engine),
+                                         state->last_deliver_at);
+        state->last_deliver_at = deliver_at;
+        state->pending_deliveries.push_back({std::move(bytes), total_size, deliver_at});
+        if(!state->delivery_in_progress && state->pending_deliveries.size() == 1) {
+            deliver_next(state);
+        }
+    }
+    state->transmit_timer.expires_at(state->link_free_at);
+    state->transmit_timer.async_wait([handler, total_size](const asio::error_code&) {
+        handler(asio::error_code(), total_size);
+    });
+}
+
+void FaultInjectingTransport::deliver_next(const std::shared_ptr<State>& state) {
+    if(state->closed || state->pending_deliveries.empty()) {
+        if(state->close_requested) {
+            close_now(state);
+        }
+        return;
+    }
+    state->delivery_timer.expires_at(state->pending_deliveries.front().deliver_at);
+    state->delivery_timer.async_wait([state](const asio::error_code& error) {
+        if(error || state->closed) {
+            return;
+        }
+        state->delivery_in_progress = true;
+        PendingDelivery& delivery = state->pending_deliveries.front();
+        state->inner->async_write({asio::buffer(delivery.bytes->data(), delivery.size)},
+                                  [state](const asio::error_code& error, std::size_t) {
+                                      state->delivery_in_progress = false;
+                                      state->pending_deliveries.pop_front();
+                                      if(error) {
+                                          state->delivery_error = error;
+                                          state->pending_deliveries.clear();
+                                      }
+                                      deliver_next(state);
+                                  });
+    });
+}
+
+void FaultInjectingTransport::close_now(const std::shared_ptr<State>& state) {
+    state->closed = true;
+    state->delivery_timer.cancel();
+    // The wrapped transport may still be reading the delivery in progress until its handler runs
+    state->pending_deliveries.erase(state->pending_deliveries.begin() + (state->delivery_in_progress ? 1 : 0),
+                                    state->pending_deliveries.end());
+    state->inner->close();
+}
+
+void FaultInjectingTransport::close() {
+    if(state->closed) {
+        return;
+    }
+    state->close_requested = true;
+    if(state->pending_deliveries.empty() && !state->delivery_in_progress) {
+        close_now(state);
+    }
+}
+
+}  // namespace adq
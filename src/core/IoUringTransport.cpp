@@ -0,0 +1,440 @@
+#include "adq/core/IoUringTransport.hpp"
+
+#ifdef ADQ_HAS_IO_URING
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <system_error>
+
+namespace adq {
+
+namespace {
+/** Converts the result of an io_uring operation to an ASIO error code */
+asio::error_code to_error_code(int result) {
+    return result < 0 ? asio::error_code(-result, asio::error::get_system_category()) : asio::error_code();
+}
+}  // namespace
+
+IoUringService::IoUringService(asio::io_context& io_context, unsigned entries)
+    : ring(entries),
+      strand(asio::make_strand(io_context)),
+      completion_event(strand),
+      next_operation_id(1),
+      submit_scheduled(false) {
+    int event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if(event_fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "eventfd");
+    }
+    completion_event.assign(event_fd);
+    ring.register_eventfd(event_fd);
+    wait_for_completions();
+}
+
+std::uint64_t IoUringService::start_operation(Preparer prepare, CompletionHandler handler) {
+    const std::uint64_t operation_id = next_operation_id++;
+    asio::post(strand, [this, operation_id, prepare = std::move(prepare), handler = std::move(handler)]() {
+        queue_operation(operation_id, prepare, std::move(handler));
+    });
+    return operation_id;
+}
+
+void IoUringService::cancel_operation(std::uint64_t operation_id) {
+    start_operation(
+        [operation_id](io_uring_sqe& sqe) {
+            sqe.opcode = IORING_OP_ASYNC_CANCEL;
+            sqe.fd = -1;
+            sqe.addr = operation_id;
+        },
+        nullptr);
+}
+
+void IoUringService::queue_operation(std::uint64_t operation_id, const Preparer& prepare, CompletionHandler handler) {
+    io_uring_sqe* sqe = ring.get_sqe();
+    if(sqe == nullptr) {
+        // The queue is full of entries that haven't been submitted yet, so submit them early
+        ring.submit();
+        sqe = ring.get_sqe();
+    }
+    if(sqe == nullptr) {
+        if(handler) {
+            handler(-EBUSY, false);
+        }
+        return;
+    }
+    prepare(*sqe);
+    sqe->user_data = operation_id;
+    operations.emplace(operation_id, std::move(handler));
+    schedule_submit();
+}
+
+void IoUringService::schedule_submit() {
+    if(submit_scheduled) {
+        return;
+    }
+    submit_scheduled = true;
+    // Operations started before this runs will be submitted along with this one
+    asio::post(strand, [this]() { submit(); });
+}
+
+void IoUringService::submit() {
+    submit_scheduled = false;
+    int result = ring.submit();
+    if(result == -EBUSY || result == -EAGAIN || result == -EINTR) {
+        // The kernel won't take more work until some completions are consumed
+        reap_completions();
+        schedule_submit();
+    } else if(result < 0) {
+        throw std::system_error(-result, std::generic_category(), "io_uring_enter");
+    }
+}
+
+void IoUringService::wait_for_completions() {
+    completion_event.async_wait(asio::posix::stream_descriptor::wait_read, [this](const asio::error_code& error) {
+        if(error) {
+            return;
+        }
+        // Reset the eventfd before reaping, so a completion posted during the reap signals it again
+        std::uint64_t num_signals;
+        asio::error_code ignored_error;
+        completion_event.read_some(asio::buffer(&num_signals, sizeof(num_signals)), ignored_error);
+        reap_completions();
+        wait_for_completions();
+    });
+}
+
+void IoUringService::reap_completions() {
+    ring.for_each_completion([this](const io_uring_cqe& cqe) {
+        auto operation = operations.find(cqe.user_data);
+        if(operation == operations.end()) {
+            return;
+        }
+        const bool more = cqe.flags & IORING_CQE_F_MORE;
+        CompletionHandler handler;
+        if(more) {
+            handler = operation->second;
+        } else {
+            handler = std::move(operation->second);
+            operations.erase(operation);
+        }
+        if(handler) {
+            handler(cqe.res, more);
+        }
+    });
+}
+
+IoUringTransport::IoUringTransport(IoUringService& service, asio::any_io_executor strand,
+                                   const asio::ip::tcp::endpoint& peer_endpoint, int hello_id)
+    : service(service),
+      strand(std::move(strand)),
+      socket_fd(-1),
+      peer_address_length(peer_endpoint.size()),
+      hello_id(hello_id),
+      write_iovec_index(0),
+      bytes_written(0),
+      read_operation(0),
+      write_operation(0),
+      closed(false) {
+    std::memcpy(&peer_address, peer_endpoint.data(), peer_endpoint.size());
+}
+
+IoUringTransport::IoUringTransport(IoUringService& service, asio::any_io_executor strand, int socket_fd)
+    : service(service),
+      strand(std::move(strand)),
+      socket_fd(socket_fd),
+      peer_address_length(0),
+      hello_id(0),
+      write_iovec_index(0),
+      bytes_written(0),
+      read_operation(0),
+      write_operation(0),
+      closed(false) {}
+
+IoUringTransport::~IoUringTransport() {
+    if(socket_fd >= 0) {
+        ::close(socket_fd);
+    }
+}
+
+template <typename Handler, typename... Args>
+void IoUringTransport::complete(Handler handler, Args... args) {
+    asio::post(strand, [handler = std::move(handler), args...]() { handler(args...); });
+}
+
+void IoUringTransport::async_connect(ConnectHandler handler) {
+    socket_fd = ::socket(peer_address.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(socket_fd < 0) {
+        complete(std::move(handler), to_error_code(-errno));
+        return;
+    }
+    // The handler keeps this transport alive (through its connection) until the connect completes
+    write_operation = service.start_operation(
+        [this](io_uring_sqe& sqe) {
+            sqe.opcode = IORING_OP_CONNECT;
+            sqe.fd = socket_fd;
+            sqe.addr = reinterpret_cast<std::uint64_t>(&peer_address);
+            sqe.off = peer_address_length;
+        },
+        [this, handler](int result, bool) {
+            if(result < 0) {
+                complete(handler, to_error_code(result));
+                return;
+            }
+            // Introduce this client; a new socket's send buffer always has room for the whole ID
+            write_operation = service.start_operation(
+                [this](io_uring_sqe& sqe) {
+                    sqe.opcode = IORING_OP_SEND;
+                    sqe.fd = socket_fd;
+                    sqe.addr = reinterpret_cast<std::uint64_t>(&hello_id);
+                    sqe.len = sizeof(hello_id);
+                    sqe.msg_flags = MSG_NOSIGNAL;
+                },
+                [this, handler](int result, bool) {
+                    if(result == sizeof(hello_id)) {
+                        complete(handler, asio::error_code());
+                    } else {
+                        complete(handler, result < 0 ? to_error_code(result) : asio::error_code(asio::error::broken_pipe));
+                    }
+                });
+        });
+}
+
+void IoUringTransport::async_read_some(asio::mutable_buffer buffer, IoHandler handler) {
+    if(closed) {
+        complete(std::move(handler), asio::error_code(asio::error::operation_aborted), std::size_t(0));
+        return;
+    }
+    read_operation = service.start_operation(
+        [this, buffer](io_uring_sqe& sqe) {
+            sqe.opcode = IORING_OP_RECV;
+            sqe.fd = socket_fd;
+            sqe.addr = reinterpret_cast<std::uint64_t>(buffer.data());
+            sqe.len = buffer.size();
+        },
+        [this, handler, buffer](int result, bool) {
+            asio::post(strand, [this, handler, buffer, result]() {
+                if(result < 0) {
+                    handler(to_error_code(result), 0);
+                } else if(result == 0 && buffer.size() > 0) {
+                    // A socket that was shut down by close() also reads as end-of-file
+                    handler(closed ? asio::error_code(asio::error::operation_aborted) : asio::error_code(asio::error::eof), 0);
+                } else {
+                    handler(asio::error_code(), result);
+                }
+            });
+        });
+}
+
+void IoUringTransport::async_write(const std::vector<asio::const_buffer>& buffers, IoHandler handler) {
+    write_iovecs.clear();
+    for(const auto& buffer : buffers) {
+        if(buffer.size() > 0) {
+            write_iovecs.push_back(iovec{const_cast<void*>(buffer.data()), buffer.size()});
+        }
+    }
+    write_iovec_index = 0;
+    bytes_written = 0;
+    continue_write(std::move(handler));
+}
+
+void IoUringTransport::continue_write(IoHandler handler) {
+    if(write_iovec_index == write_iovecs.size()) {
+        complete(std::move(handler), asio::error_code(), bytes_written);
+        return;
+    }
+    std::memset(&write_message, 0, sizeof(write_message));
+    write_message.msg_iov = &write_iovecs[write_iovec_index];
+    write_message.msg_iovlen = std::min<std::size_t>(write_iovecs.size() - write_iovec_index, IOV_MAX);
+    write_operation = service.start_operation(
+        [this](io_uring_sqe& sqe) {
+            sqe.opcode = IORING_OP_SENDMSG;
+            sqe.fd = socket_fd;
+            sqe.addr = reinterpret_cast<std::uint64_t>(&write_message);
+            sqe.msg_flags = MSG_NOSIGNAL;
+        },
+        [this, handler](int result, bool) {
+            asio::post(strand, [this, handler, result]() {
+                if(result < 0) {
+                    handler(to_error_code(result), bytes_written);
+                    return;
+                }
+                // Skip past the buffers (and the part of a buffer) that were sent
+                bytes_written += result;
+                std::size_t bytes_sent = result;
+                while(bytes_sent > 0 && write_iovec_index < write_iovecs.size()) {
+                    iovec& next = write_iovecs[write_iovec_index];
+                    if(bytes_sent < next.iov_len) {
+                        next.iov_base = static_cast<uint8_t*>(next.iov_base) + bytes_sent;
+                        next.iov_len -= bytes_sent;
+                        bytes_sent = 0;
+                    } else {
+                        bytes_sent -= next.iov_len;
+                        ++write_iovec_index;
+                    }
+                }
+                if(closed && write_iovec_index < write_iovecs.size()) {
+                    handler(asio::error::operation_aborted, bytes_written);
+                    return;
+                }
+                continue_write(handler);
+            });
+        });
+}
+
+void IoUringTransport::close() {
+    if(closed) {
+        return;
+    }
+    closed = true;
+    if(socket_fd >= 0) {
+        // Shutting down the socket makes any read or write in progress finish
+        ::shutdown(socket_fd, SHUT_RDWR);
+    }
+    if(read_operation != 0) {
+        service.cancel_operation(read_operation);
+    }
+    if(write_operation != 0) {
+        service.cancel_operation(write_operation);
+    }
+}
+
+IoUringListener::IoUringListener(IoUringService& service, asio::io_context& io_context,
+                                 const asio::ip::tcp::endpoint& listen_endpoint)
+    : service(service),
+      io_context(io_context),
+      use_multishot(true),
+      accept_operation(0),
+      closed(false) {
+    listen_fd = ::socket(listen_endpoint.protocol().family(), SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(listen_fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "socket");
+    }
+    // Match the options ASIO's acceptor uses
+    int reuse_address = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse_address, sizeof(reuse_address));
+    if(::bind(listen_fd, listen_endpoint.data(), listen_endpoint.size()) < 0
+       || ::listen(listen_fd, SOMAXCONN) < 0) {
+        int error = errno;
+        ::close(listen_fd);
+        throw std::system_error(error, std::generic_category(), "bind/listen");
+    }
+}
+
+IoUringListener::~IoUringListener() {
+    ::close(listen_fd);
+}
+
+void IoUringListener::start_accepting(AcceptHandler handler) {
+    accept_handler = std::move(handler);
+    start_accept();
+}
+
+void IoUringListener::start_accept() {
+    accept_operation = service.start_operation(
+        [this](io_uring_sqe& sqe) {
+            sqe.opcode = IORING_OP_ACCEPT;
+            sqe.fd = listen_fd;
+            sqe.accept_flags = SOCK_CLOEXEC;
+            if(use_multishot) {
+                sqe.ioprio |= IORING_ACCEPT_MULTISHOT;
+            }
+        },
+        [this](int result, bool more) { handle_accept_completion(result, more); });
+}
+
+void IoUringListener::handle_accept_completion(int result, bool more) {
+    if(closed) {
+        if(result >= 0) {
+            ::close(result);
+        }
+        return;
+    }
+    if(result == -EINVAL && use_multishot) {
+        // Kernels older than 5.19 reject multishot accepts
+        use_multishot = false;
+        start_accept();
+        return;
+    }
+    if(result < 0) {
+        accept_handler(to_error_code(result), nullptr, 0, asio::ip::address());
+    } else {
+        read_hello(result);
+    }
+    // A multishot accept keeps going until the kernel says it has stopped
+    if(!more) {
+        start_accept();
+    }
+}
+
+namespace {
+/**
+ * The state of one hello read that IoUringListener shares with its timeout.
+ * Whichever of the two finishes first sets finished, so that the other one
+ * knows not to touch the socket.
+ */
+struct HelloRead {
+    int hello_id = 0;
+    std::atomic<std::uint64_t> operation{0};
+    std::atomic<bool> finished{false};
+};
+}  // namespace
+
+void IoUringListener::read_hello(int socket_fd) {
+    // A TCP peer is identified by the address it connected from
+    asio::ip::tcp::endpoint remote_endpoint;
+    socklen_t remote_endpoint_size = remote_endpoint.capacity();
+    if(::getpeername(socket_fd, remote_endpoint.data(), &remote_endpoint_size) < 0) {
+        int error = errno;
+        ::close(socket_fd);
+        accept_handler(to_error_code(-error), nullptr, 0, asio::ip::address());
+        return;
+    }
+    remote_endpoint.resize(remote_endpoint_size);
+    const asio::ip::address remote_address = remote_endpoint.address();
+    auto hello = std::make_shared<HelloRead>();
+    hello->operation = service.start_operation(
+        [socket_fd, hello](io_uring_sqe& sqe) {
+            sqe.opcode = IORING_OP_RECV;
+            sqe.fd = socket_fd;
+            sqe.addr = reinterpret_cast<std::uint64_t>(&hello->hello_id);
+            sqe.len = sizeof(int);
+            sqe.msg_flags = MSG_WAITALL;
+        },
+        [this, socket_fd, hello, remote_address](int result, bool) {
+            if(hello->finished.exchange(true)) {
+                // The timeout already cancelled the read
+                ::close(socket_fd);
+                accept_handler(asio::error::timed_out, nullptr, 0, asio::ip::address());
+                return;
+            }
+            if(result != sizeof(int)) {
+                ::close(socket_fd);
+                accept_handler(result < 0 ? to_error_code(result) : asio::error_code(asio::error::eof), nullptr, 0,
+                               asio::ip::address());
+                return;
+            }
+            accept_handler(asio::error_code(),
+                           std::make_unique<IoUringTransport>(service, asio::make_strand(io_context), socket_fd),
+                           hello->hello_id, remote_address);
+        });
+    // The timer only cancels the read; the read's completion still owns the socket
+    auto hello_timer = std::make_shared<asio::steady_timer>(io_context, HELLO_TIMEOUT);
+    hello_timer->async_wait([this, hello, hello_timer](const asio::error_code& error) {
+        if(!error && !hello->finished.exchange(true)) {
+            service.cancel_operation(hello->operation);
+        }
+    });
+}
+
+void IoUringListener::close() {
+    closed = true;
+    service.cancel_operation(accept_operation);
+}
+
+}  // namespace adq
+
+#endif  // ADQ_HAS_IO_URING
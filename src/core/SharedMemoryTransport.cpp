@@ -0,0 +1,309 @@
+#include "adq/core/SharedMemoryTransport.hpp"
+
+#include <cstring>
+#include <system_error>
+#include <utility>
+
+namespace adq {
+
+SharedMemoryTransport::SharedMemoryTransport(asio::any_io_executor strand,
+                                             const asio::local::stream_protocol::endpoint& doorbell_endpoint,
+                                             const std::string& ring_name, std::size_t ring_capacity, int local_id)
+    : doorbell(std::move(strand)),
+      doorbell_endpoint(doorbell_endpoint),
+      ring_name(ring_name),
+      ring_capacity(ring_capacity),
+      local_id(local_id),
+      doorbell_wait_pending(false),
+      peer_closed(false),
+      write_buffer_index(0),
+      write_buffer_offset(0),
+      bytes_written(0) {}
+
+SharedMemoryTransport::SharedMemoryTransport(asio::local::stream_protocol::socket doorbell,
+                                             std::unique_ptr<util::SharedMemoryRing> send_ring,
+                                             std::unique_ptr<util::SharedMemoryRing> receive_ring)
+    : doorbell(std::move(doorbell)),
+      ring_capacity(0),
+      local_id(0),
+      send_ring(std::move(send_ring)),
+      receive_ring(std::move(receive_ring)),
+      doorbell_wait_pending(false),
+      peer_closed(false),
+      write_buffer_index(0),
+      write_buffer_offset(0),
+      bytes_written(0) {
+    this->doorbell.non_blocking(true);
+}
+
+void SharedMemoryTransport::async_connect(ConnectHandler handler) {
+    try {
+        send_ring = util::SharedMemoryRing::create(ring_name + CONNECTOR_TO_ACCEPTOR_SUFFIX, ring_capacity);
+        receive_ring = util::SharedMemoryRing::create(ring_name + ACCEPTOR_TO_CONNECTOR_SUFFIX, ring_capacity);
+    } catch(std::system_error& e) {
+        if(send_ring) {
+            send_ring->unlink();
+        }
+        asio::error_code error(e.code().value(), asio::error::get_system_category());
+        asio::post(doorbell.get_executor(), [handler, error]() { handler(error); });
+        return;
+    }
+    // The hello is the client's ID, the length of the ring name, and the name itself
+    const uint32_t name_length = ring_name.size();
+    hello.resize(sizeof(int) + sizeof(uint32_t) + name_length);
+    std::memcpy(hello.data(), &local_id, sizeof(int));
+    std::memcpy(hello.data() + sizeof(int), &name_length, sizeof(uint32_t));
+    std::memcpy(hello.data() + sizeof(int) + sizeof(uint32_t), ring_name.data(), name_length);
+    doorbell.async_connect(doorbell_endpoint, [this, handler](const asio::error_code& error) {
+        if(error) {
+            // The listener will never open the rings, so they must be removed here
+            send_ring->unlink();
+            receive_ring->unlink();
+            handler(error);
+            return;
+        }
+        asio::async_write(doorbell, asio::buffer(hello), [this, handler](const asio::error_code& error, std::size_t) {
+            if(!error) {
+                doorbell.non_blocking(true);
+            }
+            handler(error);
+        });
+    });
+}
+
+void SharedMemoryTransport::async_read_some(asio::mutable_buffer buffer, IoHandler handler) {
+    read_buffer = buffer;
+    read_handler = std::move(handler);
+    continue_read();
+}
+
+void SharedMemoryTransport::async_write(const std::vector<asio::const_buffer>& buffers, IoHandler handler) {
+    write_buffers = buffers;
+    write_buffer_index = 0;
+    write_buffer_offset = 0;
+    bytes_written = 0;
+    write_handler = std::move(handler);
+    continue_write();
+}
+
+void SharedMemoryTransport::close() {
+    asio::error_code ignored_error;
+    doorbell.close(ignored_error);
+}
+
+void SharedMemoryTransport::ring_doorbell() {
+    // If the socket is full, the other side has unread doorbell bytes and will wake up anyway
+    asio::error_code ignored_error;
+    const uint8_t ring = 1;
+    doorbell.write_some(asio::buffer(&ring, 1), ignored_error);
+}
+
+void SharedMemoryTransport::continue_write() {
+    if(peer_closed) {
+        complete(write_handler, asio::error::broken_pipe, bytes_written);
+        return;
+    }
+    while(true) {
+        bool ring_full = false;
+        std::size_t bytes_copied = 0;
+        while(write_buffer_index < write_buffers.size()) {
+            const asio::const_buffer& buffer = write_buffers[write_buffer_index];
+            const std::size_t copied = send_ring->write(static_cast<const uint8_t*>(buffer.data()) + write_buffer_offset,
+                                                        buffer.size() - write_buffer_offset);
+            bytes_copied += copied;
+            write_buffer_offset += copied;
+            if(write_buffer_offset < buffer.size()) {
+                ring_full = true;
+                break;
+            }
+            write_buffer_index++;
+            write_buffer_offset = 0;
+        }
+        bytes_written += bytes_copied;
+        if(bytes_copied > 0 && send_ring->take_reader_waiting()) {
+            ring_doorbell();
+        }
+        if(!ring_full) {
+            write_buffers.clear();
+            complete(write_handler, asio::error_code(), bytes_written);
+            return;
+        }
+        // Check again after setting the flag, in case the reader freed space before it could see the flag
+        send_ring->set_writer_waiting(true);
+        if(send_ring->free_space() == 0) {
+            wait_for_doorbell();
+            return;
+        }
+        send_ring->set_writer_waiting(false);
+    }
+}
+
+void SharedMemoryTransport::continue_read() {
+    if(read_buffer.size() == 0) {
+        complete(read_handler, asio::error_code(), 0);
+        return;
+    }
+    while(true) {
+        const std::size_t bytes_read = receive_ring->read(static_cast<uint8_t*>(read_buffer.data()), read_buffer.size());
+        if(bytes_read > 0) {
+            if(receive_ring->take_writer_waiting()) {
+                ring_doorbell();
+            }
+            complete(read_handler, asio::error_code(), bytes_read);
+            return;
+        }
+        // Bytes written before the peer closed its doorbell are still delivered before the EOF
+        if(peer_closed) {
+            complete(read_handler, asio::error::eof, 0);
+            return;
+        }
+        receive_ring->set_reader_waiting(true);
+        if(receive_ring->bytes_available() == 0) {
+            wait_for_doorbell();
+            return;
+        }
+        receive_ring->set_reader_waiting(false);
+    }
+}
+
+void SharedMemoryTransport::wait_for_doorbell() {
+    if(doorbell_wait_pending) {
+        return;
+    }
+    doorbell_wait_pending = true;
+    // A read or write is in progress for as long as the wait is, and its handler keeps this transport alive
+    doorbell.async_wait(asio::local::stream_protocol::socket::wait_read, [this](const asio::error_code& error) {
+        doorbell_wait_pending = false;
+        if(error) {
+            if(read_handler) {
+                complete(read_handler, error, 0);
+            }
+            if(write_handler) {
+                complete(write_handler, error, bytes_written);
+            }
+            return;
+        }
+        // Discard every doorbell byte that has arrived; one wakeup is enough for all of them
+        asio::error_code read_error;
+        while(!read_error) {
+            doorbell.read_some(asio::buffer(doorbell_scratch), read_error);
+        }
+        if(read_error != asio::error::would_block && read_error != asio::error::try_again) {
+            peer_closed = true;
+        }
+        if(read_handler) {
+            continue_read();
+        }
+        if(write_handler) {
+            continue_write();
+        }
+    });
+}
+
+void SharedMemoryTransport::complete(IoHandler& handler, const asio::error_code& error, std::size_t bytes_transferred) {
+    // The handler may start another operation, which would overwrite the member it came from
+    IoHandler completed_handler = std::move(handler);
+    handler = nullptr;
+    asio::post(doorbell.get_executor(), [completed_handler, error, bytes_transferred]() {
+        completed_handler(error, bytes_transferred);
+    });
+}
+
+void SharedMemoryListener::start_accepting(AcceptHandler handler) {
+    accept_handler = std::move(handler);
+    do_accept();
+}
+
+void SharedMemoryListener::do_accept() {
+    acceptor.async_accept(asio::make_strand(io_context),
+                          [this](const asio::error_code& error, asio::local::stream_protocol::socket doorbell) {
+                              if(error == asio::error::operation_aborted) {
+                                  return;
+                              }
+                              if(error) {
+                                  accept_handler(error, nullptr, 0, asio::ip::address());
+                              } else {
+                                  read_hello(std::move(doorbell));
+                              }
+                              do_accept();
+                          });
+}
+
+void SharedMemoryListener::read_hello(asio::local::stream_protocol::socket doorbell) {
+    // Shared memory only works within one host, so the peer can be identified by its user
+    if(!is_same_user(doorbell.native_handle())) {
+        asio::error_code ignored_error;
+        doorbell.close(ignored_error);
+        accept_handler(asio::error::access_denied, nullptr, 0, asio::ip::address());
+        return;
+    }
+    auto accepted_doorbell = std::make_shared<asio::local::stream_protocol::socket>(std::move(doorbell));
+    auto hello = std::make_shared<std::vector<uint8_t>>(sizeof(int) + sizeof(uint32_t));
+    // The timer shares the doorbell's strand, and covers both parts of the hello
+    auto hello_timer = std::make_shared<asio::steady_timer>(accepted_doorbell->get_executor(), HELLO_TIMEOUT);
+    hello_timer->async_wait([accepted_doorbell](const asio::error_code& error) {
+        if(!error) {
+            asio::error_code ignored_error;
+            accepted_doorbell->close(ignored_error);
+        }
+    });
+    asio::async_read(*accepted_doorbell, asio::buffer(*hello), [this, accepted_doorbell, hello, hello_timer](const asio::error_code& error, std::size_t) {
+        if(error) {
+            hello_timer->cancel();
+            accept_handler(error == asio::error::operation_aborted ? asio::error::timed_out : error,
+                           nullptr, 0, asio::ip::address());
+            return;
+        }
+        int client_id;
+        uint32_t name_length;
+        std::memcpy(&client_id, hello->data(), sizeof(int));
+        std::memcpy(&name_length, hello->data() + sizeof(int), sizeof(uint32_t));
+        if(name_length == 0 || name_length > MAX_RING_NAME_LENGTH) {
+            hello_timer->cancel();
+            asio::error_code ignored_error;
+            accepted_doorbell->close(ignored_error);
+            accept_handler(asio::error::invalid_argument, nullptr, 0, asio::ip::address());
+            return;
+        }
+        auto ring_name = std::make_shared<std::string>(name_length, '\0');
+        asio::async_read(*accepted_doorbell, asio::buffer(&(*ring_name)[0], name_length),
+                         [this, accepted_doorbell, ring_name, client_id, hello_timer](const asio::error_code& error, std::size_t) {
+                             hello_timer->cancel();
+                             if(error) {
+                                 accept_handler(error == asio::error::operation_aborted ? asio::error::timed_out : error,
+                                                nullptr, 0, asio::ip::address());
+                                 return;
+                             }
+                             std::unique_ptr<util::SharedMemoryRing> send_ring;
+                             std::unique_ptr<util::SharedMemoryRing> receive_ring;
+                             try {
+                                 receive_ring = util::SharedMemoryRing::open(
+                                         *ring_name + SharedMemoryTransport::CONNECTOR_TO_ACCEPTOR_SUFFIX);
+                                 send_ring = util::SharedMemoryRing::open(
+                                         *ring_name + SharedMemoryTransport::ACCEPTOR_TO_CONNECTOR_SUFFIX);
+                             } catch(std::system_error& e) {
+                                 if(receive_ring) {
+                                     receive_ring->unlink();
+                                 }
+                                 accept_handler(asio::error_code(e.code().value(), asio::error::get_system_category()),
+                                                nullptr, 0, asio::ip::address());
+                                 return;
+                             }
+                             // Both sides have the rings mapped now, so their names are no longer needed
+                             receive_ring->unlink();
+                             send_ring->unlink();
+                             accept_handler(error,
+                                            std::make_unique<SharedMemoryTransport>(std::move(*accepted_doorbell),
+                                                                                    std::move(send_ring),
+                                                                                    std::move(receive_ring)),
+                                            client_id, asio::ip::address());
+                         });
+    });
+}
+
+void SharedMemoryListener::close() {
+    asio::error_code ignored_error;
+    acceptor.close(ignored_error);
+}
+
+}  // namespace adq
@@ -0,0 +1,17 @@
+#include "adq/core/Transport.hpp"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace adq {
+
+bool TransportListener::is_same_user(int socket_fd) {
+    struct ucred credentials;
+    socklen_t credentials_length = sizeof(credentials);
+    if(::getsockopt(socket_fd, SOL_SOCKET, SO_PEERCRED, &credentials, &credentials_length) < 0) {
+        return false;
+    }
+    return credentials.uid == ::getuid();
+}
+
+}  // namespace adq
@@ -0,0 +1,118 @@
+#include "adq/util/BufferPool.hpp"
+
+#include <algorithm>
+
+namespace adq {
+namespace util {
+
+constexpr std::size_t BufferPool::MIN_BUFFER_SIZE;
+constexpr std::size_t BufferPool::NUM_SIZE_CLASSES;
+constexpr std::size_t BufferPool::MAX_BUFFER_SIZE;
+constexpr std::size_t BufferPool::THREAD_CACHE_SIZE;
+constexpr std::size_t BufferPool::MAX_THREAD_CACHE_BYTES_PER_CLASS;
+constexpr std::size_t BufferPool::MAX_FREE_BYTES_PER_CLASS;
+
+BufferPool::BufferPool()
+    : bytes_in_use(0),
+      peak_bytes_in_use(0),
+      bytes_free(0),
+      heap_allocations(0),
+      reuses(0) {}
+
+BufferPool& BufferPool::getInstance() {
+    static BufferPool instance;
+    return instance;
+}
+
+BufferPool::ThreadCache& BufferPool::thread_cache() {
+    thread_local ThreadCache cache;
+    return cache;
+}
+
+BufferPool::ThreadCache::~ThreadCache() {
+    for(std::size_t size_class = 0; size_class < NUM_SIZE_CLASSES; ++size_class) {
+        getInstance().give_back(size_class, free_buffers[size_class], free_buffers[size_class].size());
+    }
+}
+
+std::size_t BufferPool::size_class_for(std::size_t size) {
+    std::size_t size_class = 0;
+    while(size_class + 1 < NUM_SIZE_CLASSES && (MIN_BUFFER_SIZE << size_class) < size) {
+        ++size_class;
+    }
+    return size_class;
+}
+
+std::shared_ptr<BufferPool::Buffer> BufferPool::acquire(std::size_t min_size) {
+    std::unique_ptr<Buffer> buffer;
+    if(min_size > MAX_BUFFER_SIZE) {
+        buffer = std::make_unique<Buffer>(min_size);
+        ++heap_allocations;
+    } else {
+        const std::size_t size_class = size_class_for(min_size);
+        auto& cached_buffers = thread_cache().free_buffers[size_class];
+        if(cached_buffers.empty()) {
+            // Refill half the cache at once, so the shared list's lock is taken less often;
+            // a class too large to cache still takes the one buffer it needs
+            SizeClass& shared = size_classes[size_class];
+            std::lock_guard<std::mutex> lock(shared.mutex);
+            const std::size_t count = std::min(shared.free_buffers.size(),
+                                               std::max<std::size_t>(thread_cache_capacity(size_class) / 2, 1));
+            for(std::size_t i = 0; i < count; ++i) {
+                cached_buffers.emplace_back(std::move(shared.free_buffers.back()));
+                shared.free_buffers.pop_back();
+            }
+            bytes_free -= count * (MIN_BUFFER_SIZE << size_class);
+        }
+        if(!cached_buffers.empty()) {
+            buffer = std::move(cached_buffers.back());
+            cached_buffers.pop_back();
+            ++reuses;
+        } else {
+            buffer = std::make_unique<Buffer>(MIN_BUFFER_SIZE << size_class);
+            ++heap_allocations;
+        }
+    }
+    const std::size_t in_use = bytes_in_use += buffer->size();
+    std::size_t peak = peak_bytes_in_use.load();
+    while(in_use > peak && !peak_bytes_in_use.compare_exchange_weak(peak, in_use)) {
+    }
+    return std::shared_ptr<Buffer>(buffer.release(), [](Buffer* released) { getInstance().release(released); });
+}
+
+void BufferPool::release(Buffer* buffer) {
+    std::unique_ptr<Buffer> owned_buffer(buffer);
+    bytes_in_use -= buffer->size();
+    if(buffer->size() > MAX_BUFFER_SIZE) {
+        return;
+    }
+    const std::size_t size_class = size_class_for(buffer->size());
+    auto& cached_buffers = thread_cache().free_buffers[size_class];
+    cached_buffers.emplace_back(std::move(owned_buffer));
+    const std::size_t cache_capacity = thread_cache_capacity(size_class);
+    if(cached_buffers.size() > cache_capacity) {
+        // This thread frees more than it allocates, so let other threads have all but half its cache
+        give_back(size_class, cached_buffers, cached_buffers.size() - cache_capacity / 2);
+    }
+}
+
+void BufferPool::give_back(std::size_t size_class, std::vector<std::unique_ptr<Buffer>>& buffers, std::size_t count) {
+    const std::size_t buffer_size = MIN_BUFFER_SIZE << size_class;
+    SizeClass& shared = size_classes[size_class];
+    std::lock_guard<std::mutex> lock(shared.mutex);
+    for(std::size_t i = 0; i < count && !buffers.empty(); ++i) {
+        // Beyond the limit, the buffer is freed when buffers.pop_back() destroys it
+        if((shared.free_buffers.size() + 1) * buffer_size <= MAX_FREE_BYTES_PER_CLASS) {
+            shared.free_buffers.emplace_back(std::move(buffers.back()));
+            bytes_free += buffer_size;
+        }
+        buffers.pop_back();
+    }
+}
+
+BufferPool::Metrics BufferPool::get_metrics() const {
+    return {bytes_in_use.load(), peak_bytes_in_use.load(), bytes_free.load(), heap_allocations.load(), reuses.load()};
+}
+
+}  // namespace util
+}  // namespace adq
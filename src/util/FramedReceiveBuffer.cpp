@@ -0,0 +1,98 @@
+#include "adq/util/FramedReceiveBuffer.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace adq {
+namespace util {
+
+constexpr std::size_t FramedReceiveBuffer::DEFAULT_CAPACITY;
+constexpr std::size_t FramedReceiveBuffer::MIN_READ_SIZE;
+constexpr std::size_t FramedReceiveBuffer::MAX_FRAME_SIZE;
+
+FramedReceiveBuffer::FramedReceiveBuffer(std::size_t initial_capacity)
+    : buffer(BufferPool::getInstance().acquire(std::max(initial_capacity, MIN_READ_SIZE))),
+      read_offset(0),
+      write_offset(0) {}
+
+uint8_t* FramedReceiveBuffer::prepare() {
+    // If the pending bytes include a frame header, make sure the whole frame will fit
+    std::size_t space_needed = MIN_READ_SIZE;
+    if(bytes_buffered() >= sizeof(frame_size_t) && !has_oversized_frame()) {
+        frame_size_t body_size;
+        std::memcpy(&body_size, buffer->data() + read_offset, sizeof(body_size));
+        const std::size_t frame_total = sizeof(frame_size_t) + body_size;
+        if(frame_total > bytes_buffered()) {
+            space_needed = std::max(space_needed, frame_total - bytes_buffered());
+        }
+    }
+    if(buffer.use_count() > 1) {
+        // Some frames in the current storage are still referenced, so any of it might be in use.
+        // Copy the partial frame into new storage rather than writing over them.
+        auto new_buffer = BufferPool::getInstance().acquire(std::max(DEFAULT_CAPACITY, bytes_buffered() + space_needed));
+        std::memcpy(new_buffer->data(), buffer->data() + read_offset, bytes_buffered());
+        write_offset -= read_offset;
+        read_offset = 0;
+        buffer = std::move(new_buffer);
+    } else if(free_space() < space_needed) {
+        // Move the partial frame to the front of the buffer, then grow it if that wasn't enough
+        if(read_offset > 0) {
+            std::memmove(buffer->data(), buffer->data() + read_offset, bytes_buffered());
+            write_offset -= read_offset;
+            read_offset = 0;
+        }
+        if(free_space() < space_needed) {
+            auto new_buffer = BufferPool::getInstance().acquire(write_offset + space_needed);
+            std::memcpy(new_buffer->data(), buffer->data(), write_offset);
+            buffer = std::move(new_buffer);
+        }
+    }
+    return buffer->data() + write_offset;
+}
+
+void FramedReceiveBuffer::commit(std::size_t bytes_received) {
+    write_offset = std::min(write_offset + bytes_received, buffer->size());
+}
+
+bool FramedReceiveBuffer::next_frame(const uint8_t*& frame_body, std::size_t& frame_size) {
+    if(bytes_buffered() < sizeof(frame_size_t)) {
+        return false;
+    }
+    frame_size_t body_size;
+    std::memcpy(&body_size, buffer->data() + read_offset, sizeof(body_size));
+    if(body_size > MAX_FRAME_SIZE || bytes_buffered() - sizeof(frame_size_t) < body_size) {
+        return false;
+    }
+    frame_body = buffer->data() + read_offset + sizeof(frame_size_t);
+    frame_size = body_size;
+    read_offset += sizeof(frame_size_t) + body_size;
+    // If everything has been parsed, the next read can start at the front of the buffer.
+    // This doesn't move any bytes, so frame_body stays valid.
+    if(read_offset == write_offset) {
+        read_offset = 0;
+        write_offset = 0;
+    }
+    return true;
+}
+
+bool FramedReceiveBuffer::has_oversized_frame() const {
+    if(bytes_buffered() < sizeof(frame_size_t)) {
+        return false;
+    }
+    frame_size_t body_size;
+    std::memcpy(&body_size, buffer->data() + read_offset, sizeof(body_size));
+    return body_size > MAX_FRAME_SIZE;
+}
+
+std::shared_ptr<const uint8_t> FramedReceiveBuffer::share_frame(const uint8_t* frame_body) const {
+    // Aliasing constructor: points at the frame, but keeps the whole storage vector alive
+    return std::shared_ptr<const uint8_t>(buffer, frame_body);
+}
+
+void FramedReceiveBuffer::clear() {
+    read_offset = 0;
+    write_offset = 0;
+}
+
+}  // namespace util
+}  // namespace adq
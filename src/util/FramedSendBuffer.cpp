@@ -0,0 +1,108 @@
+#include "adq/util/FramedSendBuffer.hpp"
+
+#include <cstring>
+#include <mutex>
+
+namespace adq {
+namespace util {
+
+constexpr std::size_t FramedSendBuffer::MIN_REFERENCE_SIZE;
+constexpr std::size_t FramedSendBuffer::MAX_RECYCLED_BUFFERS;
+
+namespace {
+/* Frames are usually built on one thread and released on another, after
+ * their write completes, so the recycled frames are shared by all threads */
+std::mutex recycled_buffers_mutex;
+std::vector<std::unique_ptr<FramedSendBuffer>> recycled_buffers;
+}  // namespace
+
+FramedSendBuffer::FramedSendBuffer(std::size_t scratch_capacity) {
+    reset(scratch_capacity);
+}
+
+void FramedSendBuffer::reset(std::size_t scratch_capacity) {
+    scratch = BufferPool::getInstance().acquire(sizeof(frame_size_t) + scratch_capacity);
+    scratch_size = 0;
+    segments.clear();
+    buffer_sequence.clear();
+    retained_objects.clear();
+    total_size = 0;
+    // The header will be filled in by finish(), once the size of the body is known
+    append(sizeof(frame_size_t));
+}
+
+std::shared_ptr<FramedSendBuffer> FramedSendBuffer::create(std::size_t scratch_capacity) {
+    std::unique_ptr<FramedSendBuffer> send_buffer;
+    {
+        std::lock_guard<std::mutex> lock(recycled_buffers_mutex);
+        if(!recycled_buffers.empty()) {
+            send_buffer = std::move(recycled_buffers.back());
+            recycled_buffers.pop_back();
+        }
+    }
+    if(send_buffer) {
+        send_buffer->reset(scratch_capacity);
+    } else {
+        send_buffer = std::make_unique<FramedSendBuffer>(scratch_capacity);
+    }
+    return std::shared_ptr<FramedSendBuffer>(send_buffer.release(), &FramedSendBuffer::recycle);
+}
+
+void FramedSendBuffer::recycle(FramedSendBuffer* send_buffer) {
+    std::unique_ptr<FramedSendBuffer> owned_buffer(send_buffer);
+    // Release the scratch area and the retained messages now, rather than when the frame is reused
+    send_buffer->scratch.reset();
+    send_buffer->retained_objects.clear();
+    std::lock_guard<std::mutex> lock(recycled_buffers_mutex);
+    if(recycled_buffers.size() < MAX_RECYCLED_BUFFERS) {
+        recycled_buffers.emplace_back(std::move(owned_buffer));
+    }
+}
+
+uint8_t* FramedSendBuffer::append(std::size_t num_bytes) {
+    const std::size_t scratch_offset = scratch_size;
+    if(scratch_offset + num_bytes > scratch->size()) {
+        // Move to the next larger pooled buffer; size classes double, so this happens rarely
+        auto new_scratch = BufferPool::getInstance().acquire(scratch_offset + num_bytes);
+        std::memcpy(new_scratch->data(), scratch->data(), scratch_offset);
+        scratch = std::move(new_scratch);
+    }
+    scratch_size += num_bytes;
+    // Extend the last segment if it is also in the scratch area, rather than starting a new one
+    if(!segments.empty() && segments.back().data == nullptr) {
+        segments.back().length += num_bytes;
+    } else {
+        segments.push_back({nullptr, scratch_offset, num_bytes});
+    }
+    total_size += num_bytes;
+    return scratch->data() + scratch_offset;
+}
+
+void FramedSendBuffer::append_reference(const uint8_t* data, std::size_t num_bytes) {
+    if(num_bytes < MIN_REFERENCE_SIZE) {
+        std::memcpy(append(num_bytes), data, num_bytes);
+        return;
+    }
+    segments.push_back({data, 0, num_bytes});
+    total_size += num_bytes;
+}
+
+void FramedSendBuffer::retain(std::shared_ptr<const void> object) {
+    retained_objects.emplace_back(std::move(object));
+}
+
+const std::vector<asio::const_buffer>& FramedSendBuffer::finish() {
+    const frame_size_t frame_body_size = body_size();
+    std::memcpy(scratch->data(), &frame_body_size, sizeof(frame_body_size));
+    // The scratch area can't move any more, so now it's safe to take pointers into it
+    buffer_sequence.clear();
+    buffer_sequence.reserve(segments.size());
+    for(const auto& segment : segments) {
+        const uint8_t* segment_start = segment.data ? segment.data : scratch->data() + segment.scratch_offset;
+        buffer_sequence.emplace_back(segment_start, segment.length);
+    }
+    return buffer_sequence;
+}
+
+}  // namespace util
+}  // namespace adq
@@ -0,0 +1,109 @@
+#include "adq/util/IoUring.hpp"
+
+#ifdef ADQ_HAS_IO_URING
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+namespace adq {
+namespace util {
+
+namespace {
+void* map_ring(int ring_fd, std::size_t size, off_t offset) {
+    void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, offset);
+    if(mapping == MAP_FAILED) {
+        int error = errno;
+        close(ring_fd);
+        throw std::system_error(error, std::generic_category(), "mmap io_uring");
+    }
+    return mapping;
+}
+}  // namespace
+
+IoUring::IoUring(unsigned entries) : local_sq_tail(0), num_unsubmitted(0) {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+    if(ring_fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "io_uring_setup");
+    }
+    sq_entries = params.sq_entries;
+    sq_mapping_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_mapping_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    // Newer kernels map both queues with a single mmap call
+    const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if(single_mmap) {
+        sq_mapping_size = cq_mapping_size = std::max(sq_mapping_size, cq_mapping_size);
+    }
+    sq_mapping = map_ring(ring_fd, sq_mapping_size, IORING_OFF_SQ_RING);
+    cq_mapping = single_mmap ? sq_mapping : map_ring(ring_fd, cq_mapping_size, IORING_OFF_CQ_RING);
+    sqes_mapping_size = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = static_cast<io_uring_sqe*>(map_ring(ring_fd, sqes_mapping_size, IORING_OFF_SQES));
+
+    uint8_t* sq_base = static_cast<uint8_t*>(sq_mapping);
+    sq_head = reinterpret_cast<unsigned*>(sq_base + params.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned*>(sq_base + params.sq_off.tail);
+    sq_ring_mask = reinterpret_cast<unsigned*>(sq_base + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned*>(sq_base + params.sq_off.array);
+    uint8_t* cq_base = static_cast<uint8_t*>(cq_mapping);
+    cq_head = reinterpret_cast<unsigned*>(cq_base + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(cq_base + params.cq_off.tail);
+    cq_ring_mask = reinterpret_cast<unsigned*>(cq_base + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(cq_base + params.cq_off.cqes);
+    local_sq_tail = *sq_tail;
+}
+
+IoUring::~IoUring() {
+    munmap(sqes, sqes_mapping_size);
+    if(cq_mapping != sq_mapping) {
+        munmap(cq_mapping, cq_mapping_size);
+    }
+    munmap(sq_mapping, sq_mapping_size);
+    // Closing the ring cancels any operations that are still in progress
+    close(ring_fd);
+}
+
+io_uring_sqe* IoUring::get_sqe() {
+    const unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    if(local_sq_tail - head >= sq_entries) {
+        return nullptr;
+    }
+    const unsigned index = local_sq_tail & *sq_ring_mask;
+    io_uring_sqe* sqe = &sqes[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sq_array[index] = index;
+    ++local_sq_tail;
+    ++num_unsubmitted;
+    return sqe;
+}
+
+int IoUring::submit() {
+    if(num_unsubmitted == 0) {
+        return 0;
+    }
+    // Publish the new entries to the kernel, then tell it how many there are
+    __atomic_store_n(sq_tail, local_sq_tail, __ATOMIC_RELEASE);
+    int submitted = syscall(__NR_io_uring_enter, ring_fd, num_unsubmitted, 0, 0, nullptr, 0);
+    if(submitted < 0) {
+        return -errno;
+    }
+    num_unsubmitted -= std::min<unsigned>(submitted, num_unsubmitted);
+    return submitted;
+}
+
+void IoUring::register_eventfd(int event_fd) {
+    if(syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_EVENTFD, &event_fd, 1) < 0) {
+        throw std::system_error(errno, std::generic_category(), "io_uring_register eventfd");
+    }
+}
+
+}  // namespace util
+}  // namespace adq
+
+#endif  // ADQ_HAS_IO_URING
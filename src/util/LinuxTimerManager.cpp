@@ -1,11 +1,13 @@
 #include "adq/util/LinuxTimerManager.hpp"
 
 #include <cassert>
+#include <cerrno>
 #include <csignal>
 #include <cstring>
 #include <ctime>
 #include <functional>
 #include <mutex>
+#include <system_error>
 #include <thread>
 
 namespace adq {
@@ -55,19 +57,33 @@ timer_id_t LinuxTimerManager::register_timer(const int delay_ms, std::function<v
     timer_event.sigev_signo = timer_signal_num;
     timer_event.sigev_value.sival_int = next_id;
 
+    // Timers are registered from several threads, and the callback thread removes them
+    std::lock_guard<std::mutex> lock(cancelled_timers_mutex);
     timer_t timer_handle;
     int success_flag = timer_create(CLOCK_REALTIME, &timer_event, &timer_handle);
     assert(success_flag == 0);
     timer_handles[next_id] = timer_handle;
     timer_callbacks[next_id] = callback;
 
-    // Arm the timer to fire once after delay_ms milliseconds
+    // Arm the timer to fire once after delay_ms milliseconds. tv_nsec must be
+    // less than a second, and an all-zero it_value would disarm the timer
+    // instead, so a delay of 0 or less fires after 1ns.
     struct itimerspec timer_spec = {0};
     timer_spec.it_interval.tv_sec = 0;
     timer_spec.it_interval.tv_nsec = 0;
-    timer_spec.it_value.tv_sec = 0;
-    timer_spec.it_value.tv_nsec = delay_ms * 1000000;
-    timer_settime(timer_handle, 0, &timer_spec, NULL);
+    if(delay_ms > 0) {
+        timer_spec.it_value.tv_sec = delay_ms / 1000;
+        timer_spec.it_value.tv_nsec = static_cast<long>(delay_ms % 1000) * 1000000;
+    } else {
+        timer_spec.it_value.tv_nsec = 1;
+    }
+    if(timer_settime(timer_handle, 0, &timer_spec, NULL) != 0) {
+        const int error = errno;
+        timer_delete(timer_handle);
+        timer_handles.erase(next_id);
+        timer_callbacks.erase(next_id);
+        throw std::system_error(error, std::system_category(), "timer_settime");
+    }
 
     return next_id++;  // Return current value, then increment it for next time
 }
@@ -99,20 +115,24 @@ void LinuxTimerManager::callback_thread_main() {
         if(!fired_timers.try_dequeue(callback_thread_token, timer_id)) {
             continue;
         }
-        std::unique_lock<std::mutex> cancelled_timers_lock(cancelled_timers_mutex);
-        // Only fire the trigger if the timer is not in the cancelled set
-        auto cancelled_location = cancelled_timers.find(timer_id);
-        if(cancelled_location == cancelled_timers.end()) {
-            // The callback may take a while, allow other cancellations while it is running
-            cancelled_timers_lock.unlock();
-            timer_callbacks.at(timer_id)();
-            cancelled_timers_lock.lock();
-        } else {
-            cancelled_timers.erase(cancelled_location);
+        std::function<void(void)> callback;
+        {
+            std::lock_guard<std::mutex> lock(cancelled_timers_mutex);
+            // Only fire the trigger if the timer is not in the cancelled set
+            auto cancelled_location = cancelled_timers.find(timer_id);
+            if(cancelled_location == cancelled_timers.end()) {
+                callback = std::move(timer_callbacks.at(timer_id));
+            } else {
+                cancelled_timers.erase(cancelled_location);
+            }
+            timer_callbacks.erase(timer_id);
+            timer_delete(timer_handles.at(timer_id));
+            timer_handles.erase(timer_id);
+        }
+        // The callback may take a while, so run it without the lock, allowing other registrations and cancellations
+        if(callback) {
+            callback();
         }
-        timer_callbacks.erase(timer_id);
-        timer_delete(tm_instance->timer_handles.at(timer_id));
-        timer_handles.erase(timer_id);
     }
 }
 
@@ -0,0 +1,46 @@
+#include "adq/util/OverlaySchedule.hpp"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+namespace adq {
+namespace util {
+
+OverlaySchedule::OverlaySchedule(int num_nodes)
+    : num_nodes(num_nodes),
+      cycle_start(0),
+      cycle_length(1) {
+    if(num_nodes < 1) {
+        throw std::invalid_argument("Can't build an overlay schedule for " + std::to_string(num_nodes) + " nodes");
+    }
+    // Double the offset each round until a value repeats, which closes the cycle
+    std::vector<int> round_first_seen(num_nodes, -1);
+    long offset = 1 % num_nodes;
+    for(int round = 0;; ++round) {
+        if(round_first_seen[offset] != -1) {
+            cycle_start = round_first_seen[offset];
+            cycle_length = round - cycle_start;
+            break;
+        }
+        round_first_seen[offset] = round;
+        offsets.push_back(static_cast<int>(offset));
+        offset = (offset * 2) % num_nodes;
+    }
+}
+
+const OverlaySchedule& OverlaySchedule::for_num_nodes(int num_nodes) {
+    static std::mutex schedules_mutex;
+    static std::map<int, std::unique_ptr<const OverlaySchedule>> schedules;
+    std::lock_guard<std::mutex> lock(schedules_mutex);
+    auto schedule_iter = schedules.find(num_nodes);
+    if(schedule_iter == schedules.end()) {
+        schedule_iter = schedules.emplace(num_nodes, std::make_unique<const OverlaySchedule>(num_nodes)).first;
+    }
+    return *schedule_iter->second;
+}
+
+}  // namespace util
+}  // namespace adq
@@ -6,7 +6,7 @@
  */
 
 #include "adq/util/PathFinder.hpp"
-#include "adq/util/Overlay.hpp"
+#include "adq/util/OverlaySchedule.hpp"
 
 #include <algorithm>
 #include <functional>
@@ -29,8 +29,8 @@ namespace util {
 
 const int MIN_PATH_LENGTH = 3;
 
-list<int> find_another(const int source, const int target, const int n, const int starting_round, const int max_round, set<int>& used_nodes);
-list<int> find_path(const int source, const int target, const int n, const int starting_round, const int max_round, const set<int>& exclude_nodes);
+list<int> find_another(const int source, const int target, const OverlaySchedule& schedule, const int starting_round, const int max_round, set<int>& used_nodes);
+list<int> find_path(const int source, const int target, const OverlaySchedule& schedule, const int starting_round, const int max_round, const set<int>& exclude_nodes);
 
 //Trivial helper struct for the find_path function. Note that its hash code is defined down at the bottom.
 struct InfectedNode {
@@ -67,9 +67,10 @@ namespace util {
 std::vector<std::list<int>> find_paths(const int source_id, const std::vector<int>& target_ids, const int num_nodes, const int start_round) {
     set<int> used_nodes(target_ids.begin(), target_ids.end());
     std::vector<list<int>> paths(target_ids.size());
+    const OverlaySchedule& schedule = OverlaySchedule::for_num_nodes(num_nodes);
     int rounds_limit = static_cast<int>(ceil(log2(num_nodes))) * target_ids.size() + MIN_PATH_LENGTH;
     for(size_t i = 0; i < target_ids.size(); ++i) {
-        paths[i] = find_another(source_id, target_ids[i], num_nodes, start_round, start_round + rounds_limit, used_nodes);
+        paths[i] = find_another(source_id, target_ids[i], schedule, start_round, start_round + rounds_limit, used_nodes);
         paths[i].pop_front();
     }
     return paths;
@@ -83,7 +84,7 @@ std::vector<std::list<int>> find_paths(const int source_id, const std::vector<in
  * there.
  * @param source The ID of the source node
  * @param target The ID of the target node
- * @param n The total number of nodes in the graph
+ * @param schedule The overlay schedule for the total number of nodes in the graph
  * @param starting_round The round number on which the path starts
  * @param max_round The maximum round number the path can extend to
  * @param used_nodes A reference to the set of nodes that have already been
@@ -91,11 +92,11 @@ std::vector<std::list<int>> find_paths(const int source_id, const std::vector<in
  * @return A path from {@code source} to {@code target}, including {@code source}
  *         but not {@code target}
  */
-list<int> find_another(const int source, const int target, const int n, const int starting_round, const int max_round, set<int>& used_nodes) {
-    if(target >= n) {
+list<int> find_another(const int source, const int target, const OverlaySchedule& schedule, const int starting_round, const int max_round, set<int>& used_nodes) {
+    if(target >= schedule.get_num_nodes()) {
         throw std::runtime_error(std::string("Invalid node number supplied to find_path: ") + std::to_string(target));
     }
-    list<int> path = find_path(source, target, n, starting_round, max_round, used_nodes);
+    list<int> path = find_path(source, target, schedule, starting_round, max_round, used_nodes);
     for(const auto& hop : path) {
         if(hop != source && hop != target) {
             used_nodes.insert(hop);
@@ -110,7 +111,7 @@ list<int> find_another(const int source, const int target, const int n, const in
  * "parent" of each node as the node that first infected it.
  * @param source
  * @param target
- * @param n The total number of nodes in the graph
+ * @param schedule The overlay schedule for the total number of nodes in the graph
  * @param starting_round The round number on which the path starts
  * @param max_round The maximum round number the path can be extended to before
  *        giving up on finding the target
@@ -120,14 +121,14 @@ list<int> find_another(const int source, const int target, const int n, const in
  *        method in the same findPaths call are referring to the same object)
  * @return The entire path
  */
-list<int> find_path(const int source, const int target, const int n, const int starting_round, const int max_round, const set<int>& exclude_nodes) {
+list<int> find_path(const int source, const int target, const OverlaySchedule& schedule, const int starting_round, const int max_round, const set<int>& exclude_nodes) {
     std::unordered_set<InfectedNode> infected;
     infected.insert(InfectedNode{source, starting_round, nullptr});
     //Propagate the infection one round at a time; this loop should not finish if the target can be reached
     for (int time = starting_round; time < max_round; time++) {
         std::unordered_set<InfectedNode> newInfectedNodes;
         for(const auto& infectedNode : infected) {
-            InfectedNode endPtNode{gossip_target(infectedNode.id, time, n), time+1, const_cast<InfectedNode*>(&infectedNode)};
+            InfectedNode endPtNode{schedule.gossip_target(infectedNode.id, time), time+1, const_cast<InfectedNode*>(&infectedNode)};
             //If the endpoint was already used, skip infecting it (note that target nodes are also on the used list)
             if (exclude_nodes.find(endPtNode.id) != exclude_nodes.end() && endPtNode.id != target)
                 continue;
@@ -0,0 +1,122 @@
+#include "adq/util/SharedMemoryRing.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <system_error>
+
+namespace adq {
+namespace util {
+
+SharedMemoryRing::SharedMemoryRing(const std::string& name, void* mapping, std::size_t mapped_size, std::size_t capacity)
+    : name(name),
+      header(static_cast<Header*>(mapping)),
+      data(static_cast<uint8_t*>(mapping) + sizeof(Header)),
+      mapped_size(mapped_size),
+      capacity(capacity) {}
+
+SharedMemoryRing::~SharedMemoryRing() {
+    munmap(header, mapped_size);
+}
+
+std::unique_ptr<SharedMemoryRing> SharedMemoryRing::create(const std::string& name, std::size_t capacity) {
+    // A segment left over from an earlier connection would have stale positions
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+    if(fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "shm_open " + name);
+    }
+    const std::size_t mapped_size = sizeof(Header) + capacity;
+    if(ftruncate(fd, mapped_size) < 0) {
+        int error = errno;
+        close(fd);
+        shm_unlink(name.c_str());
+        throw std::system_error(error, std::generic_category(), "ftruncate " + name);
+    }
+    void* mapping = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int error = errno;
+    close(fd);
+    if(mapping == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        throw std::system_error(error, std::generic_category(), "mmap " + name);
+    }
+    // The new segment is zero-filled, but the atomics still need to be constructed
+    Header* header = new(mapping) Header();
+    header->write_position.store(0);
+    header->read_position.store(0);
+    header->reader_waiting.store(false);
+    header->writer_waiting.store(false);
+    header->capacity = capacity;
+    return std::unique_ptr<SharedMemoryRing>(new SharedMemoryRing(name, mapping, mapped_size, capacity));
+}
+
+std::unique_ptr<SharedMemoryRing> SharedMemoryRing::open(const std::string& name) {
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if(fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "shm_open " + name);
+    }
+    struct stat segment_info;
+    if(fstat(fd, &segment_info) < 0 || static_cast<std::size_t>(segment_info.st_size) < sizeof(Header)) {
+        int error = errno ? errno : EINVAL;
+        close(fd);
+        throw std::system_error(error, std::generic_category(), "fstat " + name);
+    }
+    const std::size_t mapped_size = segment_info.st_size;
+    void* mapping = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int error = errno;
+    close(fd);
+    if(mapping == MAP_FAILED) {
+        throw std::system_error(error, std::generic_category(), "mmap " + name);
+    }
+    // The header was written by the other process, so its capacity must be checked before it is used
+    const std::uint64_t capacity = static_cast<Header*>(mapping)->capacity;
+    if(capacity == 0 || capacity > mapped_size - sizeof(Header)) {
+        munmap(mapping, mapped_size);
+        throw std::system_error(EINVAL, std::generic_category(), "Invalid capacity in ring " + name);
+    }
+    return std::unique_ptr<SharedMemoryRing>(new SharedMemoryRing(name, mapping, mapped_size, capacity));
+}
+
+void SharedMemoryRing::unlink() {
+    shm_unlink(name.c_str());
+}
+
+std::size_t SharedMemoryRing::bytes_available() const {
+    // The positions are shared with the other process, so don't trust them to be within the capacity
+    return std::min<std::size_t>(capacity, header->write_position.load() - header->read_position.load());
+}
+
+std::size_t SharedMemoryRing::write(const uint8_t* bytes, std::size_t num_bytes) {
+    const std::uint64_t write_position = header->write_position.load(std::memory_order_relaxed);
+    const std::uint64_t read_position = header->read_position.load(std::memory_order_acquire);
+    const std::size_t used = std::min<std::size_t>(capacity, write_position - read_position);
+    const std::size_t to_write = std::min(num_bytes, capacity - used);
+    // The free space may wrap around the end of the ring, so copy it in up to two pieces
+    const std::size_t start = write_position % capacity;
+    const std::size_t first_piece = std::min(to_write, capacity - start);
+    std::memcpy(data + start, bytes, first_piece);
+    std::memcpy(data, bytes + first_piece, to_write - first_piece);
+    header->write_position.store(write_position + to_write);
+    return to_write;
+}
+
+std::size_t SharedMemoryRing::read(uint8_t* buffer, std::size_t max_bytes) {
+    const std::uint64_t read_position = header->read_position.load(std::memory_order_relaxed);
+    const std::uint64_t write_position = header->write_position.load(std::memory_order_acquire);
+    const std::size_t to_read = std::min({max_bytes, capacity, static_cast<std::size_t>(write_position - read_position)});
+    const std::size_t start = read_position % capacity;
+    const std::size_t first_piece = std::min(to_read, capacity - start);
+    std::memcpy(buffer, data + start, first_piece);
+    std::memcpy(buffer + first_piece, data, to_read - first_piece);
+    header->read_position.store(read_position + to_read);
+    return to_read;
+}
+
+}  // namespace util
+}  // namespace adq
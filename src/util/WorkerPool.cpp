@@ -0,0 +1,108 @@
+#include "adq/util/WorkerPool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+
+namespace adq {
+namespace util {
+
+WorkerPool::WorkerPool(std::size_t num_threads) : shutting_down(false) {
+    workers.reserve(num_threads);
+    for(std::size_t i = 0; i < num_threads; ++i) {
+        workers.emplace_back(&WorkerPool::worker_main, this);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(tasks_mutex);
+        shutting_down = true;
+    }
+    tasks_available.notify_all();
+    for(auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void WorkerPool::worker_main() {
+    while(true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(tasks_mutex);
+            tasks_available.wait(lock, [this]() { return shutting_down || !tasks.empty(); });
+            if(tasks.empty()) {
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+namespace {
+/**
+ * The progress of one call to parallel_for, which is shared with its helper
+ * tasks. A helper that only starts after every index has been claimed does
+ * nothing, so the call can return without waiting for it.
+ */
+struct ParallelForState {
+    const std::function<void(std::size_t)>* body;
+    std::size_t count;
+    std::atomic<std::size_t> next_index{0};
+    std::mutex done_mutex;
+    std::condition_variable all_done;
+    std::size_t num_done = 0;
+    std::exception_ptr first_exception;
+
+    /** Claims and runs indices until there are none left */
+    void run() {
+        for(std::size_t index = next_index++; index < count; index = next_index++) {
+            std::exception_ptr exception;
+            try {
+                (*body)(index);
+            } catch(...) {
+                exception = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(done_mutex);
+            if(exception && !first_exception) {
+                first_exception = exception;
+            }
+            if(++num_done == count) {
+                all_done.notify_one();
+            }
+        }
+    }
+};
+}  // namespace
+
+void WorkerPool::parallel_for(std::size_t count, const std::function<void(std::size_t)>& body) {
+    if(count == 0) {
+        return;
+    }
+    auto state = std::make_shared<ParallelForState>();
+    state->body = &body;
+    state->count = count;
+    // The calling thread takes one share of the work itself
+    const std::size_t num_helpers = std::min(count - 1, workers.size());
+    if(num_helpers > 0) {
+        {
+            std::lock_guard<std::mutex> lock(tasks_mutex);
+            for(std::size_t i = 0; i < num_helpers; ++i) {
+                tasks.emplace_back([state]() { state->run(); });
+            }
+        }
+        tasks_available.notify_all();
+    }
+    state->run();
+    std::unique_lock<std::mutex> lock(state->done_mutex);
+    state->all_done.wait(lock, [&state]() { return state->num_done == state->count; });
+    if(state->first_exception) {
+        std::rethrow_exception(state->first_exception);
+    }
+}
+
+}  // namespace util
+}  // namespace adq